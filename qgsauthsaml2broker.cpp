@@ -0,0 +1,440 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2broker.h"
+#include "qgsapplication.h"
+#include "qgslogger.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStringList>
+#include <QThread>
+
+namespace
+{
+  enum Operation
+  {
+    ClaimOp = 1,
+    PublishOp,
+    ReleaseOp
+  };
+
+  const int CONNECT_TIMEOUT = 1000;
+  const qint64 MAX_FRAME = 1024 * 1024;
+
+  QMutex sMutex;
+  QThread *sThread = nullptr;
+  QgsAuthSAML2Broker *sBroker = nullptr;
+
+  // seconds a session without expiry is handed out, as for restored sessions
+  int assumedSessionLifetime()
+  {
+    return QSettings().value( "/auth/saml2/sessionLifetime", 28800 ).toInt();
+  }
+
+  // frames are a 32 bit size followed by a QDataStream of the message
+  void writeFrame( QLocalSocket *socket, const QByteArray &frame )
+  {
+    QByteArray size;
+    QDataStream out( &size, QIODevice::WriteOnly );
+    out << quint32( frame.size() );
+    socket->write( size );
+    socket->write( frame );
+  }
+
+  // false until a whole frame arrived; a frame that cannot be valid aborts the connection
+  bool readFrame( QLocalSocket *socket, QByteArray *frame )
+  {
+    if ( socket->bytesAvailable() < 4 )
+      return false;
+
+    quint32 size;
+    QDataStream in( socket->peek( 4 ) );
+    in >> size;
+    if ( size > MAX_FRAME )
+    {
+      socket->abort();
+      return false;
+    }
+    if ( socket->bytesAvailable() < 4 + qint64( size ) )
+      return false;
+
+    socket->read( 4 );
+    *frame = socket->read( size );
+    return true;
+  }
+
+  QByteArray serialized( const QgsAuthSAML2SessionStore::Record &record )
+  {
+    QList<QByteArray> cookies;
+    Q_FOREACH ( const QNetworkCookie &cookie, record.cookies )
+      cookies << cookie.toRawForm( QNetworkCookie::Full );
+
+    QByteArray data;
+    QDataStream out( &data, QIODevice::WriteOnly );
+    out << record.key << record.authcfg << record.url << cookies << record.obtained << record.expires;
+    return data;
+  }
+
+  bool deserialized( const QByteArray &data, QgsAuthSAML2SessionStore::Record *record )
+  {
+    QList<QByteArray> cookies;
+    QDataStream in( data );
+    in >> record->key >> record->authcfg >> record->url >> cookies >> record->obtained >> record->expires;
+    record->cookies.clear();
+    Q_FOREACH ( const QByteArray &cookie, cookies )
+      record->cookies << QNetworkCookie::parseCookies( cookie );
+    return in.status() == QDataStream::Ok && !record->cookies.isEmpty();
+  }
+
+  bool expired( const QByteArray &data, const QDateTime &now )
+  {
+    QgsAuthSAML2SessionStore::Record record;
+    if ( !deserialized( data, &record ) )
+      return true;
+    QDateTime expires = record.expires.isValid() ? record.expires : record.obtained.addSecs( assumedSessionLifetime() );
+    return expires <= now;
+  }
+}
+
+
+QgsAuthSAML2Broker::QgsAuthSAML2Broker()
+  : QObject()
+  , mServer( nullptr )
+  , mExpiryTimer( nullptr )
+{
+}
+
+bool QgsAuthSAML2Broker::isEnabled()
+{
+#if QT_VERSION >= 0x050000
+  return QSettings().value( "/auth/saml2/sessionBroker", false ).toBool();
+#else
+  // the socket cannot be restricted to the user
+  return false;
+#endif
+}
+
+QString QgsAuthSAML2Broker::serverName()
+{
+  // in the settings directory, so no other user can take the name first; processes
+  // sharing a profile share its authentication database and thus the authcfg ids
+#ifdef Q_OS_WIN
+  return QString( "qgis-saml2-%1" ).arg( QString( QCryptographicHash::hash( QgsApplication::qgisSettingsDirPath().toUtf8(),
+                                         QCryptographicHash::Sha1 ).toHex().left( 16 ) ) );
+#else
+  return QgsApplication::qgisSettingsDirPath() + "saml2broker";
+#endif
+}
+
+void QgsAuthSAML2Broker::ensureServer()
+{
+  QMutexLocker locker( &sMutex );
+  if ( sBroker )
+    return;
+
+  QThread *thread = new QThread();
+  thread->setObjectName( "SAML2 session broker" );
+  thread->start();
+
+  QgsAuthSAML2Broker *broker = new QgsAuthSAML2Broker();
+  broker->moveToThread( thread );
+  bool listening = false;
+  QMetaObject::invokeMethod( broker, "listen", Qt::BlockingQueuedConnection,
+                             Q_RETURN_ARG( bool, listening ), Q_ARG( QString, serverName() ) );
+  if ( listening )
+  {
+    sThread = thread;
+    sBroker = broker;
+    return;
+  }
+
+  // another process started serving in the meantime
+  thread->quit();
+  thread->wait();
+  delete thread;
+  delete broker;
+}
+
+void QgsAuthSAML2Broker::shutdown()
+{
+  QMutexLocker locker( &sMutex );
+  if ( sThread )
+  {
+    sThread->quit();
+    sThread->wait();
+    delete sThread;
+    sThread = nullptr;
+
+    delete sBroker;
+    sBroker = nullptr;
+  }
+}
+
+bool QgsAuthSAML2Broker::listen( const QString &name )
+{
+  mServer = new QLocalServer( this );
+#if QT_VERSION >= 0x050000
+  mServer->setSocketOptions( QLocalServer::UserAccessOption );
+#endif
+  if ( !mServer->listen( name ) )
+  {
+    if ( mServer->serverError() != QAbstractSocket::AddressInUseError )
+      return false;
+
+    // a live broker accepts connections, a socket left behind by a crashed process does not
+    QLocalSocket probe;
+    probe.connectToServer( name );
+    if ( probe.waitForConnected( CONNECT_TIMEOUT ) )
+      return false;
+
+    QLocalServer::removeServer( name );
+    if ( !mServer->listen( name ) )
+      return false;
+  }
+
+  connect( mServer, SIGNAL( newConnection() ), this, SLOT( onNewConnection() ) );
+  // created here, on the thread of the broker
+  mExpiryTimer = new QTimer( this );
+  connect( mExpiryTimer, SIGNAL( timeout() ), this, SLOT( expireClaims() ) );
+  mExpiryTimer->start( 5000 );
+  QgsDebugMsg( QString( "Serving SAML2 sessions at %1" ).arg( mServer->fullServerName() ) );
+  return true;
+}
+
+QByteArray QgsAuthSAML2Broker::call( const QByteArray &request, int msecs )
+{
+  QLocalSocket socket;
+  socket.connectToServer( serverName() );
+  if ( !socket.waitForConnected( CONNECT_TIMEOUT ) )
+  {
+    // nobody serves, or the process that did is gone
+    ensureServer();
+    socket.connectToServer( serverName() );
+    if ( !socket.waitForConnected( CONNECT_TIMEOUT ) )
+      return QByteArray();
+  }
+
+  writeFrame( &socket, request );
+
+  QElapsedTimer timer;
+  timer.start();
+  QByteArray answer;
+  while ( !readFrame( &socket, &answer ) )
+  {
+    qint64 left = msecs - timer.elapsed();
+    if ( left <= 0 || socket.state() != QLocalSocket::ConnectedState || !socket.waitForReadyRead( int( left ) ) )
+      return QByteArray();
+  }
+  return answer;
+}
+
+QgsAuthSAML2Broker::Answer QgsAuthSAML2Broker::claim( const QString &key, int msecs, QgsAuthSAML2SessionStore::Record *record )
+{
+  QByteArray request;
+  QDataStream out( &request, QIODevice::WriteOnly );
+  out << quint8( ClaimOp ) << key << qint32( msecs );
+
+  // the broker answers once the process logging in is done, or its time is up
+  QByteArray answer = call( request, msecs + CONNECT_TIMEOUT );
+  if ( answer.isEmpty() )
+    return Unavailable;
+
+  quint8 result;
+  QByteArray session;
+  QDataStream in( answer );
+  in >> result >> session;
+  if ( in.status() != QDataStream::Ok )
+    return Unavailable;
+  if ( result == Session )
+    return deserialized( session, record ) ? Session : Unavailable;
+  return result == Claimed ? Claimed : Unavailable;
+}
+
+void QgsAuthSAML2Broker::publish( const QgsAuthSAML2SessionStore::Record &record )
+{
+  QByteArray request;
+  QDataStream out( &request, QIODevice::WriteOnly );
+  out << quint8( PublishOp ) << record.key << serialized( record );
+  call( request, CONNECT_TIMEOUT );
+}
+
+void QgsAuthSAML2Broker::release( const QString &key )
+{
+  QByteArray request;
+  QDataStream out( &request, QIODevice::WriteOnly );
+  out << quint8( ReleaseOp ) << key;
+  call( request, CONNECT_TIMEOUT );
+}
+
+void QgsAuthSAML2Broker::onNewConnection()
+{
+  while ( QLocalSocket *socket = mServer->nextPendingConnection() )
+  {
+    connect( socket, SIGNAL( readyRead() ), this, SLOT( onReadyRead() ) );
+    connect( socket, SIGNAL( disconnected() ), socket, SLOT( deleteLater() ) );
+  }
+}
+
+void QgsAuthSAML2Broker::onReadyRead()
+{
+  QLocalSocket *socket = qobject_cast<QLocalSocket *>( sender() );
+  if ( !socket )
+    return;
+
+  QByteArray request;
+  while ( readFrame( socket, &request ) )
+    handle( socket, request );
+}
+
+void QgsAuthSAML2Broker::handle( QLocalSocket *socket, const QByteArray &request )
+{
+  quint8 operation;
+  QString key;
+  QDataStream in( request );
+  in >> operation >> key;
+  if ( in.status() != QDataStream::Ok )
+  {
+    socket->abort();
+    return;
+  }
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  switch ( operation )
+  {
+    case ClaimOp:
+    {
+      qint32 msecs;
+      in >> msecs;
+
+      QByteArray session = mSessions.value( key );
+      if ( !session.isEmpty() && !expired( session, QDateTime::currentDateTimeUtc() ) )
+      {
+        reply( socket, Session, session );
+        return;
+      }
+      mSessions.remove( key );
+
+      // another process is logging in, this one waits for its outcome
+      QHash<QString, Claim>::iterator it = mClaims.find( key );
+      if ( it != mClaims.end() && now < it->until )
+      {
+        Waiter waiter;
+        waiter.socket = socket;
+        waiter.msecs = msecs;
+        it->waiters << waiter;
+        return;
+      }
+
+      if ( it == mClaims.end() )
+        it = mClaims.insert( key, Claim() );
+      it->until = now + msecs;
+      reply( socket, Claimed );
+      return;
+    }
+
+    case PublishOp:
+    {
+      QByteArray session;
+      in >> session;
+      if ( in.status() == QDataStream::Ok && !session.isEmpty() )
+        mSessions.insert( key, session );
+      endClaim( key, session );
+      reply( socket, Unavailable );
+      return;
+    }
+
+    case ReleaseOp:
+      endClaim( key, QByteArray() );
+      reply( socket, Unavailable );
+      return;
+
+    default:
+      socket->abort();
+  }
+}
+
+void QgsAuthSAML2Broker::endClaim( const QString &key, const QByteArray &session )
+{
+  QHash<QString, Claim>::iterator it = mClaims.find( key );
+  if ( it == mClaims.end() )
+    return;
+
+  QList<Waiter> waiters = it->waiters;
+  mClaims.erase( it );
+
+  if ( !session.isEmpty() )
+  {
+    Q_FOREACH ( const Waiter &waiter, waiters )
+    {
+      if ( waiter.socket && waiter.socket->state() == QLocalSocket::ConnectedState )
+        reply( waiter.socket, Session, session );
+    }
+    return;
+  }
+
+  // the login failed or found nothing to log in to; the next process in line tries, the rest keep waiting
+  while ( !waiters.isEmpty() )
+  {
+    Waiter next = waiters.takeFirst();
+    if ( !next.socket || next.socket->state() != QLocalSocket::ConnectedState )
+      continue;
+
+    Claim claim;
+    claim.until = QDateTime::currentMSecsSinceEpoch() + next.msecs;
+    claim.waiters = waiters;
+    mClaims.insert( key, claim );
+    reply( next.socket, Claimed );
+    return;
+  }
+}
+
+void QgsAuthSAML2Broker::reply( QLocalSocket *socket, Answer answer, const QByteArray &session )
+{
+  QByteArray frame;
+  QDataStream out( &frame, QIODevice::WriteOnly );
+  out << quint8( answer ) << session;
+  writeFrame( socket, frame );
+}
+
+void QgsAuthSAML2Broker::expireClaims()
+{
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QStringList keys;
+  for ( QHash<QString, Claim>::const_iterator it = mClaims.constBegin(); it != mClaims.constEnd(); ++it )
+  {
+    if ( it->until <= now )
+      keys << it.key();
+  }
+  Q_FOREACH ( const QString &key, keys )
+    endClaim( key, QByteArray() );
+
+  QDateTime utcNow = QDateTime::currentDateTimeUtc();
+  QHash<QString, QByteArray>::iterator it = mSessions.begin();
+  while ( it != mSessions.end() )
+  {
+    if ( expired( it.value(), utcNow ) )
+      it = mSessions.erase( it );
+    else
+      ++it;
+  }
+}
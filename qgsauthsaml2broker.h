@@ -0,0 +1,125 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2BROKER_H
+#define QGSAUTHSAML2BROKER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QPointer>
+#include <QString>
+#include <QTimer>
+
+#include "qgsauthsaml2sessionstore.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+/**
+ * Shares SP sessions among the QGIS and qgis_process instances of a user.
+ *
+ * The first process that needs the broker serves it on a local socket in
+ * its settings directory, on a thread of its own; the others connect to it.
+ * Before logging in, a process claims the session key: it either gets the
+ * session another process established, or the right to log in itself while
+ * later claims for the key wait for its outcome. When the serving process
+ * exits, the next claim starts a new broker, with no sessions.
+ *
+ * It is enabled with the /auth/saml2/sessionBroker setting and needs Qt 5.
+ */
+class QgsAuthSAML2Broker : public QObject
+{
+  Q_OBJECT
+
+public:
+  enum Answer
+  {
+    Unavailable,  //!< no broker, or it did not answer in time
+    Session,      //!< another process has a session for the key
+    Claimed       //!< the caller logs in and publishes or releases the key
+  };
+
+  static bool isEnabled();
+
+  /**
+   * Asks for the session under key, waiting up to msecs while another process logs in.
+   * Blocks the calling thread.
+   */
+  static Answer claim( const QString &key, int msecs, QgsAuthSAML2SessionStore::Record *record );
+
+  /** Hands a session to the other processes, and ends the claim for its key */
+  static void publish( const QgsAuthSAML2SessionStore::Record &record );
+
+  /** Ends a claim without a session, the next waiting process logs in */
+  static void release( const QString &key );
+
+  /** Stops serving, called on plugin cleanup */
+  static void shutdown();
+
+private slots:
+  bool listen( const QString &name );
+
+  void onNewConnection();
+
+  void onReadyRead();
+
+  //! Claims of processes that went away without releasing them
+  void expireClaims();
+
+private:
+  struct Waiter
+  {
+    QPointer<QLocalSocket> socket;
+    qint32 msecs;       //!< time the process asked for its own login
+  };
+
+  struct Claim
+  {
+    Claim() : until( 0 ) {}
+
+    qint64 until;       //!< msecs since epoch the claiming process has for its login
+    QList<Waiter> waiters;
+  };
+
+  QgsAuthSAML2Broker();
+
+  static QString serverName();
+
+  //! Serves the broker in this process unless another process does
+  static void ensureServer();
+
+  //! Sends request and reads the answer; empty if the broker is not there
+  static QByteArray call( const QByteArray &request, int msecs );
+
+  void handle( QLocalSocket *socket, const QByteArray &request );
+
+  //! Ends the claim for key; all waiters get session if there is one, else the first waiter gets the claim
+  void endClaim( const QString &key, const QByteArray &session );
+
+  void reply( QLocalSocket *socket, Answer answer, const QByteArray &session = QByteArray() );
+
+  QLocalServer *mServer;
+  QTimer *mExpiryTimer;
+
+  //! Serialized records by key
+  QHash<QString, QByteArray> mSessions;
+  QHash<QString, Claim> mClaims;
+
+  Q_DISABLE_COPY( QgsAuthSAML2Broker )
+};
+
+#endif // QGSAUTHSAML2BROKER_H
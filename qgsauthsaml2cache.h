@@ -0,0 +1,190 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2CACHE_H
+#define QGSAUTHSAML2CACHE_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QString>
+
+/**
+ * Concurrent string keyed cache, split into shards that each carry their own
+ * reader/writer lock.
+ *
+ * Network requests of all rendering threads look up sessions and configs on
+ * every request, while writes only happen after a login or a config change.
+ * Lookups take a shared lock on one shard only, so readers never block each
+ * other and a writer only stalls the readers of its own shard.
+ *
+ * With a capacity, an insert into a full shard evicts the entry of that shard
+ * that was looked up least recently. Lookups only stamp an atomic, so the
+ * bound costs them no write lock; eviction is per shard and thus approximate.
+ */
+template <typename T, int Shards = 16>
+class QgsAuthSAML2ShardedCache
+{
+public:
+  QgsAuthSAML2ShardedCache() : mShardCapacity( 0 ) {}
+
+  /** Bounds the cache to about capacity entries, 0 for no bound */
+  void setCapacity( int capacity )
+  {
+    mShardCapacity = capacity > 0 ? qMax( 1, ( capacity + Shards - 1 ) / Shards ) : 0;
+  }
+
+  /** Copies the value for key into value, returns false if there is none */
+  bool lookup( const QString &key, T *value ) const
+  {
+    const Shard &shard = shardFor( key );
+    QReadLocker locker( &shard.lock );
+    typename QHash<QString, Item>::const_iterator it = shard.items.constFind( key );
+    if ( it == shard.items.constEnd() )
+      return false;
+    if ( mShardCapacity > 0 )
+      it->used.fetchAndStoreRelaxed( shard.clock.fetchAndAddRelaxed( 1 ) );
+    if ( value )
+      *value = it->value;
+    return true;
+  }
+
+  bool contains( const QString &key ) const
+  {
+    return lookup( key, nullptr );
+  }
+
+  T value( const QString &key, const T &defaultValue = T() ) const
+  {
+    T result;
+    return lookup( key, &result ) ? result : defaultValue;
+  }
+
+  void insert( const QString &key, const T &value )
+  {
+    Shard &shard = shardFor( key );
+    QWriteLocker locker( &shard.lock );
+    typename QHash<QString, Item>::iterator it = shard.items.find( key );
+    if ( it == shard.items.end() )
+    {
+      if ( mShardCapacity > 0 && shard.items.size() >= mShardCapacity )
+        evictOne( shard );
+      it = shard.items.insert( key, Item() );
+    }
+    it->value = value;
+    it->used.fetchAndStoreRelaxed( shard.clock.fetchAndAddRelaxed( 1 ) );
+  }
+
+  /** Returns true if an entry was removed */
+  bool remove( const QString &key )
+  {
+    Shard &shard = shardFor( key );
+    QWriteLocker locker( &shard.lock );
+    return shard.items.remove( key ) > 0;
+  }
+
+  void clear()
+  {
+    for ( int i = 0; i < Shards; ++i )
+    {
+      QWriteLocker locker( &mShards[i].lock );
+      mShards[i].items.clear();
+    }
+  }
+
+  /** Consistent copy of each shard, for occasional scans off the hot path */
+  QHash<QString, T> snapshot() const
+  {
+    QHash<QString, T> result;
+    for ( int i = 0; i < Shards; ++i )
+    {
+      QReadLocker locker( &mShards[i].lock );
+      for ( typename QHash<QString, Item>::const_iterator it = mShards[i].items.constBegin(); it != mShards[i].items.constEnd(); ++it )
+        result.insert( it.key(), it->value );
+    }
+    return result;
+  }
+
+  int size() const
+  {
+    int count = 0;
+    for ( int i = 0; i < Shards; ++i )
+    {
+      QReadLocker locker( &mShards[i].lock );
+      count += mShards[i].items.size();
+    }
+    return count;
+  }
+
+private:
+  struct Item
+  {
+    Item() {}
+    Item( const Item &other ) : value( other.value ), used( other.used.fetchAndAddRelaxed( 0 ) ) {}
+    Item &operator=( const Item &other )
+    {
+      value = other.value;
+      used.fetchAndStoreRelaxed( other.used.fetchAndAddRelaxed( 0 ) );
+      return *this;
+    }
+
+    T value;
+    mutable QAtomicInt used;   //!< shard clock at the last lookup
+  };
+
+  struct Shard
+  {
+    mutable QReadWriteLock lock;
+    mutable QAtomicInt clock;
+    QHash<QString, Item> items;
+  };
+
+  //! Drops the least recently used entry; caller holds the write lock of shard
+  static void evictOne( Shard &shard )
+  {
+    typename QHash<QString, Item>::iterator victim = shard.items.end();
+    uint now = uint( shard.clock.fetchAndAddRelaxed( 0 ) );
+    uint oldest = 0;
+    for ( typename QHash<QString, Item>::iterator it = shard.items.begin(); it != shard.items.end(); ++it )
+    {
+      // age rather than stamp, so the comparison survives the clock wrapping
+      uint age = now - uint( it->used.fetchAndAddRelaxed( 0 ) );
+      if ( victim == shard.items.end() || age > oldest )
+      {
+        victim = it;
+        oldest = age;
+      }
+    }
+    if ( victim != shard.items.end() )
+      shard.items.erase( victim );
+  }
+
+  Shard &shardFor( const QString &key )
+  {
+    return mShards[ qHash( key ) % Shards ];
+  }
+
+  const Shard &shardFor( const QString &key ) const
+  {
+    return mShards[ qHash( key ) % Shards ];
+  }
+
+  Shard mShards[Shards];
+  int mShardCapacity;
+
+  Q_DISABLE_COPY( QgsAuthSAML2ShardedCache )
+};
+
+#endif // QGSAUTHSAML2CACHE_H
@@ -0,0 +1,239 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2connections.h"
+#include "qgsauthmanager.h"
+#include "qgsnetworkaccessmanager.h"
+#include "qgslogger.h"
+#include "qgsmessagelog.h"
+#ifndef QT_NO_OPENSSL
+#include "qgsauthcertutils.h"
+#include "qgsauthconfig.h"
+#endif
+
+#include <QDateTime>
+#include <QNetworkProxyFactory>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QSet>
+#include <QStringList>
+#include <QUrl>
+#ifndef QT_NO_OPENSSL
+#include <QSslConfiguration>
+#endif
+
+static const QString AUTH_METHOD_KEY = "SAML2";
+
+namespace
+{
+  // Qt drops idle connections after two minutes, warming more often than this is wasted
+  const qint64 WARM_INTERVAL = 60 * 1000;
+
+  /**
+   * Asks the proxy factory of a QgsNetworkAccessManager, which owns it.
+   * That one applies the proxy factories registered with QGIS, the exclude
+   * list and the fallback proxy.
+   */
+  class ForwardingProxyFactory : public QNetworkProxyFactory
+  {
+    public:
+      explicit ForwardingProxyFactory( QNetworkAccessManager *nam )
+        : mNam( nam )
+      {}
+
+      QList<QNetworkProxy> queryProxy( const QNetworkProxyQuery &query = QNetworkProxyQuery() ) override
+      {
+        if ( mNam && mNam->proxyFactory() )
+          return mNam->proxyFactory()->queryProxy( query );
+        return QList<QNetworkProxy>() << QgsNetworkAccessManager::instance()->fallbackProxy();
+      }
+
+    private:
+      QPointer<QNetworkAccessManager> mNam;
+  };
+
+  QString sslHostPort( const QUrl &url )
+  {
+    return QString( "%1:%2" ).arg( url.host().trimmed() ).arg( url.port( 443 ) );
+  }
+}
+
+
+QgsAuthSAML2Connections::QgsAuthSAML2Connections()
+  : QObject()
+  , mIdpNam( nullptr )
+  , mSpNam( nullptr )
+{
+}
+
+QString QgsAuthSAML2Connections::hostKey( const QUrl &url )
+{
+  return QString( "%1:%2" ).arg( url.host() ).arg( url.port( url.scheme() == "https" ? 443 : 80 ) );
+}
+
+QNetworkAccessManager *QgsAuthSAML2Connections::idpManager()
+{
+  // The IdP leg answers authentication requests itself, so it runs on a manager of
+  // its own; prepare() and onSslErrors() give it the SSL settings, the proxies are
+  // those of the worker's QgsNetworkAccessManager.
+  if ( !mIdpNam )
+  {
+    mIdpNam = new QNetworkAccessManager( this );
+    mIdpNam->setProxyFactory( new ForwardingProxyFactory( spManager() ) );
+#ifndef QT_NO_OPENSSL
+    connect( mIdpNam, SIGNAL( sslErrors( QNetworkReply *, const QList<QSslError> & ) ),
+             this, SLOT( onSslErrors( QNetworkReply *, const QList<QSslError> & ) ) );
+#endif
+  }
+  return mIdpNam;
+}
+
+QNetworkAccessManager *QgsAuthSAML2Connections::spManager()
+{
+  // the per-thread manager of the worker outlives single handshakes
+  QNetworkAccessManager *nam = QgsNetworkAccessManager::instance();
+  if ( nam == mSpNam )
+    return nam;
+  mSpNam = nam;
+
+  // It relays authentication requests and SSL errors to the main thread and blocks
+  // until they are answered there. The main thread may itself be parked waiting for
+  // the handshake, so the relays are cut: unanswered requests fail the leg and the
+  // next request of the layer retries.
+  disconnect( nam, SIGNAL( authenticationRequired( QNetworkReply *, QAuthenticator * ) ), nullptr, nullptr );
+  disconnect( nam, SIGNAL( proxyAuthenticationRequired( const QNetworkProxy &, QAuthenticator * ) ), nullptr, nullptr );
+#ifndef QT_NO_OPENSSL
+  disconnect( nam, SIGNAL( sslErrors( QNetworkReply *, const QList<QSslError> & ) ), nullptr, nullptr );
+  connect( nam, SIGNAL( sslErrors( QNetworkReply *, const QList<QSslError> & ) ),
+           this, SLOT( onSslErrors( QNetworkReply *, const QList<QSslError> & ) ) );
+#endif
+  return nam;
+}
+
+void QgsAuthSAML2Connections::prepare( QNetworkRequest &request ) const
+{
+#ifndef QT_NO_OPENSSL
+  if ( request.url().scheme() != "https" )
+    return;
+
+  QSslConfiguration sslConfig = request.sslConfiguration();
+
+  // what QgsNetworkAccessManager::createRequest() does for its own requests
+  if ( !QgsAuthManager::instance()->isDisabled() )
+  {
+    sslConfig.setCaCertificates( QgsAuthManager::instance()->getTrustedCaCertsCache() );
+
+    QgsAuthConfigSslServer serverConfig = QgsAuthManager::instance()->getSslCertCustomConfigByHost( sslHostPort( request.url() ) );
+    if ( !serverConfig.isNull() )
+    {
+      sslConfig.setProtocol( serverConfig.sslProtocol() );
+      sslConfig.setPeerVerifyMode( serverConfig.sslPeerVerifyMode() );
+      sslConfig.setPeerVerifyDepth( serverConfig.sslPeerVerifyDepth() );
+    }
+  }
+
+#if QT_VERSION >= 0x050200
+  sslConfig.setSslOption( QSsl::SslOptionDisableSessionPersistence, false );
+  QByteArray ticket = mTlsSessions.value( hostKey( request.url() ) );
+  if ( !ticket.isEmpty() )
+    sslConfig.setSessionTicket( ticket );
+#endif
+  request.setSslConfiguration( sslConfig );
+#else
+  Q_UNUSED( request )
+#endif
+}
+
+#ifndef QT_NO_OPENSSL
+void QgsAuthSAML2Connections::onSslErrors( QNetworkReply *reply, const QList<QSslError> &errors )
+{
+  // the errors the user accepted for this certificate and server, as QgisApp looks them up,
+  // and those of the SSL server configuration stored for it
+  const QString hostPort = sslHostPort( reply->url() );
+  const QString key = QString( "%1:%2" ).arg( QgsAuthCertUtils::shaHexForCert( reply->sslConfiguration().peerCertificate() ), hostPort );
+  QSet<QSslError::SslError> ignored = QgsAuthManager::instance()->getIgnoredSslErrorCache().value( key );
+  QgsAuthConfigSslServer serverConfig = QgsAuthManager::instance()->getSslCertCustomConfigByHost( hostPort );
+  if ( !serverConfig.isNull() )
+    ignored.unite( serverConfig.sslIgnoredErrorEnums().toSet() );
+
+  QStringList unexpected;
+  Q_FOREACH ( const QSslError &error, errors )
+  {
+    if ( error.error() != QSslError::NoError && !ignored.contains( error.error() ) )
+      unexpected << error.errorString();
+  }
+
+  if ( unexpected.isEmpty() )
+  {
+    reply->ignoreSslErrors();
+    return;
+  }
+
+  // there is no one to ask on the worker thread, the reply fails; said once per certificate and errors
+  const QString report = key + '|' + unexpected.join( "; " );
+  if ( mSslReported.contains( report ) )
+    return;
+  mSslReported.insert( report );
+  QgsMessageLog::logMessage( tr( "SSL errors connecting to %1: %2. Accept them for the server in the authentication settings to log in." )
+                             .arg( hostPort, unexpected.join( "; " ) ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+}
+#endif
+
+void QgsAuthSAML2Connections::remember( QNetworkReply *reply )
+{
+#if !defined(QT_NO_OPENSSL) && QT_VERSION >= 0x050200
+  if ( reply->url().scheme() != "https" )
+    return;
+
+  QByteArray ticket = reply->sslConfiguration().sessionTicket();
+  if ( !ticket.isEmpty() )
+    mTlsSessions.insert( hostKey( reply->url() ), ticket );
+#else
+  Q_UNUSED( reply )
+#endif
+}
+
+void QgsAuthSAML2Connections::prewarm( const QString &url, bool idp )
+{
+#if QT_VERSION >= 0x050200
+  QUrl target( url );
+  if ( !target.isValid() || target.host().isEmpty() )
+    return;
+
+  const QString key = hostKey( target );
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  if ( now - mWarmed.value( key, -WARM_INTERVAL ) < WARM_INTERVAL )
+    return;
+  mWarmed.insert( key, now );
+
+  QgsDebugMsg( QString( "Opening connection to %1 ahead of the SAML2 login" ).arg( key ) );
+  QNetworkAccessManager *nam = idp ? idpManager() : spManager();
+#ifndef QT_NO_OPENSSL
+  if ( target.scheme() == "https" )
+  {
+    QNetworkRequest request( target );
+    prepare( request );
+    nam->connectToHostEncrypted( target.host(), target.port( 443 ), request.sslConfiguration() );
+    return;
+  }
+#endif
+  nam->connectToHost( target.host(), target.port( 80 ) );
+#else
+  // Qt 4 has no way to open a connection without a request
+  Q_UNUSED( url )
+  Q_UNUSED( idp )
+#endif
+}
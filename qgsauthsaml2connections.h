@@ -0,0 +1,109 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2CONNECTIONS_H
+#define QGSAUTHSAML2CONNECTIONS_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#ifndef QT_NO_OPENSSL
+#include <QSslError>
+#endif
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QNetworkRequest;
+class QUrl;
+
+/**
+ * Connections of the handshake worker thread to SPs and IdPs.
+ *
+ * Lives on the worker thread, as do the network managers it hands out, so
+ * their keep-alive connections serve every handshake instead of a single
+ * request thread. TLS sessions of finished replies are offered to the next
+ * request for the same host, saving the full TLS handshake where the server
+ * supports session tickets. prewarm() opens a connection ahead of the first
+ * login.
+ *
+ * The IdP manager is a plain QNetworkAccessManager, configured the way
+ * QgsNetworkAccessManager configures its own: the proxies come from the QGIS
+ * proxy factory and its exclude list, https requests get the trusted CAs and
+ * server configuration of the auth database, and SSL errors the user chose to
+ * ignore for a server are ignored.
+ *
+ * Nothing is relayed to the main thread, which may be parked waiting for the
+ * handshake: SSL errors the user has not accepted yet and authentication
+ * requests of the SP or a proxy fail the leg.
+ */
+class QgsAuthSAML2Connections : public QObject
+{
+  Q_OBJECT
+
+public:
+  QgsAuthSAML2Connections();
+
+  /** Manager of the IdP leg, created on first use; worker thread only */
+  QNetworkAccessManager *idpManager();
+
+  /** Manager of the SP legs, the QgsNetworkAccessManager of the worker thread */
+  QNetworkAccessManager *spManager();
+
+  /**
+   * Applies the trusted CAs and the SSL server configuration of the auth database
+   * to an https request, and offers the TLS session of an earlier connection to its host
+   */
+  void prepare( QNetworkRequest &request ) const;
+
+  /** Keeps the TLS session of a reply for the next connection to its host */
+  void remember( QNetworkReply *reply );
+
+public slots:
+  /**
+   * Opens a connection to url unless one was opened recently.
+   * Invoke queued from other threads.
+   */
+  void prewarm( const QString &url, bool idp );
+
+private slots:
+#ifndef QT_NO_OPENSSL
+  //! Ignores the errors accepted for the server in the auth database, logs the others once
+  void onSslErrors( QNetworkReply *reply, const QList<QSslError> &errors );
+#endif
+
+private:
+  static QString hostKey( const QUrl &url );
+
+  QNetworkAccessManager *mIdpNam;
+
+  //! The manager spManager() last cut off from the main thread
+  QNetworkAccessManager *mSpNam;
+
+  //! TLS session tickets by host and port
+  QHash<QString, QByteArray> mTlsSessions;
+
+  //! msecs since epoch of the last prewarm by host and port
+  QHash<QString, qint64> mWarmed;
+
+  //! SSL errors already logged, by certificate, host and port
+  QSet<QString> mSslReported;
+
+  Q_DISABLE_COPY( QgsAuthSAML2Connections )
+};
+
+#endif // QGSAUTHSAML2CONNECTIONS_H
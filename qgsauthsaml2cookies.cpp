@@ -0,0 +1,203 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2cookies.h"
+
+#include <QStringList>
+
+namespace
+{
+  bool expired( const QNetworkCookie &cookie, const QDateTime &now )
+  {
+    return !cookie.isSessionCookie() && cookie.expirationDate() <= now;
+  }
+
+  bool sameCookie( const QNetworkCookie &a, const QNetworkCookie &b )
+  {
+    return a.name() == b.name() && a.domain() == b.domain() && a.path() == b.path();
+  }
+
+  // second-level labels the registries of country code TLDs hand out below, as in co.uk or com.au
+  const char *const REGISTRY_LABELS[] =
+  {
+    "ac", "co", "com", "edu", "go", "gob", "gov", "govt", "ltd", "mil", "ne", "net", "nic", "nom", "or", "org", "plc", "sch"
+  };
+
+  /**
+   * Whether domain, without its leading dot, is one under which anyone can register names.
+   * Short of the public suffix list this covers the TLDs themselves and the common
+   * second-level registries of country code TLDs.
+   */
+  bool isPublicSuffix( const QString &domain )
+  {
+    QStringList labels = domain.toLower().split( '.' );
+    if ( labels.size() == 1 )
+      return true;
+    if ( labels.size() != 2 || labels.at( 1 ).length() != 2 )
+      return false;
+
+    for ( size_t i = 0; i < sizeof( REGISTRY_LABELS ) / sizeof( REGISTRY_LABELS[0] ); ++i )
+    {
+      if ( labels.at( 0 ) == QLatin1String( REGISTRY_LABELS[i] ) )
+        return true;
+    }
+    return false;
+  }
+}
+
+
+bool QgsAuthSAML2Cookies::domainMatches( const QString &host, const QString &domain )
+{
+  // normalized() gives every Domain attribute a leading dot; without it the cookie is host-only
+  if ( !domain.startsWith( '.' ) )
+    return host.compare( domain, Qt::CaseInsensitive ) == 0;
+
+  return host.compare( domain.mid( 1 ), Qt::CaseInsensitive ) == 0
+         || host.endsWith( domain, Qt::CaseInsensitive );
+}
+
+bool QgsAuthSAML2Cookies::pathMatches( const QString &path, const QString &cookiePath )
+{
+  if ( !path.startsWith( cookiePath ) )
+    return false;
+  return path.length() == cookiePath.length()
+         || cookiePath.endsWith( '/' )
+         || path.at( cookiePath.length() ) == '/';
+}
+
+QList<QNetworkCookie> QgsAuthSAML2Cookies::normalized( const QList<QNetworkCookie> &cookies, const QUrl &origin )
+{
+  // the default path is the directory of the request path
+  QString defaultPath = origin.path();
+  int slash = defaultPath.lastIndexOf( '/' );
+  defaultPath = slash > 0 ? defaultPath.left( slash ) : QString( "/" );
+
+  QList<QNetworkCookie> result;
+  Q_FOREACH ( QNetworkCookie cookie, cookies )
+  {
+    if ( cookie.domain().isEmpty() )
+    {
+      cookie.setDomain( origin.host() );
+    }
+    else
+    {
+      // Qt keeps the Domain attribute as sent; like QNetworkCookie::normalize(), the
+      // leading dot tells it from a host-only cookie and covers the subdomains
+      if ( !cookie.domain().startsWith( '.' ) )
+        cookie.setDomain( '.' + cookie.domain() );
+      if ( !domainMatches( origin.host(), cookie.domain() ) )
+        continue;
+
+      // RFC 6265 5.3 step 5: a cookie for a public suffix would go to every site below it;
+      // the host itself may still set one, it becomes host-only
+      if ( isPublicSuffix( cookie.domain().mid( 1 ) ) )
+      {
+        if ( origin.host().compare( cookie.domain().mid( 1 ), Qt::CaseInsensitive ) != 0 )
+          continue;
+        cookie.setDomain( origin.host() );
+      }
+    }
+
+    if ( cookie.path().isEmpty() || !cookie.path().startsWith( '/' ) )
+      cookie.setPath( defaultPath );
+
+    result << cookie;
+  }
+  return result;
+}
+
+QList<QNetworkCookie> QgsAuthSAML2Cookies::matching( const QList<QNetworkCookie> &cookies, const QUrl &url, const QDateTime &now )
+{
+  const QString path = url.path().isEmpty() ? QString( "/" ) : url.path();
+  const bool secure = url.scheme() == "https";
+
+  QList<QNetworkCookie> result;
+  Q_FOREACH ( const QNetworkCookie &cookie, cookies )
+  {
+    if ( ( cookie.isSecure() && !secure ) || expired( cookie, now )
+         || !domainMatches( url.host(), cookie.domain() ) || !pathMatches( path, cookie.path() ) )
+      continue;
+    result << cookie;
+  }
+  return result;
+}
+
+void QgsAuthSAML2Cookies::merge( QList<QNetworkCookie> &into, const QList<QNetworkCookie> &from, const QDateTime &now )
+{
+  QList<QNetworkCookie>::iterator it = into.begin();
+  while ( it != into.end() )
+  {
+    if ( expired( *it, now ) )
+      it = into.erase( it );
+    else
+      ++it;
+  }
+
+  Q_FOREACH ( const QNetworkCookie &cookie, from )
+  {
+    for ( it = into.begin(); it != into.end(); ++it )
+    {
+      if ( sameCookie( *it, cookie ) )
+      {
+        into.erase( it );
+        break;
+      }
+    }
+
+    if ( !expired( cookie, now ) )
+      into << cookie;
+  }
+}
+
+bool QgsAuthSAML2Cookies::containsAll( const QList<QNetworkCookie> &cookies, const QList<QNetworkCookie> &subset )
+{
+  Q_FOREACH ( const QNetworkCookie &wanted, subset )
+  {
+    bool found = false;
+    Q_FOREACH ( const QNetworkCookie &cookie, cookies )
+    {
+      if ( cookie.name() == wanted.name() && cookie.value() == wanted.value() )
+      {
+        found = true;
+        break;
+      }
+    }
+    if ( !found )
+      return false;
+  }
+  return true;
+}
+
+void QgsAuthSAML2Cookies::remove( QList<QNetworkCookie> &cookies, const QList<QNetworkCookie> &remove )
+{
+  QList<QNetworkCookie>::iterator it = cookies.begin();
+  while ( it != cookies.end() )
+  {
+    bool drop = false;
+    Q_FOREACH ( const QNetworkCookie &cookie, remove )
+    {
+      if ( it->name() == cookie.name() && it->value() == cookie.value() )
+      {
+        drop = true;
+        break;
+      }
+    }
+
+    if ( drop )
+      it = cookies.erase( it );
+    else
+      ++it;
+  }
+}
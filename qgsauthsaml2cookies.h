@@ -0,0 +1,60 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2COOKIES_H
+#define QGSAUTHSAML2COOKIES_H
+
+#include <QDateTime>
+#include <QList>
+#include <QNetworkCookie>
+#include <QUrl>
+
+/**
+ * Cookie scoping of the SP sessions, after RFC 6265.
+ *
+ * A SP session is a list of cookies as the assertion consumer set them.
+ * normalized() fills in the defaults for domain and path once, when the
+ * cookies are received, so matching() can decide per request which of them
+ * to send.
+ */
+class QgsAuthSAML2Cookies
+{
+public:
+  /**
+   * Cookies set by a response from origin, with default domain and path; cookies for foreign domains are dropped.
+   * A Domain attribute gets a leading dot, a cookie without one is host-only.
+   * Cookies for a public suffix such as com or co.uk are dropped unless origin is that host.
+   */
+  static QList<QNetworkCookie> normalized( const QList<QNetworkCookie> &cookies, const QUrl &origin );
+
+  /** The cookies that go with a request to url */
+  static QList<QNetworkCookie> matching( const QList<QNetworkCookie> &cookies, const QUrl &url, const QDateTime &now );
+
+  /** Replaces cookies of the same name, domain and path; expired cookies delete their match */
+  static void merge( QList<QNetworkCookie> &into, const QList<QNetworkCookie> &from, const QDateTime &now );
+
+  /** True if every cookie of subset is in cookies with the same value */
+  static bool containsAll( const QList<QNetworkCookie> &cookies, const QList<QNetworkCookie> &subset );
+
+  /** Removes the cookies that have the name and value of one in remove */
+  static void remove( QList<QNetworkCookie> &cookies, const QList<QNetworkCookie> &remove );
+
+private:
+  static bool domainMatches( const QString &host, const QString &domain );
+
+  static bool pathMatches( const QString &path, const QString &cookiePath );
+};
+
+#endif // QGSAUTHSAML2COOKIES_H
@@ -0,0 +1,277 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2ecpcodec.h"
+
+#include <QXmlStreamReader>
+
+namespace
+{
+  const char *nsSOAP = "http://schemas.xmlsoap.org/soap/envelope/";
+  const char *nsECP = "urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp";
+  const char *nsPAOS = "urn:liberty:paos:2003-08";
+  const char *nsSAMLP = "urn:oasis:names:tc:SAML:2.0:protocol";
+  const char *nsSAML = "urn:oasis:names:tc:SAML:2.0:assertion";
+
+  /**
+   * Maps the character offsets of QXmlStreamReader to byte offsets of the
+   * UTF-8 envelope. Offsets must be requested in ascending order, so the
+   * envelope is walked once no matter how many offsets are needed.
+   */
+  class ByteOffsets
+  {
+  public:
+    explicit ByteOffsets( const QByteArray &data )
+      : mData( reinterpret_cast<const unsigned char *>( data.constData() ) )
+      , mSize( data.size() )
+      , mByte( 0 )
+      , mChar( 0 )
+    {
+      // the decoder swallows a byte order mark
+      if ( mSize >= 3 && mData[0] == 0xEF && mData[1] == 0xBB && mData[2] == 0xBF )
+        mByte = 3;
+    }
+
+    int byteOffset( qint64 charOffset )
+    {
+      while ( mChar < charOffset && mByte < mSize )
+      {
+        unsigned char c = mData[mByte];
+        int length = c < 0x80 ? 1 : ( c >> 5 ) == 0x06 ? 2 : ( c >> 4 ) == 0x0E ? 3 : ( c >> 3 ) == 0x1E ? 4 : 1;
+        mByte += length;
+        // characters outside the BMP are surrogate pairs in QString
+        mChar += length == 4 ? 2 : 1;
+      }
+      return qMin( mByte, mSize );
+    }
+
+  private:
+    const unsigned char *mData;
+    int mSize;
+    int mByte;
+    qint64 mChar;
+  };
+
+  bool endsTag( const QByteArray &data, int offset )
+  {
+    return offset > 0 && offset <= data.size() && data.at( offset - 1 ) == '>';
+  }
+
+  QString escaped( const QString &text )
+  {
+    QString result;
+    result.reserve( text.size() );
+    for ( int i = 0; i < text.size(); ++i )
+    {
+      const QChar c = text.at( i );
+      if ( c == '&' )
+        result += "&amp;";
+      else if ( c == '<' )
+        result += "&lt;";
+      else if ( c == '>' )
+        result += "&gt;";
+      else
+        result += c;
+    }
+    return result;
+  }
+
+  bool setError( QString *error, const QString &message )
+  {
+    if ( error )
+      *error = message;
+    return false;
+  }
+}
+
+
+bool QgsAuthSAML2EcpCodec::parseSpRequest( const QByteArray &envelope, SpRequest &request, QString *error )
+{
+  request = SpRequest();
+
+  QXmlStreamReader xml( envelope );
+  ByteOffsets offsets( envelope );
+  bool inHeader = false;
+
+  while ( !xml.atEnd() )
+  {
+    QXmlStreamReader::TokenType token = xml.readNext();
+    if ( token == QXmlStreamReader::StartElement )
+    {
+      if ( xml.namespaceUri() == nsSOAP && xml.name() == "Header" )
+      {
+        inHeader = true;
+        request.headerTagEnd = offsets.byteOffset( xml.characterOffset() );
+      }
+      else if ( inHeader && xml.namespaceUri() == nsECP )
+      {
+        request.isEcp = true;
+        if ( xml.name() == "RelayState" )
+          request.relayState = xml.readElementText();
+      }
+      else if ( inHeader && xml.namespaceUri() == nsPAOS && xml.name() == "Request" )
+      {
+        request.responseConsumerUrl = xml.attributes().value( "responseConsumerURL" ).toString();
+      }
+      else if ( xml.namespaceUri() == nsSAMLP && xml.name() == "AuthnRequest" )
+      {
+        // everything needed precedes the request itself
+        request.acsUrl = xml.attributes().value( "AssertionConsumerServiceURL" ).toString();
+        break;
+      }
+    }
+    else if ( token == QXmlStreamReader::EndElement && inHeader
+              && xml.namespaceUri() == nsSOAP && xml.name() == "Header" )
+    {
+      inHeader = false;
+      request.headerEnd = offsets.byteOffset( xml.characterOffset() );
+    }
+  }
+
+  if ( xml.hasError() )
+    return setError( error, QStringLiteral( "%1 at line %2" ).arg( xml.errorString() ).arg( xml.lineNumber() ) );
+
+  if ( request.headerTagEnd < 0 || request.headerEnd < 0 )
+    return setError( error, QStringLiteral( "SOAP header missing" ) );
+
+  // offsets are computed for UTF-8, anything else must not be spliced
+  if ( !endsTag( envelope, request.headerTagEnd ) || !endsTag( envelope, request.headerEnd ) )
+    return setError( error, QStringLiteral( "unsupported envelope encoding" ) );
+
+  return true;
+}
+
+QByteArray QgsAuthSAML2EcpCodec::idpRequest( const QByteArray &envelope, const SpRequest &request )
+{
+  // already empty
+  if ( request.headerTagEnd == request.headerEnd )
+    return envelope;
+
+  // <S:Header ...>...</S:Header> becomes <S:Header .../>
+  QByteArray result;
+  result.reserve( envelope.size() - ( request.headerEnd - request.headerTagEnd ) + 1 );
+  result.append( envelope.constData(), request.headerTagEnd - 1 );
+  result.append( "/>" );
+  result.append( envelope.constData() + request.headerEnd, envelope.size() - request.headerEnd );
+  return result;
+}
+
+bool QgsAuthSAML2EcpCodec::parseIdpResponse( const QByteArray &envelope, IdpResponse &response, QString *error )
+{
+  response = IdpResponse();
+
+  QXmlStreamReader xml( envelope );
+  ByteOffsets offsets( envelope );
+  bool inHeader = false;
+
+  while ( !xml.atEnd() )
+  {
+    qint64 tokenBegin = xml.characterOffset();
+    QXmlStreamReader::TokenType token = xml.readNext();
+    if ( token == QXmlStreamReader::StartElement )
+    {
+      if ( xml.namespaceUri() == nsSOAP && xml.name() == "Envelope" )
+      {
+        response.envelopePrefix = xml.prefix().toString();
+      }
+      else if ( xml.namespaceUri() == nsSOAP && xml.name() == "Header" )
+      {
+        inHeader = true;
+        response.headerPrefix = xml.prefix().toString();
+        response.headerTagEnd = offsets.byteOffset( xml.characterOffset() );
+      }
+      else if ( xml.namespaceUri() == nsSOAP && xml.name() == "Body" )
+      {
+        response.bodyBegin = offsets.byteOffset( tokenBegin );
+      }
+      else if ( inHeader && xml.namespaceUri() == nsECP && xml.name() == "Response" )
+      {
+        response.acsUrl = xml.attributes().value( "AssertionConsumerServiceURL" ).toString();
+      }
+      else if ( xml.namespaceUri() == nsSAML && xml.name() == "AuthnStatement" )
+      {
+        // the IdP may bound the SP session, unless the assertion is encrypted for the SP
+        QString notOnOrAfter = xml.attributes().value( "SessionNotOnOrAfter" ).toString();
+        response.sessionNotOnOrAfter = QDateTime::fromString( notOnOrAfter, Qt::ISODate );
+        break;
+      }
+    }
+    else if ( token == QXmlStreamReader::EndElement && inHeader
+              && xml.namespaceUri() == nsSOAP && xml.name() == "Header" )
+    {
+      inHeader = false;
+      response.headerSelfClosed = offsets.byteOffset( xml.characterOffset() ) == response.headerTagEnd;
+    }
+  }
+
+  if ( xml.hasError() )
+    return setError( error, QStringLiteral( "%1 at line %2" ).arg( xml.errorString() ).arg( xml.lineNumber() ) );
+
+  if ( response.headerTagEnd < 0 && response.bodyBegin < 0 )
+    return setError( error, QStringLiteral( "SOAP body missing" ) );
+
+  if ( ( response.headerTagEnd >= 0 && !endsTag( envelope, response.headerTagEnd ) )
+       || ( response.bodyBegin >= 0 && envelope.at( response.bodyBegin ) != '<' ) )
+    return setError( error, QStringLiteral( "unsupported envelope encoding" ) );
+
+  return true;
+}
+
+QByteArray QgsAuthSAML2EcpCodec::spResponse( const QByteArray &envelope, const IdpResponse &response, const QString &relayState )
+{
+  QString prefix = response.headerTagEnd >= 0 ? response.headerPrefix : response.envelopePrefix;
+  QString declaration;
+  if ( prefix.isEmpty() )
+  {
+    // SOAP is the default namespace, the header attributes still need a prefix
+    prefix = "S";
+    declaration = QStringLiteral( " xmlns:S=\"%1\"" ).arg( nsSOAP );
+  }
+
+  QByteArray relayStateBlock = QString( "<ecp:RelayState xmlns:ecp=\"%1\"%2 %3:actor=\"http://schemas.xmlsoap.org/soap/actor/next\" %3:mustUnderstand=\"1\">%4</ecp:RelayState>" )
+                               .arg( nsECP, declaration, prefix, escaped( relayState ) ).toUtf8();
+  QByteArray qualifiedHeader = ( response.headerPrefix.isEmpty() ? QString( "Header" ) : response.headerPrefix + ":Header" ).toUtf8();
+
+  QByteArray result;
+  result.reserve( envelope.size() + relayStateBlock.size() + 2 * qualifiedHeader.size() + 8 );
+
+  if ( response.headerTagEnd < 0 )
+  {
+    // no header at all, add one in front of the body
+    QByteArray envelopeHeader = ( response.envelopePrefix.isEmpty() ? QString( "Header" ) : response.envelopePrefix + ":Header" ).toUtf8();
+    result.append( envelope.constData(), response.bodyBegin );
+    result.append( '<' ).append( envelopeHeader ).append( '>' );
+    result.append( relayStateBlock );
+    result.append( "</" ).append( envelopeHeader ).append( '>' );
+    result.append( envelope.constData() + response.bodyBegin, envelope.size() - response.bodyBegin );
+  }
+  else if ( response.headerSelfClosed )
+  {
+    // <S:Header/> becomes <S:Header>...</S:Header>
+    int slash = envelope.lastIndexOf( '/', response.headerTagEnd - 1 );
+    result.append( envelope.constData(), slash );
+    result.append( '>' );
+    result.append( relayStateBlock );
+    result.append( "</" ).append( qualifiedHeader ).append( '>' );
+    result.append( envelope.constData() + response.headerTagEnd, envelope.size() - response.headerTagEnd );
+  }
+  else
+  {
+    result.append( envelope.constData(), response.headerTagEnd );
+    result.append( relayStateBlock );
+    result.append( envelope.constData() + response.headerTagEnd, envelope.size() - response.headerTagEnd );
+  }
+  return result;
+}
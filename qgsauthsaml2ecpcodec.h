@@ -0,0 +1,82 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2ECPCODEC_H
+#define QGSAUTHSAML2ECPCODEC_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QString>
+
+/**
+ * Single pass reader and rewriter of the SOAP envelopes exchanged during an
+ * ECP handshake.
+ *
+ * The envelopes carry XML signatures, so they must reach the IdP and the SP
+ * byte for byte. Instead of building a DOM, the codec streams over the raw
+ * bytes once with QXmlStreamReader, picks up the values it needs and records
+ * the byte offsets of the SOAP header. The rewrite then splices the new header
+ * between untouched slices of the original envelope in one allocation.
+ */
+class QgsAuthSAML2EcpCodec
+{
+public:
+  //! PAOS AuthnRequest envelope received from the SP
+  struct SpRequest
+  {
+    SpRequest() : isEcp( false ), headerTagEnd( -1 ), headerEnd( -1 ) {}
+
+    bool isEcp;                   //!< the header carries ECP blocks
+    QString relayState;           //!< text of ecp:RelayState
+    QString acsUrl;               //!< AssertionConsumerServiceURL of the AuthnRequest
+    QString responseConsumerUrl;  //!< responseConsumerURL of paos:Request
+    int headerTagEnd;             //!< byte offset just past the SOAP Header start tag
+    int headerEnd;                //!< byte offset just past the SOAP Header end tag
+  };
+
+  //! Envelope with the SAML response received from the IdP
+  struct IdpResponse
+  {
+    IdpResponse() : headerTagEnd( -1 ), headerSelfClosed( false ), bodyBegin( -1 ) {}
+
+    QString envelopePrefix;       //!< prefix of the SOAP envelope namespace
+    QString headerPrefix;         //!< prefix of the SOAP Header element
+    QString acsUrl;               //!< AssertionConsumerServiceURL of ecp:Response
+    QDateTime sessionNotOnOrAfter;
+    int headerTagEnd;             //!< byte offset just past the SOAP Header start tag, -1 without header
+    bool headerSelfClosed;
+    int bodyBegin;                //!< byte offset of the SOAP Body start tag
+  };
+
+  /**
+   * Reads the envelope of the SP up to the AuthnRequest.
+   * Returns false and sets error if it is not a SOAP envelope.
+   */
+  static bool parseSpRequest( const QByteArray &envelope, SpRequest &request, QString *error = nullptr );
+
+  //! The SP envelope as relayed to the IdP: the same bytes with an empty SOAP header
+  static QByteArray idpRequest( const QByteArray &envelope, const SpRequest &request );
+
+  /**
+   * Reads the envelope of the IdP.
+   * Returns false and sets error if it is not a SOAP envelope.
+   */
+  static bool parseIdpResponse( const QByteArray &envelope, IdpResponse &response, QString *error = nullptr );
+
+  //! The IdP envelope as posted to the SP: the same bytes with ecp:RelayState added to the header
+  static QByteArray spResponse( const QByteArray &envelope, const IdpResponse &response, const QString &relayState );
+};
+
+#endif // QGSAUTHSAML2ECPCODEC_H
@@ -15,26 +15,42 @@ email                : am at secure-dimensions dot de
 
 #include <QStandardItemModel>
 #include <QUrl>
-#include <QNetworkAccessManager>
-#include <QNetworkRequest>
-#include <QNetworkReply>
-#include <QXmlStreamReader>
+#include <QThread>
+#include <QFileDialog>
 #include <QMessageBox>
 
 #include "qgsauthsaml2edit.h"
+#include "qgsauthsaml2providermodel.h"
 #include "ui_qgsauthsaml2edit.h"
 #include "qgslogger.h"
 
+namespace
+{
+  // item data of the provider combo box holding every SOAP endpoint of the IdP
+  const int ProviderUrlsRole = Qt::UserRole + 1;
+}
+
 QgsAuthSAML2Edit::QgsAuthSAML2Edit( QWidget *parent )
   : QgsAuthMethodEdit( parent )
   , mValid( 0 )
+  , mLoaderThread( nullptr )
+  , mLoader( nullptr )
+  , mProviderModel( nullptr )
 {
   setupUi( this );
+  mProviderModel = new QgsAuthSAML2ProviderModel( this );
+  lvProviders->setModel( mProviderModel );
   setupConnections();
 }
 
 QgsAuthSAML2Edit::~QgsAuthSAML2Edit()
 {
+  if ( mLoaderThread )
+  {
+    // the loader is deleted by the thread on its way out
+    mLoaderThread->quit();
+    mLoaderThread->wait();
+  }
 }
 
 bool QgsAuthSAML2Edit::validateConfig()
@@ -55,8 +71,11 @@ QgsStringMap QgsAuthSAML2Edit::configMap() const
   config.insert( "username", leUsername->text() );
   config.insert( "password", lePassword->text() );
   config.insert( "federationurl", leFedUrl->text() );
+  config.insert( "federationcert", leFedCert->text() );
   config.insert( "providername", cbProviders->currentText() );
   config.insert( "providerurl", cbProviders->itemData( cbProviders->currentIndex() ).toString() );
+  // URLs have no spaces, the list fits the flat config
+  config.insert( "providerurls", cbProviders->itemData( cbProviders->currentIndex(), ProviderUrlsRole ).toStringList().join( " " ) );
 
   return config;
 }
@@ -69,8 +88,10 @@ void QgsAuthSAML2Edit::loadConfig( const QgsStringMap &configmap )
   leUsername->setText( configmap.value( "username" ) );
   lePassword->setText( configmap.value( "password" ) );
   leFedUrl->setText( configmap.value( "federationurl" ) );
+  leFedCert->setText( configmap.value( "federationcert" ) );
   cbProviders->clear();
   cbProviders->addItem( configmap.value( "providername" ), configmap.value( "providerurl" ) );
+  cbProviders->setItemData( 0, configmap.value( "providerurls" ).split( ' ', QString::SkipEmptyParts ), ProviderUrlsRole );
 
   validateConfig();
 }
@@ -86,7 +107,9 @@ void QgsAuthSAML2Edit::clearConfig()
   lePassword->clear();
   chkPasswordShow->setChecked( false );
   leFedUrl->clear();
+  leFedCert->clear();
   cbProviders->clear();
+  leProviderSearch->clear();
   //btnGetProviders->setEnabled(false);
 }
 
@@ -107,6 +130,14 @@ void QgsAuthSAML2Edit::setupConnections()
     this, SLOT( onFedUrlChanged( const QString& ) ) );
   connect( btnGetProviders, SIGNAL ( clicked() ), 
     this, SLOT( loadFederationMetadata() ) );
+  connect( btnFedCert, SIGNAL( clicked() ),
+    this, SLOT( selectFedCert() ) );
+  connect( leProviderSearch, SIGNAL( textChanged( const QString& ) ),
+    mProviderModel, SLOT( setFilter( const QString& ) ) );
+  connect( lvProviders, SIGNAL( activated( const QModelIndex& ) ),
+    this, SLOT( onProviderActivated( const QModelIndex& ) ) );
+  connect( lvProviders, SIGNAL( clicked( const QModelIndex& ) ),
+    this, SLOT( onProviderActivated( const QModelIndex& ) ) );
 }
 
 void QgsAuthSAML2Edit::onFedUrlChanged( const QString& url )
@@ -117,109 +148,76 @@ void QgsAuthSAML2Edit::onFedUrlChanged( const QString& url )
 
 }
 
-void QgsAuthSAML2Edit::loadFederationMetadata()
+void QgsAuthSAML2Edit::selectFedCert()
 {
-  // clear the list lof loaded IdPs
-  cbProviders->clear();
-
-  // load the federation metadata
-  QNetworkAccessManager *manager = new QNetworkAccessManager( this );
-  QNetworkReply* reply = manager->get( QNetworkRequest( QUrl(leFedUrl->text()) ) );
-  // signal to parse the federation metadata upon load finished
-  connect(reply, SIGNAL(finished()), this, SLOT(parseFederationMetadata()));
+  QString fileName = QFileDialog::getOpenFileName( this, tr( "Metadata signing certificate" ), leFedCert->text(),
+                     tr( "PEM certificates (*.pem *.crt *.cer);;All files (*)" ) );
+  if ( !fileName.isEmpty() )
+    leFedCert->setText( fileName );
 }
 
-void QgsAuthSAML2Edit::parseFederationMetadata()
-{  
-  /* QXmlStreamReader takes any QIODevice. */
-  QNetworkReply *reply = qobject_cast<QNetworkReply *>(sender());
-  QXmlStreamReader xml(reply);
-
-  QString entityID = QString();
-  bool entityIsIdP = false;
-  QString displayName = QString();
-  QString ecpURL = QString();
+void QgsAuthSAML2Edit::loadFederationMetadata()
+{
+  // release the index, the loader may replace it
+  mProviderModel->clear();
+  leProviderSearch->setEnabled( false );
+  lvProviders->setEnabled( false );
 
-  /* We'll parse the XML until we reach end of it.*/
-  while(!xml.atEnd() &&!xml.hasError())
+  // download and parsing of large aggregates happen on a thread of their own
+  if ( !mLoaderThread )
   {
-    /* Read next element.*/
-    QXmlStreamReader::TokenType token = xml.readNext();
-    /* If token is just StartDocument, we'll go to next.*/
-    if(token == QXmlStreamReader::StartDocument)
-    {
-      continue;
-    }
-    /* If token is StartElement, we'll see if we can read it.*/
-    if(token == QXmlStreamReader::StartElement)
-    {
-      if(xml.name() == "EntitiesDescriptor")
-      {
-        continue;
-      }
-      if(xml.name() == "EntityDescriptor")
-      {
-        entityIsIdP = false;
-        entityID = QString();
-        displayName = QString();
-        ecpURL = QString();
-
-        QXmlStreamAttributes attrs = xml.attributes();
-        entityID = QString(attrs.value("entityID").toString().constData());
-        continue;
-      }
-      else if(xml.name() == "IDPSSODescriptor")
-      {
-        entityIsIdP = true;
-        continue;
-      }
-      else if(xml.name() == "SingleSignOnService")
-      {
-        QXmlStreamAttributes attrs = xml.attributes();
-        if (entityIsIdP && attrs.value("Binding") == QString("urn:oasis:names:tc:SAML:2.0:bindings:SOAP"))
-        {
-          ecpURL = QString(attrs.value("Location").toString().constData());
-        }
-        continue;
-      }
-      else if(xml.name() == "DisplayName")
-      {
-        if (entityIsIdP)
-          displayName = QString(xml.readElementText().constData());
-
-        continue;
-      }
-
-    }
-    if(token == QXmlStreamReader::EndElement) 
-    {
-      if(xml.name() == "EntityDescriptor")
-      {
-        if(entityIsIdP && !ecpURL.isEmpty())
-        {
-          if (displayName.isEmpty())
-            displayName = entityID;
-
-          cbProviders->addItem(displayName,QVariant(ecpURL));
-
-          QgsDebugMsg(QString("IdP entityID: %1").arg(entityID.toStdString().c_str()));
-          QgsDebugMsg(QString("ECPURL: %1\n").arg( ecpURL.toStdString().c_str()));
-          QgsDebugMsg(QString("Display Name: %1\n").arg( displayName.toStdString().c_str()));
-        }
-        continue;
-      }
-    }
-
+    mLoaderThread = new QThread( this );
+    mLoader = new QgsAuthSAML2MetadataLoader();
+    mLoader->moveToThread( mLoaderThread );
+    connect( mLoaderThread, SIGNAL( finished() ), mLoader, SLOT( deleteLater() ) );
+    connect( mLoader, SIGNAL( indexReady( const QString & ) ),
+             this, SLOT( onProviderIndexReady( const QString & ) ) );
+    connect( mLoader, SIGNAL( loadFailed( const QString & ) ),
+             this, SLOT( onProvidersLoadFailed( const QString & ) ) );
+    mLoaderThread->start();
   }
-  /* Error handling. */
-  if(xml.hasError()) 
+
+  btnGetProviders->setEnabled( false );
+  QMetaObject::invokeMethod( mLoader, "load", Qt::QueuedConnection,
+                             Q_ARG( QUrl, QUrl( leFedUrl->text() ) ), Q_ARG( QString, leFedCert->text() ) );
+}
+
+void QgsAuthSAML2Edit::onProviderIndexReady( const QString &fileName )
+{
+  btnGetProviders->setEnabled( true );
+
+  QString error;
+  if ( !mProviderModel->setIndexFile( fileName, &error ) )
   {
-    QMessageBox::critical(this, 
-      "error loading Federation Metadata", 
-      xml.errorString(), 
-      QMessageBox::Ok);
+    onProvidersLoadFailed( error );
+    return;
   }
-  xml.clear();
-  cbProviders->showPopup();
-  reply->deleteLater();
+  mProviderModel->setFilter( leProviderSearch->text() );
+
+  QgsDebugMsg( QString( "Federation metadata lists %1 IdPs" ).arg( mProviderModel->matchCount() ) );
+  leProviderSearch->setEnabled( true );
+  lvProviders->setEnabled( true );
+  leProviderSearch->setFocus();
+}
+
+void QgsAuthSAML2Edit::onProvidersLoadFailed( const QString &error )
+{
+  btnGetProviders->setEnabled( true );
+
+  QMessageBox::critical( this,
+                         "error loading Federation Metadata",
+                         error,
+                         QMessageBox::Ok );
+}
+
+void QgsAuthSAML2Edit::onProviderActivated( const QModelIndex &index )
+{
+  if ( !index.isValid() )
+    return;
+
+  // the combo box only holds the chosen IdP, it is what goes to the config
+  cbProviders->clear();
+  cbProviders->addItem( index.data( Qt::DisplayRole ).toString(), index.data( QgsAuthSAML2ProviderModel::EcpUrlRole ) );
+  cbProviders->setItemData( 0, index.data( QgsAuthSAML2ProviderModel::EcpUrlsRole ), ProviderUrlsRole );
+  validateConfig();
 }
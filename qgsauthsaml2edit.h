@@ -21,6 +21,11 @@
 #include "ui_qgsauthsaml2edit.h"
 
 #include "qgsauthconfig.h"
+#include "qgsauthsaml2metadataloader.h"
+
+class QgsAuthSAML2ProviderModel;
+class QModelIndex;
+class QThread;
 
 
 class QgsAuthSAML2Edit : public QgsAuthMethodEdit, private Ui::QgsAuthSAML2Edit
@@ -49,15 +54,22 @@ private slots:
 
   void onFedUrlChanged( const QString& url );
 
+  void selectFedCert();
+
   void loadFederationMetadata();
 
-  void parseFederationMetadata();
+  void onProviderIndexReady( const QString &fileName );
 
+  void onProvidersLoadFailed( const QString &error );
 
+  void onProviderActivated( const QModelIndex &index );
 
 private:
   QgsStringMap mConfigMap;
   bool mValid;
+  QThread *mLoaderThread;
+  QgsAuthSAML2MetadataLoader *mLoader;
+  QgsAuthSAML2ProviderModel *mProviderModel;
   void setupConnections();
 };
 
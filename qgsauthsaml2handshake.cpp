@@ -0,0 +1,861 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2handshake.h"
+#include "qgsauthsaml2broker.h"
+#include "qgsauthsaml2cache.h"
+#include "qgsauthsaml2connections.h"
+#include "qgsauthsaml2cookies.h"
+#include "qgsauthsaml2ecpcodec.h"
+#include "qgsauthsaml2idpendpoints.h"
+#include "qgsauthsaml2metrics.h"
+#include "qgsauthsaml2trace.h"
+#include "qgslogger.h"
+#include "qgsmessagelog.h"
+
+#include <QAuthenticator>
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QNetworkCacheMetaData>
+#include <QNetworkCookie>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QRunnable>
+#include <QSettings>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+static const QString AUTH_METHOD_KEY = "SAML2";
+
+namespace
+{
+  QThread *sWorker = nullptr;
+  QMutex sWorkerMutex;
+
+  // lives on the worker thread
+  QgsAuthSAML2Connections *sConnections = nullptr;
+
+  QThreadPool *sClaimPool = nullptr;
+
+  // IdP SSO session cookies, keyed by IdP endpoint and user
+  QgsAuthSAML2ShardedCache<QVariant> sIdpSessions;
+
+  // handshakes parked on a credential login to the same IdP and user; worker thread only
+  QHash<QString, QList<QPointer<QgsAuthSAML2Handshake> > > sIdpWaiters;
+
+  QAtomicInt sTraceIds;
+
+  // msecs an IdP endpoint gets to answer while there is another one to try
+  int idpFailoverTimeout()
+  {
+    return 1000 * QSettings().value( "/auth/saml2/idpFailoverTimeout", 10 ).toInt();
+  }
+
+  // bytes an ECP envelope may have; real ones are a few KiB, signed and encrypted ones stay well below
+  int maxEnvelopeSize()
+  {
+    return 1024 * QSettings().value( "/auth/saml2/maxEnvelopeSize", 1024 ).toInt();
+  }
+
+  int networkTimeout()
+  {
+    return QSettings().value( "/qgis/networkAndProxy/networkTimeout", "60000" ).toInt();
+  }
+
+  // the endpoint could not be reached or is broken, as opposed to a refusal of the request
+  bool isEndpointFailure( QNetworkReply::NetworkError error )
+  {
+    return error != QNetworkReply::NoError
+           && ( error < QNetworkReply::ContentAccessDenied || int( error ) > int( QNetworkReply::ProtocolFailure ) );
+  }
+}
+
+
+QgsAuthSAML2Handshake::QgsAuthSAML2Handshake( const QNetworkRequest &request, const QString &authcfg, const QgsAuthMethodConfig &mconfig )
+  : QObject()
+  , mRequest( request )
+  , mAuthcfg( authcfg )
+  , mConfig( mconfig )
+  , mTraceId( sTraceIds.fetchAndAddRelaxed( 1 ) + 1 )
+  , mNetworkTimeout( networkTimeout() )
+  , mIdpFailoverTimeout( idpFailoverTimeout() )
+  , mMaxEnvelopeSize( maxEnvelopeSize() )
+  , mIdpEndpoints( qMax( 1, QgsAuthSAML2IdpEndpoints::candidates( mconfig ).size() ) )
+  , mReply( nullptr )
+  , mEnvelopeTooLarge( false )
+  , mIdpCredentialsSent( false )
+  , mIdpLoginLeader( false )
+  , mIdpWaited( false )
+  , mIdpIndex( 0 )
+  , mIdpTimer( new QTimer( this ) )
+  , mState( Idle )
+  , mSettled( false )
+  , mFailedIn( Idle )
+  , mChallenged( false )
+  , mBrokered( false )
+  , mBrokerClaimed( false )
+  , mClaimMsecs( 0 )
+{
+  mIdpTimer->setSingleShot( true );
+  connect( mIdpTimer, SIGNAL( timeout() ), this, SLOT( onIdpTimeout() ) );
+}
+
+QgsAuthSAML2Handshake::~QgsAuthSAML2Handshake()
+{
+  releaseIdpWaiters();
+  if ( mReply )
+  {
+    mReply->disconnect( this );
+    mReply->abort();
+    mReply->deleteLater();
+  }
+}
+
+QThread *QgsAuthSAML2Handshake::worker()
+{
+  QMutexLocker locker( &sWorkerMutex );
+  if ( !sWorker )
+  {
+    sWorker = new QThread();
+    sWorker->setObjectName( "SAML2 ECP handshake" );
+    sWorker->start();
+
+    sConnections = new QgsAuthSAML2Connections();
+    sConnections->moveToThread( sWorker );
+  }
+  return sWorker;
+}
+
+QThreadPool *QgsAuthSAML2Handshake::claimPool()
+{
+  QMutexLocker locker( &sWorkerMutex );
+  if ( !sClaimPool )
+    sClaimPool = new QThreadPool();
+  return sClaimPool;
+}
+
+QgsAuthSAML2Connections *QgsAuthSAML2Handshake::connections()
+{
+  worker();
+  QMutexLocker locker( &sWorkerMutex );
+  return sConnections;
+}
+
+void QgsAuthSAML2Handshake::prewarm( const QString &url, bool idp )
+{
+  QMetaObject::invokeMethod( connections(), "prewarm", Qt::QueuedConnection, Q_ARG( QString, url ), Q_ARG( bool, idp ) );
+}
+
+bool QgsAuthSAML2Handshake::isWorkerThread()
+{
+  QMutexLocker locker( &sWorkerMutex );
+  return sWorker && QThread::currentThread() == sWorker;
+}
+
+bool QgsAuthSAML2Handshake::isWorkerRunning()
+{
+  QMutexLocker locker( &sWorkerMutex );
+  return sWorker && sWorker->isRunning();
+}
+
+void QgsAuthSAML2Handshake::shutdownWorker()
+{
+  QMutexLocker locker( &sWorkerMutex );
+  // the claims may still start handshakes on the worker
+  if ( sClaimPool )
+  {
+    sClaimPool->waitForDone();
+    delete sClaimPool;
+    sClaimPool = nullptr;
+  }
+
+  if ( sWorker )
+  {
+    sWorker->quit();
+    sWorker->wait();
+    delete sWorker;
+    sWorker = nullptr;
+
+    // its thread is gone, it can go from here
+    delete sConnections;
+    sConnections = nullptr;
+  }
+}
+
+QString QgsAuthSAML2Handshake::idpSessionKey() const
+{
+  return QString( "%1|%2" ).arg( mConfig.config( "providerurl" ), mConfig.config( "username" ) );
+}
+
+void QgsAuthSAML2Handshake::begin()
+{
+  moveToThread( worker() );
+  QMetaObject::invokeMethod( this, "start", Qt::QueuedConnection );
+}
+
+/**
+ * Asks the broker for the session key on a thread of the claim pool.
+ * It holds the handshake until it handed it the answer.
+ */
+class QgsAuthSAML2Handshake::BrokerClaim : public QRunnable
+{
+  public:
+    BrokerClaim( const QSharedPointer<QgsAuthSAML2Handshake> &handshake, const QString &key, int msecs )
+      : mHandshake( handshake )
+      , mKey( key )
+      , mMsecs( msecs )
+    {}
+
+    void run() override
+    {
+      QgsAuthSAML2SessionStore::Record record;
+      QgsAuthSAML2Broker::Answer answer = QgsAuthSAML2Broker::claim( mKey, mMsecs, &record );
+      if ( answer == QgsAuthSAML2Broker::Session )
+      {
+        mHandshake->adopt( record );
+        return;
+      }
+
+      if ( answer == QgsAuthSAML2Broker::Claimed )
+      {
+        QMutexLocker locker( &mHandshake->mMutex );
+        mHandshake->mBrokerClaimed = true;
+      }
+      QMetaObject::invokeMethod( mHandshake.data(), "start", Qt::QueuedConnection );
+    }
+
+  private:
+    QSharedPointer<QgsAuthSAML2Handshake> mHandshake;
+    QString mKey;
+    int mMsecs;
+};
+
+void QgsAuthSAML2Handshake::beginBrokered( const QSharedPointer<QgsAuthSAML2Handshake> &handshake, const QString &key, int msecs )
+{
+  {
+    QMutexLocker locker( &handshake->mMutex );
+    handshake->mClaimMsecs = msecs;
+  }
+  handshake->moveToThread( worker() );
+  claimPool()->start( new BrokerClaim( handshake, key, msecs ) );
+}
+
+void QgsAuthSAML2Handshake::adopt( const QgsAuthSAML2SessionStore::Record &record )
+{
+  SAML2_TRACE_EVENT( mTraceId, QString( "session of another process from the broker, obtained %1" ).arg( record.obtained.toString( Qt::ISODate ) ) );
+  {
+    QMutexLocker locker( &mMutex );
+    mChallenged = true;
+    mBrokered = true;
+    mBrokeredObtained = record.obtained;
+    mCookies = record.cookies;
+    mSessionExpiry = record.expires;
+    mState = Finished;
+  }
+
+  QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::BrokerSessions );
+  emit finished();
+  settle();
+}
+
+void QgsAuthSAML2Handshake::settle()
+{
+  QMutexLocker locker( &mMutex );
+  mSettled = true;
+  mFinishedCondition.wakeAll();
+}
+
+bool QgsAuthSAML2Handshake::waitForFinished( unsigned long msecs )
+{
+  // the main thread parks too: nothing on the worker waits for it, see QgsAuthSAML2Connections::spManager()
+  QMutexLocker locker( &mMutex );
+  while ( !mSettled )
+  {
+    if ( !mFinishedCondition.wait( &mMutex, msecs ) )
+      return false;
+  }
+  return true;
+}
+
+int QgsAuthSAML2Handshake::timeBudget() const
+{
+  int claim;
+  {
+    QMutexLocker locker( &mMutex );
+    claim = mClaimMsecs;
+  }
+
+  // the SP legs and the last IdP endpoint are bounded by the network timeout
+  int idpLeg = ( mIdpEndpoints - 1 ) * mIdpFailoverTimeout + mNetworkTimeout;
+  return claim + 2 * mNetworkTimeout + 2 * idpLeg;
+}
+
+QgsAuthSAML2Handshake::State QgsAuthSAML2Handshake::state() const
+{
+  QMutexLocker locker( &mMutex );
+  return mState;
+}
+
+bool QgsAuthSAML2Handshake::challenged() const
+{
+  QMutexLocker locker( &mMutex );
+  return mChallenged;
+}
+
+bool QgsAuthSAML2Handshake::brokered() const
+{
+  QMutexLocker locker( &mMutex );
+  return mBrokered;
+}
+
+bool QgsAuthSAML2Handshake::brokerClaimed() const
+{
+  QMutexLocker locker( &mMutex );
+  return mBrokerClaimed;
+}
+
+QDateTime QgsAuthSAML2Handshake::brokeredObtained() const
+{
+  QMutexLocker locker( &mMutex );
+  return mBrokeredObtained;
+}
+
+QgsAuthSAML2Handshake::State QgsAuthSAML2Handshake::failedIn() const
+{
+  QMutexLocker locker( &mMutex );
+  return mFailedIn;
+}
+
+QList<QNetworkCookie> QgsAuthSAML2Handshake::cookies() const
+{
+  QMutexLocker locker( &mMutex );
+  return mCookies;
+}
+
+bool QgsAuthSAML2Handshake::takeResponse( QNetworkCacheMetaData *metaData, QByteArray *body )
+{
+  QMutexLocker locker( &mMutex );
+  if ( !mResponseMetaData.isValid() )
+    return false;
+
+  *metaData = mResponseMetaData;
+  *body = mResponseBody;
+  mResponseMetaData = QNetworkCacheMetaData();
+  mResponseBody.clear();
+  return true;
+}
+
+QDateTime QgsAuthSAML2Handshake::sessionExpiry() const
+{
+  QMutexLocker locker( &mMutex );
+  return mSessionExpiry;
+}
+
+QString QgsAuthSAML2Handshake::errorString() const
+{
+  QMutexLocker locker( &mMutex );
+  return mErrorString;
+}
+
+namespace
+{
+  QgsAuthSAML2Metrics::Phase metricsPhase( QgsAuthSAML2Handshake::State state )
+  {
+    switch ( state )
+    {
+      case QgsAuthSAML2Handshake::IdpAssertion:
+        return QgsAuthSAML2Metrics::IdpAssertionPhase;
+      case QgsAuthSAML2Handshake::AssertionConsumer:
+        return QgsAuthSAML2Metrics::AssertionConsumerPhase;
+      default:
+        return QgsAuthSAML2Metrics::SpChallengePhase;
+    }
+  }
+}
+
+void QgsAuthSAML2Handshake::setState( State state )
+{
+  State phase;
+  {
+    QMutexLocker locker( &mMutex );
+    phase = mState;
+    mState = state;
+  }
+  endPhase( phase );
+  SAML2_TRACE_EVENT( mTraceId, QString( "state %1 -> %2 after %3 ms" ).arg( phase ).arg( state ).arg( mTimer.elapsed() ) );
+}
+
+void QgsAuthSAML2Handshake::endPhase( State phase )
+{
+  // only the legs on the wire are timed
+  if ( phase == SpChallenge || phase == IdpAssertion || phase == AssertionConsumer )
+    QgsAuthSAML2Metrics::instance()->recordDuration( metricsPhase( phase ), mPhaseTimer.restart() );
+  else
+    mPhaseTimer.restart();
+}
+
+void QgsAuthSAML2Handshake::releaseIdpWaiters()
+{
+  if ( !mIdpLoginLeader )
+    return;
+  mIdpLoginLeader = false;
+
+  // without a session they log in on their own
+  QList<QPointer<QgsAuthSAML2Handshake> > waiters = sIdpWaiters.take( idpSessionKey() );
+  Q_FOREACH ( const QPointer<QgsAuthSAML2Handshake> &waiter, waiters )
+  {
+    if ( waiter )
+      QMetaObject::invokeMethod( waiter.data(), "sendToIdp", Qt::QueuedConnection );
+  }
+}
+
+void QgsAuthSAML2Handshake::fail( const QString &errorMsg )
+{
+  releaseIdpWaiters();
+  releaseBuffers();
+
+  QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
+  SAML2_TRACE_EVENT( mTraceId, QString( "failed: %1" ).arg( errorMsg ) );
+  State phase;
+  {
+    QMutexLocker locker( &mMutex );
+    phase = mState;
+    mErrorString = errorMsg;
+    mFailedIn = mState;
+    mState = Failed;
+  }
+
+  QgsAuthSAML2Metrics *metrics = QgsAuthSAML2Metrics::instance();
+  endPhase( phase );
+  metrics->recordDuration( QgsAuthSAML2Metrics::HandshakePhase, mTimer.elapsed() );
+  metrics->recordFailure( mConfig.config( "providerurl" ), metricsPhase( phase ) );
+  metrics->increment( QgsAuthSAML2Metrics::HandshakesFailed );
+  metrics->addToGauge( QgsAuthSAML2Metrics::HandshakesInFlight, -1 );
+
+  emit finished();
+  settle();
+}
+
+void QgsAuthSAML2Handshake::complete()
+{
+  releaseBuffers();
+
+  State phase;
+  bool challenged;
+  {
+    QMutexLocker locker( &mMutex );
+    phase = mState;
+    challenged = mChallenged;
+    mState = Finished;
+  }
+
+  SAML2_TRACE_EVENT( mTraceId, QString( challenged ? "SP session established after %1 ms" : "no challenge, done after %1 ms" ).arg( mTimer.elapsed() ) );
+
+  QgsAuthSAML2Metrics *metrics = QgsAuthSAML2Metrics::instance();
+  endPhase( phase );
+  metrics->recordDuration( QgsAuthSAML2Metrics::HandshakePhase, mTimer.elapsed() );
+  metrics->increment( challenged ? QgsAuthSAML2Metrics::HandshakesSucceeded : QgsAuthSAML2Metrics::HandshakesUnchallenged );
+  metrics->addToGauge( QgsAuthSAML2Metrics::HandshakesInFlight, -1 );
+
+  emit finished();
+  settle();
+}
+
+void QgsAuthSAML2Handshake::start()
+{
+  QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::HandshakesStarted );
+  QgsAuthSAML2Metrics::instance()->addToGauge( QgsAuthSAML2Metrics::HandshakesInFlight, 1 );
+  mTimer.start();
+  mPhaseTimer.start();
+  setState( SpChallenge );
+
+  // the session is managed by the method, cookies the worker's jar picked up from an
+  // earlier login must not answer the challenge of a renewal
+  QNetworkRequest request( mRequest );
+  request.setAttribute( QNetworkRequest::CookieLoadControlAttribute, QNetworkRequest::Manual );
+  request.setAttribute( QNetworkRequest::CookieSaveControlAttribute, QNetworkRequest::Manual );
+  // the worker's disk cache must not store the probe, see keepResponse()
+  request.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false );
+  sConnections->prepare( request );
+
+  /* this now contains the ecp response from the SP and not the capabilities*/
+  mReply = sConnections->spManager()->get( request );
+  connect( mReply, SIGNAL( downloadProgress( qint64, qint64 ) ), this, SLOT( onEnvelopeProgress( qint64, qint64 ) ) );
+  connect( mReply, SIGNAL( finished() ), this, SLOT( onSpReplyFinished() ) );
+}
+
+void QgsAuthSAML2Handshake::onEnvelopeProgress( qint64 received, qint64 total )
+{
+  // the SP answers the probe with the resource itself when there is no challenge, that is not limited
+  if ( !mReply || mEnvelopeTooLarge
+       || ( mState == SpChallenge && mReply->header( QNetworkRequest::ContentTypeHeader ).toString() != "application/vnd.paos+xml" ) )
+    return;
+
+  if ( qMax( received, total ) > mMaxEnvelopeSize )
+  {
+    SAML2_TRACE_EVENT( mTraceId, QString( "envelope exceeds %1 bytes, aborting" ).arg( mMaxEnvelopeSize ) );
+    mEnvelopeTooLarge = true;
+    mReply->abort();
+  }
+}
+
+void QgsAuthSAML2Handshake::onSpReplyFinished()
+{
+  QNetworkReply *spReply = mReply;
+  mReply = nullptr;
+  spReply->deleteLater();
+  sConnections->remember( spReply );
+
+  if ( mEnvelopeTooLarge )
+  {
+    fail( QStringLiteral( "Update request FAILED: ECP response from SP larger than %1 bytes" ).arg( mMaxEnvelopeSize ) );
+    return;
+  }
+
+  QByteArray spECPResponse;
+  if ( spReply->error() == QNetworkReply::NoError )
+  {
+    spECPResponse = spReply->readAll();
+
+    if ( spECPResponse.isEmpty() )
+    {
+      fail( QStringLiteral( "Update request FAILED: empty ECP response from SP: %1" ).arg( spReply->errorString() ) );
+      return;
+    }
+  }
+  else
+  {
+    fail( QStringLiteral( "Update request FAILED: ECP Response from SP failed: %1" ).arg( spReply->errorString() ) );
+    return;
+  }
+
+  if( spReply->header(QNetworkRequest::ContentTypeHeader).toString() != "application/vnd.paos+xml" )
+  {
+    // the probe already fetched the resource itself, hand it over instead of downloading it again
+    keepResponse( spReply, spECPResponse );
+    complete();
+    return;
+  }
+
+  SAML2_TRACE_PAYLOAD( mTraceId, "ECP response from SP", spECPResponse );
+
+  QgsAuthSAML2EcpCodec::SpRequest spRequest;
+  QString errorMsg;
+  if ( !QgsAuthSAML2EcpCodec::parseSpRequest( spECPResponse, spRequest, &errorMsg ) )
+  {
+    fail( QStringLiteral( "Update request config FAILED for authcfg: %1: could not read ECP response from SP: %2" ).arg( mAuthcfg, errorMsg ) );
+    return;
+  }
+
+  // check if the response contains the PAOS response from the SP
+  if ( !spRequest.isEcp )
+  {
+    complete();
+    return;
+  }
+
+  {
+    QMutexLocker locker( &mMutex );
+    mChallenged = true;
+  }
+
+  mRelayState = spRequest.relayState;
+  mAcsUrl = spRequest.acsUrl;
+  SAML2_TRACE_EVENT( mTraceId, QString( "SP challenge, ACS URL %1" ).arg( mAcsUrl ) );
+
+  // the IdP gets the signed bytes of the SP unchanged, only the header is emptied
+  mIdpBody = QgsAuthSAML2EcpCodec::idpRequest( spECPResponse, spRequest );
+  mIdpUrls = QgsAuthSAML2IdpEndpoints::candidates( mConfig );
+  mIdpIndex = 0;
+
+  setState( IdpAssertion );
+  sendToIdp();
+}
+
+void QgsAuthSAML2Handshake::sendToIdp()
+{
+  QNetworkRequest requestToIdP( QUrl( mIdpUrls.value( mIdpIndex ) ) );
+
+  // an SSO session at the IdP saves the password check; credentials are only sent
+  // when the IdP rejects it, see onIdpAuthenticationRequired()
+  QVariant idpSession;
+  if ( sIdpSessions.lookup( idpSessionKey(), &idpSession ) )
+  {
+    requestToIdP.setHeader( QNetworkRequest::CookieHeader, idpSession );
+  }
+  else if ( !mIdpWaited && !mIdpLoginLeader && sIdpWaiters.contains( idpSessionKey() ) )
+  {
+    // concurrent logins of one user share the SSO session the first of them sets up
+    SAML2_TRACE_EVENT( mTraceId, "waiting for the IdP login in flight" );
+    mIdpWaited = true;
+    sIdpWaiters[ idpSessionKey() ].append( QPointer<QgsAuthSAML2Handshake>( this ) );
+    return;
+  }
+  else
+  {
+    if ( !mIdpWaited && !mIdpLoginLeader )
+    {
+      sIdpWaiters.insert( idpSessionKey(), QList<QPointer<QgsAuthSAML2Handshake> >() );
+      mIdpLoginLeader = true;
+    }
+
+    // in case the user has saved username/password in the configuration, it must
+    // be applied to the IdP not the SP
+    QString username = mConfig.config( "username" );
+    QString password = mConfig.config( "password" );
+
+    if ( !username.isEmpty() )
+    {
+      requestToIdP.setRawHeader( "Authorization", "Basic " + QString( "%1:%2" ).arg( username, password ).toAscii().toBase64() );
+      mIdpCredentialsSent = true;
+    }
+  }
+
+  requestToIdP.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork );
+  requestToIdP.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false );
+  requestToIdP.setAttribute( QNetworkRequest::CookieLoadControlAttribute, QNetworkRequest::Manual );
+  requestToIdP.setAttribute( QNetworkRequest::CookieSaveControlAttribute, QNetworkRequest::Manual );
+
+  // signal SAML2 ECP to the IdP
+  requestToIdP.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml");
+  // relay the modified ECP message to IdP
+  SAML2_TRACE_PAYLOAD( mTraceId, "ECP message to IdP", mIdpBody );
+
+  sConnections->prepare( requestToIdP );
+  QNetworkAccessManager *idpNam = sConnections->idpManager();
+  connect( idpNam, SIGNAL( authenticationRequired( QNetworkReply *, QAuthenticator * ) ),
+           this, SLOT( onIdpAuthenticationRequired( QNetworkReply *, QAuthenticator * ) ), Qt::UniqueConnection );
+  mReply = idpNam->post( requestToIdP, mIdpBody );
+  connect( mReply, SIGNAL( downloadProgress( qint64, qint64 ) ), this, SLOT( onEnvelopeProgress( qint64, qint64 ) ) );
+  connect( mReply, SIGNAL( finished() ), this, SLOT( onIdpReplyFinished() ) );
+
+  // the IdP manager has no timeout of its own; a slow endpoint is given up early while there is another
+  mIdpLegTimer.start();
+  mIdpTimer->start( mIdpIndex + 1 < mIdpUrls.size() ? mIdpFailoverTimeout : mNetworkTimeout );
+}
+
+void QgsAuthSAML2Handshake::onIdpTimeout()
+{
+  if ( !mReply )
+    return;
+
+  SAML2_TRACE_EVENT( mTraceId, QString( "IdP endpoint %1 timed out" ).arg( mIdpUrls.value( mIdpIndex ) ) );
+  mReply->abort();
+}
+
+bool QgsAuthSAML2Handshake::failOver( QNetworkReply *reply )
+{
+  if ( !isEndpointFailure( reply->error() ) )
+    return false;
+
+  const QString failed = mIdpUrls.value( mIdpIndex );
+  QgsAuthSAML2IdpEndpoints::recordFailure( failed );
+  if ( ++mIdpIndex >= mIdpUrls.size() )
+    return false;
+
+  QgsMessageLog::logMessage( QStringLiteral( "IdP endpoint %1 failed: %2, trying %3" )
+                             .arg( failed, reply->errorString(), mIdpUrls.at( mIdpIndex ) ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+  mIdpCredentialsSent = false;
+  sendToIdp();
+  return true;
+}
+
+void QgsAuthSAML2Handshake::onIdpAuthenticationRequired( QNetworkReply *reply, QAuthenticator *authenticator )
+{
+  if ( reply != mReply )
+    return;
+
+  // the SSO session is gone, it is of no use to the next login either
+  sIdpSessions.remove( idpSessionKey() );
+
+  // answer once, a second request means the credentials were rejected
+  QString username = mConfig.config( "username" );
+  if ( mIdpCredentialsSent || username.isEmpty() )
+    return;
+
+  SAML2_TRACE_EVENT( mTraceId, "IdP rejected the SSO session, falling back to credentials" );
+  authenticator->setUser( username );
+  authenticator->setPassword( mConfig.config( "password" ) );
+  mIdpCredentialsSent = true;
+}
+
+void QgsAuthSAML2Handshake::onIdpReplyFinished()
+{
+  QNetworkReply *idpReply = mReply;
+  mReply = nullptr;
+  idpReply->deleteLater();
+  mIdpTimer->stop();
+  sConnections->idpManager()->disconnect( this );
+  sConnections->remember( idpReply );
+
+  // the endpoint answered, just not with anything usable; no reason to try the others
+  if ( mEnvelopeTooLarge )
+  {
+    fail( QStringLiteral( "Update request FAILED: ECP response from IdP larger than %1 bytes" ).arg( mMaxEnvelopeSize ) );
+    return;
+  }
+
+  // we have a response from the IdP
+  QByteArray idpECPResponse;
+  if ( idpReply->error() == QNetworkReply::NoError )
+  {
+    QgsAuthSAML2IdpEndpoints::recordSuccess( mIdpUrls.value( mIdpIndex ), mIdpLegTimer.elapsed() );
+    idpECPResponse = idpReply->readAll();
+
+    if ( idpECPResponse.isEmpty() )
+    {
+      fail( QStringLiteral( "Update request FAILED: empty ECP response from IdP: %1" ).arg( idpReply->errorString() ) );
+      return;
+    }
+  }
+  else
+  {
+    sIdpSessions.remove( idpSessionKey() );
+    if ( failOver( idpReply ) )
+      return;
+    fail( QStringLiteral( "Update request FAILED: ECP Response from IdP failed: %1" ).arg( idpReply->errorString() ) );
+    return;
+  }
+  mIdpBody.clear();
+
+  SAML2_TRACE_PAYLOAD( mTraceId, "ECP response from IdP", idpECPResponse );
+
+  QgsAuthSAML2EcpCodec::IdpResponse idpResponse;
+  QString errorMsg;
+  if ( !QgsAuthSAML2EcpCodec::parseIdpResponse( idpECPResponse, idpResponse, &errorMsg ) )
+  {
+    // a SOAP fault instead of an assertion, the SSO session may be the cause
+    sIdpSessions.remove( idpSessionKey() );
+    fail( QStringLiteral( "Update request config FAILED for authcfg: %1: could not read ECP response from IdP: %2" ).arg( mAuthcfg, errorMsg ) );
+    return;
+  }
+  mSessionNotOnOrAfter = idpResponse.sessionNotOnOrAfter;
+
+  // keep the SSO session the IdP set up for this user, for the logins to other SPs
+  QVariant idpSession = idpReply->header( QNetworkRequest::SetCookieHeader );
+  if ( idpSession.isValid() )
+    sIdpSessions.insert( idpSessionKey(), idpSession );
+  releaseIdpWaiters();
+
+  // the SP gets the signed bytes of the IdP unchanged, plus the captured RelayState
+  idpECPResponse = QgsAuthSAML2EcpCodec::spResponse( idpECPResponse, idpResponse, mRelayState );
+
+  SAML2_TRACE_PAYLOAD( mTraceId, "ECP message to SP", idpECPResponse );
+
+  // send modified IdP response to the SP - this contains the captured RelayState
+  QNetworkRequest requestToSP( mAcsUrl );
+  requestToSP.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork );
+  requestToSP.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false );
+  requestToSP.setAttribute( QNetworkRequest::CookieLoadControlAttribute, QNetworkRequest::Manual );
+  requestToSP.setAttribute( QNetworkRequest::CookieSaveControlAttribute, QNetworkRequest::Manual );
+
+  requestToSP.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml; application/vnd.paos+xml");
+
+  /* Send request for cookies */
+  setState( AssertionConsumer );
+  sConnections->prepare( requestToSP );
+  mReply = sConnections->spManager()->post( requestToSP, idpECPResponse );
+  connect( mReply, SIGNAL( finished() ), this, SLOT( onAcsReplyFinished() ) );
+}
+
+void QgsAuthSAML2Handshake::onAcsReplyFinished()
+{
+  QNetworkReply *capabilitiesReply = mReply;
+  mReply = nullptr;
+  capabilitiesReply->deleteLater();
+  sConnections->remember( capabilitiesReply );
+
+  if ( capabilitiesReply->error() != QNetworkReply::NoError )
+  {
+    fail( QStringLiteral( "Update request FAILED: ECP Response from SP failed: %1" ).arg( capabilitiesReply->errorString() ) );
+    return;
+  }
+
+  // all Set-Cookie headers, scoped to the ACS URL unless they name their own domain and path
+  QList<QNetworkCookie> cookies = QgsAuthSAML2Cookies::normalized(
+                                    qvariant_cast<QList<QNetworkCookie> >( capabilitiesReply->header( QNetworkRequest::SetCookieHeader ) ),
+                                    capabilitiesReply->url() );
+  if ( cookies.isEmpty() )
+  {
+    fail( QStringLiteral( "Update request FAILED: no cookies from SP: %1" ).arg( capabilitiesReply->errorString() ) );
+    return;
+  }
+
+  QDateTime expiry = mSessionNotOnOrAfter;
+  Q_FOREACH ( const QNetworkCookie &setCookie, cookies )
+  {
+    // session cookies live as long as the SP keeps the session
+    if ( setCookie.isSessionCookie() )
+      continue;
+    if ( !expiry.isValid() || setCookie.expirationDate() < expiry )
+      expiry = setCookie.expirationDate();
+  }
+
+  {
+    QMutexLocker locker( &mMutex );
+    mCookies = cookies;
+    mSessionExpiry = expiry;
+  }
+
+  complete();
+}
+
+void QgsAuthSAML2Handshake::releaseBuffers()
+{
+  // QByteArray::clear() frees the storage, unlike resize( 0 )
+  mIdpBody.clear();
+  mIdpUrls.clear();
+  mRelayState.clear();
+  mAcsUrl.clear();
+}
+
+void QgsAuthSAML2Handshake::keepResponse( QNetworkReply *reply, const QByteArray &body )
+{
+  // the worker has a disk cache of its own on the same directory; the requesting thread writes
+  // the entry through its own, or the two would overwrite each other's files
+  if ( body.isEmpty()
+       || !mRequest.attribute( QNetworkRequest::CacheSaveControlAttribute, true ).toBool()
+       || reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() != 200
+       || reply->rawHeader( "Cache-Control" ).contains( "no-store" ) )
+    return;
+
+  QNetworkCacheMetaData metaData;
+  metaData.setUrl( mRequest.url() );
+  metaData.setSaveToDisk( true );
+  metaData.setLastModified( reply->header( QNetworkRequest::LastModifiedHeader ).toDateTime() );
+
+  // keep the server's own freshness; without one the entry is stale right away, so only
+  // the request this handshake was started for loads it with PreferCache
+  QDateTime expires = QDateTime::fromString( QString::fromLatin1( reply->rawHeader( "Expires" ) ), Qt::RFC2822Date );
+  metaData.setExpirationDate( expires.isValid() ? expires : QDateTime::currentDateTimeUtc() );
+
+  QNetworkCacheMetaData::RawHeaderList headers;
+  Q_FOREACH ( const QNetworkReply::RawHeaderPair &header, reply->rawHeaderPairs() )
+  {
+    if ( qstricmp( header.first.constData(), "Set-Cookie" ) != 0 )
+      headers << header;
+  }
+  metaData.setRawHeaders( headers );
+
+  QNetworkCacheMetaData::AttributesMap attributes;
+  attributes.insert( QNetworkRequest::HttpStatusCodeAttribute, 200 );
+  attributes.insert( QNetworkRequest::HttpReasonPhraseAttribute, reply->attribute( QNetworkRequest::HttpReasonPhraseAttribute ) );
+  metaData.setAttributes( attributes );
+
+  QMutexLocker locker( &mMutex );
+  mResponseMetaData = metaData;
+  mResponseBody = body;
+}
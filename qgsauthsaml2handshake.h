@@ -0,0 +1,259 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2HANDSHAKE_H
+#define QGSAUTHSAML2HANDSHAKE_H
+
+#include <QObject>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QNetworkCacheMetaData>
+#include <QWaitCondition>
+#include <QNetworkCookie>
+#include <QNetworkRequest>
+#include <QSharedPointer>
+#include <QVariant>
+
+#include "qgsauthconfig.h"
+#include "qgsauthsaml2sessionstore.h"
+
+class QAuthenticator;
+class QNetworkReply;
+class QThread;
+class QThreadPool;
+class QTimer;
+class QgsAuthSAML2Connections;
+
+/**
+ * SAML2 ECP handshake, driven as a non-blocking state machine.
+ *
+ * The handshake walks SP challenge -> IdP assertion -> assertion consumer
+ * -> session on a dedicated worker thread. Each leg is started from the
+ * finished() signal of the previous one, so the worker never spins a nested
+ * QEventLoop. Requesting threads, the main thread included, park in
+ * waitForFinished() until the handshake reaches Finished or Failed and then
+ * pick up the result. The worker never waits for another thread in turn: SSL
+ * errors and authentication requests are answered on the worker or fail the
+ * leg, they are not relayed to the main thread.
+ */
+class QgsAuthSAML2Handshake : public QObject
+{
+  Q_OBJECT
+
+public:
+  enum State
+  {
+    Idle,
+    SpChallenge,       //!< GET to the SP announcing PAOS support
+    IdpAssertion,      //!< POST of the AuthnRequest to the IdP
+    AssertionConsumer, //!< POST of the IdP response to the SP ACS URL
+    Finished,          //!< SP session established, or no challenge at all
+    Failed
+  };
+
+  QgsAuthSAML2Handshake( const QNetworkRequest &request, const QString &authcfg, const QgsAuthMethodConfig &mconfig );
+  ~QgsAuthSAML2Handshake();
+
+  /** Moves the handshake to the worker thread and starts the SP challenge */
+  void begin();
+
+  /**
+   * Like begin(), but asks the session broker for key first, on a thread of its
+   * own: another process may hold a session for the SP or be logging in to it.
+   * The handshake then finishes with that session, or logs in holding the claim.
+   * The caller waits for it like for any other handshake.
+   */
+  static void beginBrokered( const QSharedPointer<QgsAuthSAML2Handshake> &handshake, const QString &key, int msecs );
+
+  /**
+   * Parks the calling thread until the handshake completes and finished()
+   * returned. Returns false if it did not complete within msecs.
+   */
+  bool waitForFinished( unsigned long msecs );
+
+  /**
+   * Msecs the handshake may take at most: the broker claim, the SP challenge,
+   * each IdP endpoint but the last up to the failover timeout, the IdP login
+   * of another handshake it waits for, and the assertion consumer.
+   */
+  int timeBudget() const;
+
+  State state() const;
+
+  /** The request the handshake was started for */
+  QNetworkRequest request() const { return mRequest; }
+
+  QString authcfg() const { return mAuthcfg; }
+
+  /** The IdP SOAP endpoint the handshake logs in at */
+  QString idpUrl() const { return mConfig.config( "providerurl" ); }
+
+  /** True if the SP answered with a PAOS challenge, i.e. the resource is SAML protected */
+  bool challenged() const;
+
+  /** True if the handshake finished with the session another process published to the broker */
+  bool brokered() const;
+
+  /** True if this process logs in for the key at the broker, and publishes or releases it */
+  bool brokerClaimed() const;
+
+  /** When a brokered session was established by the other process; invalid otherwise */
+  QDateTime brokeredObtained() const;
+
+  /** The leg a failed handshake was in when it failed, Idle if it did not fail */
+  State failedIn() const;
+
+  /**
+   * Hands the requested resource, fetched while probing for the challenge, to
+   * the first caller, which stores it in the network cache of its own thread.
+   * False if the probe fetched nothing cacheable or another caller took it.
+   */
+  bool takeResponse( QNetworkCacheMetaData *metaData, QByteArray *body );
+
+  /** Session cookies set by the SP assertion consumer, with domain and path filled in; valid once Finished */
+  QList<QNetworkCookie> cookies() const;
+
+  /**
+   * End of the SP session, the earlier of the cookie expiry and the
+   * SessionNotOnOrAfter of the assertion. Invalid if neither limits it.
+   */
+  QDateTime sessionExpiry() const;
+
+  QString errorString() const;
+
+  /** True if the calling thread is the handshake worker thread */
+  static bool isWorkerThread();
+
+  /** True while the worker thread runs handshakes, it is started on demand */
+  static bool isWorkerRunning();
+
+  /** Stops the worker thread, called on plugin cleanup */
+  static void shutdownWorker();
+
+  /** Opens the connection to an IdP or SP on the worker thread ahead of the first login */
+  static void prewarm( const QString &url, bool idp );
+
+signals:
+  /**
+   * Emitted once the state is Finished or Failed, before waitForFinished() returns
+   * in any thread. Receivers connected directly are done with the handshake by then.
+   */
+  void finished();
+
+private slots:
+  void start();
+
+  void onSpReplyFinished();
+
+  //! Aborts an ECP reply that grows past the envelope limit
+  void onEnvelopeProgress( qint64 received, qint64 total );
+
+  //! Posts the AuthnRequest to the IdP, or parks until a login to the same IdP in flight is done
+  void sendToIdp();
+
+  void onIdpAuthenticationRequired( QNetworkReply *reply, QAuthenticator *authenticator );
+
+  void onIdpReplyFinished();
+
+  //! The IdP endpoint took too long, give up on it
+  void onIdpTimeout();
+
+  void onAcsReplyFinished();
+
+private:
+  class BrokerClaim;
+
+  static QThread *worker();
+
+  //! Threads asking the broker, whose claims block while another process logs in
+  static QThreadPool *claimPool();
+
+  //! Finishes with the session of another process
+  void adopt( const QgsAuthSAML2SessionStore::Record &record );
+
+  //! Network managers and TLS sessions of the worker thread
+  static QgsAuthSAML2Connections *connections();
+
+  //! IdP SSO sessions are shared per IdP endpoint and user
+  QString idpSessionKey() const;
+
+  //! Resumes the handshakes that parked on the IdP login of this one
+  void releaseIdpWaiters();
+
+  //! Sends the AuthnRequest to the next IdP endpoint if reply failed for want of a working endpoint
+  bool failOver( QNetworkReply *reply );
+
+  void setState( State state );
+
+  //! Records the duration of the leg that just ended in the metrics
+  void endPhase( State phase );
+
+  void fail( const QString &errorMsg );
+
+  void complete();
+
+  //! Releases the threads in waitForFinished(), after finished() returned
+  void settle();
+
+  //! Drops the SOAP buffers once the handshake is done, it may be kept around a while longer
+  void releaseBuffers();
+
+  //! Keeps a response to the original request for takeResponse()
+  void keepResponse( QNetworkReply *reply, const QByteArray &body );
+
+  QNetworkRequest mRequest;
+  QString mAuthcfg;
+  QgsAuthMethodConfig mConfig;
+
+  int mTraceId;           //!< tells the handshakes apart in the trace
+  int mNetworkTimeout;     //!< msecs, the settings are read once per handshake
+  int mIdpFailoverTimeout; //!< msecs
+  int mMaxEnvelopeSize;    //!< bytes
+  int mIdpEndpoints;       //!< configured IdP endpoints, for timeBudget()
+  QNetworkReply *mReply;
+  bool mEnvelopeTooLarge;
+  QElapsedTimer mTimer;
+  QElapsedTimer mPhaseTimer;
+  bool mIdpCredentialsSent;
+  QByteArray mIdpBody;
+  bool mIdpLoginLeader;    //!< other handshakes wait for the IdP session of this one
+  bool mIdpWaited;         //!< parked once already, never again
+  QStringList mIdpUrls;    //!< endpoints of the IdP, in the order they are tried
+  int mIdpIndex;
+  QTimer *mIdpTimer;
+  QElapsedTimer mIdpLegTimer;
+  QString mRelayState;
+  QString mAcsUrl;
+  QDateTime mSessionNotOnOrAfter;
+
+  mutable QMutex mMutex;
+  QWaitCondition mFinishedCondition;
+  State mState;
+  bool mSettled;           //!< finished() returned, waiters are released only then
+  State mFailedIn;
+  bool mChallenged;
+  bool mBrokered;
+  bool mBrokerClaimed;
+  int mClaimMsecs;         //!< the broker may hold the handshake this long before it starts
+  QDateTime mBrokeredObtained;
+  QNetworkCacheMetaData mResponseMetaData;  //!< invalid unless a response is kept
+  QByteArray mResponseBody;
+  QList<QNetworkCookie> mCookies;
+  QDateTime mSessionExpiry;
+  QString mErrorString;
+};
+
+#endif // QGSAUTHSAML2HANDSHAKE_H
@@ -0,0 +1,120 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2idpendpoints.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+namespace
+{
+  // weight of the newest sample in the smoothed latency
+  const double LATENCY_WEIGHT = 0.3;
+
+  // msecs a failed endpoint is kept back, doubled per further failure up to the maximum
+  const qint64 HOLD_BACK = 5 * 1000;
+  const qint64 MAX_HOLD_BACK = 300 * 1000;
+
+  struct Endpoint
+  {
+    Endpoint() : latency( -1 ), failures( 0 ), heldUntil( 0 ) {}
+
+    double latency;     //!< smoothed msecs, negative until measured
+    int failures;       //!< consecutive
+    qint64 heldUntil;
+  };
+
+  QMutex sMutex;
+  QHash<QString, Endpoint> sEndpoints;
+
+  struct Candidate
+  {
+    QString url;
+    int order;          //!< position in the config, breaks ties
+    bool held;
+    double latency;
+  };
+
+  struct CandidateLess
+  {
+    bool operator()( const Candidate &a, const Candidate &b ) const
+    {
+      if ( a.held != b.held )
+        return !a.held;
+      if ( a.latency != b.latency )
+        return a.latency < b.latency;
+      return a.order < b.order;
+    }
+  };
+}
+
+
+QStringList QgsAuthSAML2IdpEndpoints::candidates( const QgsAuthMethodConfig &config )
+{
+  QStringList urls;
+  urls << config.config( "providerurl" );
+  Q_FOREACH ( const QString &url, config.config( "providerurls" ).split( ' ', QString::SkipEmptyParts ) )
+  {
+    if ( !urls.contains( url ) )
+      urls << url;
+  }
+  urls.removeAll( QString() );
+  if ( urls.size() < 2 )
+    return urls;
+
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  QList<Candidate> ranked;
+  {
+    QMutexLocker locker( &sMutex );
+    for ( int i = 0; i < urls.size(); ++i )
+    {
+      const Endpoint endpoint = sEndpoints.value( urls.at( i ) );
+      Candidate candidate;
+      candidate.url = urls.at( i );
+      candidate.order = i;
+      candidate.held = now < endpoint.heldUntil;
+      // unmeasured endpoints sort as the fastest, one login is enough to place them
+      candidate.latency = qMax( endpoint.latency, 0.0 );
+      ranked << candidate;
+    }
+  }
+  std::stable_sort( ranked.begin(), ranked.end(), CandidateLess() );
+
+  urls.clear();
+  Q_FOREACH ( const Candidate &candidate, ranked )
+    urls << candidate.url;
+  return urls;
+}
+
+void QgsAuthSAML2IdpEndpoints::recordSuccess( const QString &url, qint64 msecs )
+{
+  QMutexLocker locker( &sMutex );
+  Endpoint &endpoint = sEndpoints[url];
+  endpoint.latency = endpoint.latency < 0 ? msecs : LATENCY_WEIGHT * msecs + ( 1 - LATENCY_WEIGHT ) * endpoint.latency;
+  endpoint.failures = 0;
+  endpoint.heldUntil = 0;
+}
+
+void QgsAuthSAML2IdpEndpoints::recordFailure( const QString &url )
+{
+  QMutexLocker locker( &sMutex );
+  Endpoint &endpoint = sEndpoints[url];
+  ++endpoint.failures;
+  endpoint.heldUntil = QDateTime::currentMSecsSinceEpoch() + qMin( HOLD_BACK << qMin( endpoint.failures - 1, 16 ), MAX_HOLD_BACK );
+}
@@ -0,0 +1,46 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2IDPENDPOINTS_H
+#define QGSAUTHSAML2IDPENDPOINTS_H
+
+#include <QString>
+#include <QStringList>
+
+#include "qgsauthconfig.h"
+
+/**
+ * Latency and health of the SOAP endpoints of the IdPs.
+ *
+ * An IdP may advertise several ECP endpoints; the config keeps all of them
+ * in "providerurls". candidates() orders them for a login: healthy endpoints
+ * by their smoothed latency, endpoints never used yet first so they get
+ * measured, endpoints that failed recently last. A failed endpoint is kept
+ * back for a while that doubles with each further failure.
+ */
+class QgsAuthSAML2IdpEndpoints
+{
+public:
+  /** The endpoints of the IdP of config, best first; providerurl alone for older configs */
+  static QStringList candidates( const QgsAuthMethodConfig &config );
+
+  /** An answer from url after msecs */
+  static void recordSuccess( const QString &url, qint64 msecs );
+
+  /** url could not be reached or did not answer in time */
+  static void recordFailure( const QString &url );
+};
+
+#endif // QGSAUTHSAML2IDPENDPOINTS_H
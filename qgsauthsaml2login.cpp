@@ -0,0 +1,192 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2method.h"
+#include "qgsauthsaml2broker.h"
+#include "qgsauthsaml2handshake.h"
+#include "qgsapplication.h"
+#include "qgsauthmanager.h"
+
+#include <QFile>
+#if QT_VERSION >= 0x050100
+#include <QSaveFile>
+#endif
+#include <QList>
+#include <QNetworkCookie>
+#include <QNetworkRequest>
+#include <QStringList>
+#include <QTextStream>
+#include <QUrl>
+
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+  void usage( QTextStream &err )
+  {
+    err << "Usage: qgis_saml2_login [--master-password-file FILE] [--cookies FILE] AUTHCFG URL...\n"
+        << "\n"
+        << "Logs in to the SAML2 ECP protected services at URL with the auth config AUTHCFG.\n"
+        << "\n"
+        << "  --master-password-file FILE  read the master password of the QGIS auth database from FILE\n"
+        << "  --cookies FILE               write the session cookies to FILE in the Netscape format\n";
+  }
+
+  QString readPassword( const QString &fileName )
+  {
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+      return QString();
+    return QString::fromUtf8( file.readLine() ).trimmed();
+  }
+
+  bool writeCookies( const QString &fileName, const QList<QNetworkCookie> &cookies )
+  {
+    // the cookies are as good as the password, the file is created for the owner only
+#ifdef Q_OS_UNIX
+    mode_t mask = umask( 077 );
+#endif
+#if QT_VERSION >= 0x050100
+    QSaveFile file( fileName );
+    bool opened = file.open( QIODevice::WriteOnly | QIODevice::Text );
+#else
+    QFile file( fileName );
+    bool opened = file.open( QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text );
+#endif
+#ifdef Q_OS_UNIX
+    umask( mask );
+#endif
+    // an existing file keeps its permissions otherwise; nothing is written yet
+    if ( !opened || !file.setPermissions( QFile::ReadOwner | QFile::WriteOwner ) )
+      return false;
+
+    QTextStream out( &file );
+    out << "# Netscape HTTP Cookie File\n";
+    Q_FOREACH ( const QNetworkCookie &cookie, cookies )
+    {
+      out << cookie.domain() << '\t'
+          << ( cookie.domain().startsWith( '.' ) ? "TRUE" : "FALSE" ) << '\t'
+          << cookie.path() << '\t'
+          << ( cookie.isSecure() ? "TRUE" : "FALSE" ) << '\t'
+          << ( cookie.isSessionCookie() ? 0 : cookie.expirationDate().toTime_t() ) << '\t'
+          << QString::fromUtf8( cookie.name() ) << '\t'
+          << QString::fromUtf8( cookie.value() ) << '\n';
+    }
+    out.flush();
+#if QT_VERSION >= 0x050100
+    return file.commit();
+#else
+    return file.error() == QFile::NoError;
+#endif
+  }
+}
+
+
+/**
+ * qgis_saml2_login logs in to SAML2 ECP protected services ahead of a batch job.
+ *
+ * The logins run side by side and share one IdP session. The sessions end up
+ * wherever the method keeps them across processes: in the session store
+ * (/auth/saml2/persistSessions) and at the session broker
+ * (/auth/saml2/sessionBroker) if another process serves it. With --cookies
+ * they are also written to a Netscape cookie file, for curl, wget or GDAL.
+ */
+int main( int argc, char *argv[] )
+{
+  QgsApplication app( argc, argv, false );
+  QTextStream out( stdout );
+  QTextStream err( stderr );
+
+  QString passwordFile;
+  QString cookieFile;
+  QStringList positional;
+  QStringList args = app.arguments().mid( 1 );
+  for ( int i = 0; i < args.size(); ++i )
+  {
+    const QString &arg = args.at( i );
+    if ( arg == "--master-password-file" && i + 1 < args.size() )
+      passwordFile = args.at( ++i );
+    else if ( arg == "--cookies" && i + 1 < args.size() )
+      cookieFile = args.at( ++i );
+    else if ( arg.startsWith( "--" ) )
+    {
+      usage( err );
+      return 2;
+    }
+    else
+      positional << arg;
+  }
+
+  if ( positional.size() < 2 )
+  {
+    usage( err );
+    return 2;
+  }
+
+  QgsApplication::initQgis();
+
+  if ( !passwordFile.isEmpty() && !QgsAuthManager::instance()->setMasterPassword( readPassword( passwordFile ), true ) )
+  {
+    err << "Master password in " << passwordFile << " does not unlock the auth database\n";
+    QgsApplication::exitQgis();
+    return 1;
+  }
+
+  const QString authcfg = positional.takeFirst();
+  QList<QUrl> endpoints;
+  Q_FOREACH ( const QString &url, positional )
+    endpoints << QUrl( url );
+
+  int failed = 0;
+  QList<QNetworkCookie> cookies;
+  {
+    QgsAuthSAML2Method method;
+    method.preauthenticate( authcfg, endpoints );
+
+    // each request joins the login for its SP and returns once that is done
+    Q_FOREACH ( const QUrl &url, endpoints )
+    {
+      QNetworkRequest request( url );
+      if ( !method.updateNetworkRequest( request, authcfg ) )
+      {
+        out << "FAILED\t" << url.toString() << '\n';
+        ++failed;
+        continue;
+      }
+
+      QList<QNetworkCookie> sessionCookies = qvariant_cast<QList<QNetworkCookie> >( request.header( QNetworkRequest::CookieHeader ) );
+      out << ( sessionCookies.isEmpty() ? "OPEN\t" : "OK\t" ) << url.toString() << '\n';
+      Q_FOREACH ( const QNetworkCookie &cookie, sessionCookies )
+      {
+        if ( !cookies.contains( cookie ) )
+          cookies << cookie;
+      }
+    }
+    out.flush();
+  }
+
+  if ( !cookieFile.isEmpty() && !writeCookies( cookieFile, cookies ) )
+  {
+    err << "Could not write " << cookieFile << '\n';
+    ++failed;
+  }
+
+  QgsAuthSAML2Handshake::shutdownWorker();
+  QgsAuthSAML2Broker::shutdown();
+  QgsApplication::exitQgis();
+  return failed > 0 ? 1 : 0;
+}
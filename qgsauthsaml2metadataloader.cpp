@@ -0,0 +1,395 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2metadataloader.h"
+#include "qgsauthsaml2metadataverifier.h"
+#include "qgsapplication.h"
+#include "qgsnetworkaccessmanager.h"
+#include "qgslogger.h"
+#include "qgsmessagelog.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QRegExp>
+
+namespace
+{
+  const quint32 CACHE_MAGIC = 0x53414d44; // SAMD
+  const quint32 CACHE_VERSION = 3;
+
+  const char *SOAP_BINDING = "urn:oasis:names:tc:SAML:2.0:bindings:SOAP";
+
+  // xs:duration in seconds, years and months taken as 365 and 30 days; -1 if not a duration
+  qint64 durationSeconds( const QString &duration )
+  {
+    QRegExp rx( "^P(?:(\\d+)Y)?(?:(\\d+)M)?(?:(\\d+)D)?(?:T(?:(\\d+)H)?(?:(\\d+)M)?(?:(\\d+)(?:\\.\\d+)?S)?)?$" );
+    if ( duration.isEmpty() || !rx.exactMatch( duration.trimmed() ) )
+      return -1;
+
+    const qint64 factors[] = { 365 * 86400, 30 * 86400, 86400, 3600, 60, 1 };
+    qint64 seconds = 0;
+    for ( int i = 0; i < 6; ++i )
+      seconds += rx.cap( i + 1 ).toLongLong() * factors[i];
+    return seconds;
+  }
+}
+
+
+QDateTime QgsAuthSAML2MetadataLoader::CacheEntry::expires() const
+{
+  QDateTime result = validUntil;
+  if ( cacheDuration >= 0 )
+  {
+    QDateTime byDuration = fetched.addSecs( cacheDuration );
+    if ( !result.isValid() || byDuration < result )
+      result = byDuration;
+  }
+  return result;
+}
+
+QgsAuthSAML2MetadataLoader::QgsAuthSAML2MetadataLoader( QObject *parent )
+  : QObject( parent )
+  , mReply( nullptr )
+  , mHaveCached( false )
+  , mDepth( 0 )
+  , mEntityIsIdP( false )
+  , mInText( false )
+  , mCacheDuration( -1 )
+{
+}
+
+QgsAuthSAML2MetadataLoader::~QgsAuthSAML2MetadataLoader()
+{
+  abort();
+}
+
+QString QgsAuthSAML2MetadataLoader::cacheFileName( const QUrl &url )
+{
+  QByteArray digest = QCryptographicHash::hash( url.toEncoded(), QCryptographicHash::Sha1 ).toHex();
+  return QgsApplication::qgisSettingsDirPath() + "saml2/metadata/" + QString( digest ) + ".cache";
+}
+
+QString QgsAuthSAML2MetadataLoader::indexFileName( const QUrl &url )
+{
+  QString fileName = cacheFileName( url );
+  fileName.replace( fileName.size() - 5, 5, "idx" );
+  return fileName;
+}
+
+void QgsAuthSAML2MetadataLoader::load( const QUrl &url, const QString &certificateFile )
+{
+  abort();
+
+  mUrl = url;
+  mVerifier.reset();
+  QByteArray signer;
+  if ( !certificateFile.isEmpty() )
+  {
+    mVerifier.reset( new QgsAuthSAML2MetadataVerifier( certificateFile ) );
+    if ( !mVerifier->isValid() )
+    {
+      emit loadFailed( tr( "metadata signing certificate %1 could not be read" ).arg( certificateFile ) );
+      return;
+    }
+    signer = mVerifier->certificateFingerprint();
+  }
+
+  // a cache entry without its index is worthless, as is one not verified with the certificate
+  mHaveCached = readCache( url, mCached ) && QFile::exists( indexFileName( url ) )
+                && ( signer.isEmpty() || mCached.signer == signer );
+
+  if ( mHaveCached )
+  {
+    QDateTime expires = mCached.expires();
+    if ( expires.isValid() && QDateTime::currentDateTimeUtc() < expires )
+    {
+      QgsDebugMsg( QString( "Federation metadata of %1 taken from cache, valid until %2" ).arg( url.toString(), expires.toString( Qt::ISODate ) ) );
+      emit indexReady( indexFileName( url ) );
+      return;
+    }
+  }
+
+  QNetworkRequest request( url );
+  // the metadata is cached in its parsed form, not by the network cache
+  request.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork );
+  request.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false );
+  if ( mHaveCached )
+  {
+    if ( !mCached.etag.isEmpty() )
+      request.setRawHeader( "If-None-Match", mCached.etag );
+    if ( !mCached.lastModified.isEmpty() )
+      request.setRawHeader( "If-Modified-Since", mCached.lastModified );
+  }
+
+  resetParser();
+  mReply = QgsNetworkAccessManager::instance()->get( request );
+  connect( mReply, SIGNAL( readyRead() ), this, SLOT( onReadyRead() ) );
+  connect( mReply, SIGNAL( finished() ), this, SLOT( onFinished() ) );
+}
+
+void QgsAuthSAML2MetadataLoader::abort()
+{
+  if ( !mReply )
+    return;
+
+  disconnect( mReply, nullptr, this, nullptr );
+  mReply->abort();
+  mReply->deleteLater();
+  mReply = nullptr;
+}
+
+void QgsAuthSAML2MetadataLoader::onReadyRead()
+{
+  // a 304 has no body, anything else but 200 is reported when finished
+  if ( mReply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt() != 200 )
+    return;
+
+  QByteArray data = mReply->readAll();
+  if ( mVerifier )
+    mVerifier->addData( data );
+  mXml.addData( data );
+  if ( !parseAvailable() )
+    finish( QString( "%1 at line %2" ).arg( mXml.errorString() ).arg( mXml.lineNumber() ) );
+}
+
+void QgsAuthSAML2MetadataLoader::onFinished()
+{
+  QNetworkReply *reply = mReply;
+  mReply = nullptr;
+  reply->deleteLater();
+
+  if ( reply->error() != QNetworkReply::NoError )
+  {
+    if ( mHaveCached )
+    {
+      // better an outdated list than none
+      QgsMessageLog::logMessage( tr( "Federation metadata could not be refreshed, using the cached copy: %1" ).arg( reply->errorString() ), tr( "SAML2" ), QgsMessageLog::WARNING );
+      emit indexReady( indexFileName( mUrl ) );
+    }
+    else
+    {
+      emit loadFailed( reply->errorString() );
+    }
+    return;
+  }
+
+  int status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+  if ( status == 304 && mHaveCached )
+  {
+    QgsDebugMsg( QString( "Federation metadata of %1 not modified" ).arg( mUrl.toString() ) );
+    mCached.fetched = QDateTime::currentDateTimeUtc();
+    writeCache( mUrl, mCached );
+    emit indexReady( indexFileName( mUrl ) );
+    return;
+  }
+
+  if ( status != 200 )
+  {
+    emit loadFailed( tr( "unexpected HTTP status %1 %2" ).arg( status ).arg( reply->attribute( QNetworkRequest::HttpReasonPhraseAttribute ).toString() ) );
+    return;
+  }
+
+  QByteArray data = reply->readAll();
+  if ( mVerifier )
+    mVerifier->addData( data );
+  mXml.addData( data );
+  parseAvailable();
+  if ( mXml.hasError() )
+  {
+    // a truncated document ends up here as PrematureEndOfDocumentError
+    emit loadFailed( QString( "%1 at line %2" ).arg( mXml.errorString() ).arg( mXml.lineNumber() ) );
+    return;
+  }
+
+  QString errorMsg;
+  if ( mVerifier && !mVerifier->verify( &errorMsg ) )
+  {
+    emit loadFailed( tr( "federation metadata signature is not valid: %1" ).arg( errorMsg ) );
+    return;
+  }
+  if ( !mVerifier )
+    QgsDebugMsg( QString( "Federation metadata of %1 taken without signature verification" ).arg( mUrl.toString() ) );
+
+  QDir().mkpath( QFileInfo( indexFileName( mUrl ) ).absolutePath() );
+  if ( !QgsAuthSAML2ProviderIndex::write( indexFileName( mUrl ), mProviders, &errorMsg ) )
+  {
+    emit loadFailed( tr( "provider index could not be written: %1" ).arg( errorMsg ) );
+    return;
+  }
+  QgsDebugMsg( QString( "Indexed %1 IdPs of %2" ).arg( mProviders.size() ).arg( mUrl.toString() ) );
+  mProviders.clear();
+
+  CacheEntry entry;
+  entry.etag = reply->rawHeader( "ETag" );
+  entry.lastModified = reply->rawHeader( "Last-Modified" );
+  entry.fetched = QDateTime::currentDateTimeUtc();
+  entry.validUntil = mValidUntil;
+  entry.cacheDuration = mCacheDuration;
+  if ( mVerifier )
+    entry.signer = mVerifier->certificateFingerprint();
+  if ( !writeCache( mUrl, entry ) )
+    QgsDebugMsg( QString( "Federation metadata cache %1 could not be written" ).arg( cacheFileName( mUrl ) ) );
+
+  mCached = entry;
+  mHaveCached = true;
+  emit indexReady( indexFileName( mUrl ) );
+}
+
+void QgsAuthSAML2MetadataLoader::finish( const QString &error )
+{
+  abort();
+  emit loadFailed( error );
+}
+
+void QgsAuthSAML2MetadataLoader::resetParser()
+{
+  mXml.clear();
+  mDepth = 0;
+  mEntityIsIdP = false;
+  mInText = false;
+  mProvider = QgsAuthSAML2Provider();
+  mProviders.clear();
+  mValidUntil = QDateTime();
+  mCacheDuration = -1;
+}
+
+bool QgsAuthSAML2MetadataLoader::parseAvailable()
+{
+  while ( !mXml.atEnd() )
+  {
+    QXmlStreamReader::TokenType token = mXml.readNext();
+    if ( mVerifier )
+      mVerifier->process( mXml );
+    if ( token == QXmlStreamReader::StartElement )
+    {
+      ++mDepth;
+      if ( mDepth == 1 )
+      {
+        // caching limits of the aggregate, or of a single entity
+        QXmlStreamAttributes attrs = mXml.attributes();
+        mValidUntil = QDateTime::fromString( attrs.value( "validUntil" ).toString(), Qt::ISODate );
+        mCacheDuration = durationSeconds( attrs.value( "cacheDuration" ).toString() );
+      }
+
+      if ( mXml.name() == "EntityDescriptor" )
+      {
+        mEntityIsIdP = false;
+        mProvider = QgsAuthSAML2Provider();
+        mProvider.entityId = mXml.attributes().value( "entityID" ).toString();
+      }
+      else if ( mXml.name() == "IDPSSODescriptor" )
+      {
+        mEntityIsIdP = true;
+      }
+      else if ( mEntityIsIdP && mXml.name() == "SingleSignOnService" )
+      {
+        QXmlStreamAttributes attrs = mXml.attributes();
+        if ( attrs.value( "Binding" ) == SOAP_BINDING )
+        {
+          mProvider.ecpUrl = attrs.value( "Location" ).toString();
+          mProvider.ecpUrls << mProvider.ecpUrl;
+        }
+      }
+      else if ( mEntityIsIdP && ( mXml.name() == "DisplayName" || mXml.name() == "Scope" ) )
+      {
+        // the text may arrive in a later chunk, collect it until the end tag
+        mInText = true;
+        mTextLang = mXml.attributes().value( "xml:lang" ).toString();
+        mText.clear();
+      }
+    }
+    else if ( token == QXmlStreamReader::Characters && mInText )
+    {
+      mText += mXml.text();
+    }
+    else if ( token == QXmlStreamReader::EndElement )
+    {
+      --mDepth;
+      if ( mInText && mXml.name() == "DisplayName" )
+      {
+        mInText = false;
+        QString name = mText.trimmed();
+        mProvider.displayNames << qMakePair( mTextLang, name );
+        // first name given, unless there is an English one
+        if ( mProvider.displayName.isEmpty() || mTextLang.startsWith( "en" ) )
+          mProvider.displayName = name;
+      }
+      else if ( mInText && mXml.name() == "Scope" )
+      {
+        mInText = false;
+        mProvider.scopes << mText.trimmed();
+      }
+      else if ( mXml.name() == "EntityDescriptor" )
+      {
+        if ( mEntityIsIdP && !mProvider.ecpUrl.isEmpty() )
+        {
+          if ( mProvider.displayName.isEmpty() )
+            mProvider.displayName = mProvider.entityId;
+          mProviders << mProvider;
+        }
+        mEntityIsIdP = false;
+      }
+    }
+  }
+
+  return !mXml.hasError() || mXml.error() == QXmlStreamReader::PrematureEndOfDocumentError;
+}
+
+bool QgsAuthSAML2MetadataLoader::readCache( const QUrl &url, CacheEntry &entry )
+{
+  QFile file( cacheFileName( url ) );
+  if ( !file.open( QIODevice::ReadOnly ) )
+    return false;
+
+  QDataStream in( &file );
+  quint32 magic, version;
+  QUrl cachedUrl;
+  in >> magic >> version;
+  if ( magic != CACHE_MAGIC || version != CACHE_VERSION )
+    return false;
+
+  in >> cachedUrl >> entry.etag >> entry.lastModified >> entry.fetched >> entry.validUntil >> entry.cacheDuration >> entry.signer;
+  return in.status() == QDataStream::Ok && cachedUrl == url;
+}
+
+bool QgsAuthSAML2MetadataLoader::writeCache( const QUrl &url, const CacheEntry &entry )
+{
+  QString fileName = cacheFileName( url );
+  QDir().mkpath( QFileInfo( fileName ).absolutePath() );
+
+  // write aside and swap, the GUI of another QGIS may be reading it
+  QFile file( fileName + ".new" );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    return false;
+
+  QDataStream out( &file );
+  out << CACHE_MAGIC << CACHE_VERSION;
+  out << url << entry.etag << entry.lastModified << entry.fetched << entry.validUntil << entry.cacheDuration << entry.signer;
+  file.close();
+
+  if ( out.status() != QDataStream::Ok || file.error() != QFile::NoError )
+  {
+    file.remove();
+    return false;
+  }
+
+  QFile::remove( fileName );
+  return file.rename( fileName );
+}
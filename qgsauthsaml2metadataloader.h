@@ -0,0 +1,124 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2METADATALOADER_H
+#define QGSAUTHSAML2METADATALOADER_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QObject>
+#include <QScopedPointer>
+#include <QString>
+#include <QUrl>
+#include <QXmlStreamReader>
+
+#include "qgsauthsaml2providerindex.h"
+
+class QgsAuthSAML2MetadataVerifier;
+class QNetworkReply;
+
+/**
+ * Loads the IdPs of a federation from its metadata, off the GUI thread.
+ *
+ * The loader is meant to live on a thread of its own. The metadata is parsed
+ * chunk by chunk as it arrives, so an aggregate of tens of MB is never held
+ * in memory nor parsed in one go. The providers found are written to a
+ * QgsAuthSAML2ProviderIndex in the QGIS settings directory, next to a cache
+ * file with the validators of the response: while the index is within its
+ * validUntil/cacheDuration it is handed out without any network access,
+ * afterwards it is revalidated with a conditional request.
+ *
+ * Given the certificate of the federation operator, the loader verifies the
+ * metadata signature in the same pass and only indexes signed metadata.
+ */
+class QgsAuthSAML2MetadataLoader : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit QgsAuthSAML2MetadataLoader( QObject *parent = nullptr );
+  ~QgsAuthSAML2MetadataLoader();
+
+  /** Path of the cache file for the metadata at url */
+  static QString cacheFileName( const QUrl &url );
+
+  /** Path of the provider index for the metadata at url */
+  static QString indexFileName( const QUrl &url );
+
+public slots:
+  /**
+   * Loads the providers of url into its index, aborting a load in progress.
+   * With a certificateFile (PEM) only metadata signed with that certificate is accepted.
+   */
+  void load( const QUrl &url, const QString &certificateFile = QString() );
+
+  void abort();
+
+signals:
+  /** The provider index of the requested metadata is up to date */
+  void indexReady( const QString &fileName );
+
+  void loadFailed( const QString &error );
+
+private slots:
+  void onReadyRead();
+
+  void onFinished();
+
+private:
+  struct CacheEntry
+  {
+    CacheEntry() : cacheDuration( -1 ) {}
+
+    QByteArray etag;
+    QByteArray lastModified;
+    QDateTime fetched;
+    QDateTime validUntil;
+    qint64 cacheDuration;        //!< seconds, -1 if not given
+    QByteArray signer;           //!< fingerprint of the certificate the metadata was verified with
+
+    //! Until when the entry may be used without asking the server, invalid if the metadata does not say
+    QDateTime expires() const;
+  };
+
+  static bool readCache( const QUrl &url, CacheEntry &entry );
+  static bool writeCache( const QUrl &url, const CacheEntry &entry );
+
+  void resetParser();
+
+  /** Consumes the tokens available so far, returns false on a parse error */
+  bool parseAvailable();
+
+  void finish( const QString &error );
+
+  QNetworkReply *mReply;
+  QUrl mUrl;
+  CacheEntry mCached;
+  bool mHaveCached;
+  QScopedPointer<QgsAuthSAML2MetadataVerifier> mVerifier;
+
+  QXmlStreamReader mXml;
+  int mDepth;
+  bool mEntityIsIdP;
+  bool mInText;
+  QString mTextLang;
+  QString mText;
+  QgsAuthSAML2Provider mProvider;
+  QgsAuthSAML2ProviderList mProviders;
+  QDateTime mValidUntil;
+  qint64 mCacheDuration;
+};
+
+#endif // QGSAUTHSAML2METADATALOADER_H
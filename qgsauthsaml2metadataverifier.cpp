@@ -0,0 +1,458 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2metadataverifier.h"
+#include "qgsapplication.h"
+#include "qgslogger.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPair>
+#include <QTextStream>
+
+#include <algorithm>
+
+namespace
+{
+  const char *nsDSIG = "http://www.w3.org/2000/09/xmldsig#";
+  const char *nsEXC_C14N = "http://www.w3.org/2001/10/xml-exc-c14n#";
+  const char *ENVELOPED_SIGNATURE = "http://www.w3.org/2000/09/xmldsig#enveloped-signature";
+  const char *DIGEST_SHA1 = "http://www.w3.org/2000/09/xmldsig#sha1";
+  const char *DIGEST_SHA256 = "http://www.w3.org/2001/04/xmlenc#sha256";
+  const char *RSA_SHA1 = "http://www.w3.org/2000/09/xmldsig#rsa-sha1";
+  const char *RSA_SHA256 = "http://www.w3.org/2001/04/xmldsig-more#rsa-sha256";
+
+  const int KNOWN_GOOD_MAX = 64;
+
+  // documents verified before, as content digest and certificate fingerprint
+  QMutex sKnownGoodMutex;
+
+  QString knownGoodFileName()
+  {
+    return QgsApplication::qgisSettingsDirPath() + "saml2/metadata/verified";
+  }
+
+  QStringList knownGood()
+  {
+    QStringList entries;
+    QFile file( knownGoodFileName() );
+    if ( file.open( QIODevice::ReadOnly | QIODevice::Text ) )
+    {
+      QTextStream in( &file );
+      while ( !in.atEnd() )
+        entries << in.readLine();
+    }
+    return entries;
+  }
+
+  void rememberGood( const QString &entry )
+  {
+    QStringList entries = knownGood();
+    entries.removeAll( entry );
+    entries.prepend( entry );
+    while ( entries.size() > KNOWN_GOOD_MAX )
+      entries.removeLast();
+
+    // on the first download the verifier runs before the loader created the metadata directory
+    QDir().mkpath( QFileInfo( knownGoodFileName() ).absolutePath() );
+    QFile file( knownGoodFileName() );
+    if ( file.open( QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text ) )
+    {
+      QTextStream out( &file );
+      Q_FOREACH ( const QString &line, entries )
+        out << line << '\n';
+    }
+  }
+
+  void escape( const QStringRef &text, bool attribute, QString &out )
+  {
+    for ( int i = 0; i < text.size(); ++i )
+    {
+      const QChar c = text.at( i );
+      if ( c == '&' )
+        out += "&amp;";
+      else if ( c == '<' )
+        out += "&lt;";
+      else if ( c == '>' && !attribute )
+        out += "&gt;";
+      else if ( c == '"' && attribute )
+        out += "&quot;";
+      else if ( c == '\t' && attribute )
+        out += "&#x9;";
+      else if ( c == '\n' && attribute )
+        out += "&#xA;";
+      else if ( c == '\r' )
+        out += "&#xD;";
+      else
+        out += c;
+    }
+  }
+
+  // c14n orders attributes by namespace URI, then local name
+  bool attributeLess( const QXmlStreamAttribute &a, const QXmlStreamAttribute &b )
+  {
+    int byNamespace = QStringRef::compare( a.namespaceUri(), b.namespaceUri().toString() );
+    return byNamespace != 0 ? byNamespace < 0 : QStringRef::compare( a.name(), b.name().toString() ) < 0;
+  }
+
+  QByteArray base64Value( const QString &text )
+  {
+    QString compact = text;
+    compact.remove( ' ' ).remove( '\t' ).remove( '\n' ).remove( '\r' );
+    return QByteArray::fromBase64( compact.toLatin1() );
+  }
+}
+
+
+void QgsAuthSAML2MetadataVerifier::Canonicalizer::startElement( const QXmlStreamReader &xml, QByteArray &out )
+{
+  // exclusive c14n declares only the namespaces the element and its attributes use
+  QList< QPair<QString, QString> > used;
+  used << qMakePair( xml.prefix().toString(), xml.namespaceUri().toString() );
+  QXmlStreamAttributes attributes = xml.attributes();
+  Q_FOREACH ( const QXmlStreamAttribute &attribute, attributes )
+  {
+    if ( !attribute.prefix().isEmpty() && attribute.prefix() != QLatin1String( "xml" ) )
+      used << qMakePair( attribute.prefix().toString(), attribute.namespaceUri().toString() );
+  }
+
+  QHash<QString, QString> rendered;
+  for ( int i = 0; i < used.size(); ++i )
+  {
+    const QString &prefix = used.at( i ).first;
+    const QString &uri = used.at( i ).second;
+    if ( rendered.contains( prefix ) )
+      continue;
+
+    bool inScope = false;
+    QString scopeUri;
+    for ( int level = mRendered.size() - 1; level >= 0 && !inScope; --level )
+    {
+      QHash<QString, QString>::const_iterator it = mRendered.at( level ).constFind( prefix );
+      if ( it != mRendered.at( level ).constEnd() )
+      {
+        inScope = true;
+        scopeUri = it.value();
+      }
+    }
+    // an empty default namespace is only rendered to undo an outer one
+    if ( inScope ? scopeUri == uri : uri.isEmpty() )
+      continue;
+    rendered.insert( prefix, uri );
+  }
+
+  QString tag( "<" );
+  tag += xml.qualifiedName();
+
+  QStringList prefixes = rendered.keys();
+  prefixes.sort();
+  Q_FOREACH ( const QString &prefix, prefixes )
+  {
+    tag += prefix.isEmpty() ? QString( " xmlns=\"" ) : QString( " xmlns:%1=\"" ).arg( prefix );
+    QString uri = rendered.value( prefix );
+    escape( QStringRef( &uri ), true, tag );
+    tag += '"';
+  }
+
+  QVector<QXmlStreamAttribute> sorted = attributes;
+  std::sort( sorted.begin(), sorted.end(), attributeLess );
+  Q_FOREACH ( const QXmlStreamAttribute &attribute, sorted )
+  {
+    tag += ' ';
+    tag += attribute.qualifiedName();
+    tag += "=\"";
+    escape( attribute.value(), true, tag );
+    tag += '"';
+  }
+  tag += '>';
+
+  out += tag.toUtf8();
+  mRendered << rendered;
+}
+
+void QgsAuthSAML2MetadataVerifier::Canonicalizer::endElement( const QXmlStreamReader &xml, QByteArray &out )
+{
+  out += "</";
+  out += xml.qualifiedName().toString().toUtf8();
+  out += '>';
+  if ( !mRendered.isEmpty() )
+    mRendered.pop_back();
+}
+
+void QgsAuthSAML2MetadataVerifier::Canonicalizer::characters( const QXmlStreamReader &xml, QByteArray &out )
+{
+  QString text;
+  escape( xml.text(), false, text );
+  out += text.toUtf8();
+}
+
+void QgsAuthSAML2MetadataVerifier::Canonicalizer::processingInstruction( const QXmlStreamReader &xml, QByteArray &out )
+{
+  QString pi = "<?" + xml.processingInstructionTarget().toString();
+  if ( !xml.processingInstructionData().isEmpty() )
+    pi += ' ' + xml.processingInstructionData().toString();
+  pi += "?>";
+  out += pi.toUtf8();
+}
+
+
+QgsAuthSAML2MetadataVerifier::QgsAuthSAML2MetadataVerifier( const QString &certificateFile )
+  : mContentHash( "sha256" )
+  , mDepth( 0 )
+  , mUnsigned( false )
+  , mSignatureSeen( false )
+  , mSignatureDepth( 0 )
+  , mInSignedInfo( false )
+  , mReferences( 0 )
+{
+  QCA::ConvertResult result;
+  QCA::Certificate certificate = QCA::Certificate::fromPEMFile( certificateFile, &result );
+  if ( result == QCA::ConvertGood )
+    mCertificate = certificate;
+}
+
+QByteArray QgsAuthSAML2MetadataVerifier::certificateFingerprint() const
+{
+  return QCA::Hash( "sha256" ).hashToString( mCertificate.toDER() ).toLatin1();
+}
+
+void QgsAuthSAML2MetadataVerifier::addData( const QByteArray &data )
+{
+  mContentHash.update( data );
+}
+
+void QgsAuthSAML2MetadataVerifier::digest( const QByteArray &canonical )
+{
+  if ( mDigest )
+    mDigest->update( canonical );
+  else if ( !mUnsigned )
+    mPending += canonical;
+}
+
+void QgsAuthSAML2MetadataVerifier::process( const QXmlStreamReader &xml )
+{
+  switch ( xml.tokenType() )
+  {
+    case QXmlStreamReader::StartElement:
+    {
+      ++mDepth;
+      bool isDsig = xml.namespaceUri() == nsDSIG;
+
+      if ( mDepth == 1 )
+      {
+        QXmlStreamAttributes attributes = xml.attributes();
+        mRootId = attributes.hasAttribute( "ID" ) ? attributes.value( "ID" ).toString() : attributes.value( "Id" ).toString();
+      }
+      else if ( mDepth == 2 && !mSignatureSeen && !mUnsigned )
+      {
+        // the schema puts the signature in front of all other children
+        if ( isDsig && xml.name() == "Signature" )
+        {
+          mSignatureSeen = true;
+          mSignatureDepth = mDepth;
+          return;
+        }
+        mUnsigned = true;
+        mPending.clear();
+      }
+
+      if ( !mSignatureDepth )
+      {
+        QByteArray canonical;
+        mDocument.startElement( xml, canonical );
+        digest( canonical );
+        return;
+      }
+
+      if ( isDsig && xml.name() == "SignedInfo" )
+        mInSignedInfo = true;
+      if ( mInSignedInfo )
+        mSignedInfoC14n.startElement( xml, mSignedInfo );
+      mText.clear();
+
+      QXmlStreamAttributes attributes = xml.attributes();
+      if ( isDsig && xml.name() == "CanonicalizationMethod" )
+      {
+        mCanonicalizationMethod = attributes.value( "Algorithm" ).toString();
+      }
+      else if ( isDsig && xml.name() == "SignatureMethod" )
+      {
+        mSignatureMethod = attributes.value( "Algorithm" ).toString();
+      }
+      else if ( isDsig && xml.name() == "Reference" )
+      {
+        ++mReferences;
+        mReferenceUri = attributes.value( "URI" ).toString();
+      }
+      else if ( isDsig && xml.name() == "Transform" )
+      {
+        mTransforms << attributes.value( "Algorithm" ).toString();
+      }
+      else if ( xml.namespaceUri() == nsEXC_C14N && xml.name() == "InclusiveNamespaces" )
+      {
+        mInclusivePrefixes = attributes.value( "PrefixList" ).toString().trimmed();
+      }
+      else if ( isDsig && xml.name() == "DigestMethod" && !mDigest )
+      {
+        // from here on the document is hashed as it streams by
+        mDigestMethod = attributes.value( "Algorithm" ).toString();
+        if ( mDigestMethod == DIGEST_SHA256 )
+          mDigest.reset( new QCA::Hash( "sha256" ) );
+        else if ( mDigestMethod == DIGEST_SHA1 )
+          mDigest.reset( new QCA::Hash( "sha1" ) );
+        else
+          mUnsigned = true;
+
+        if ( mDigest )
+          mDigest->update( mPending );
+        mPending.clear();
+      }
+      return;
+    }
+
+    case QXmlStreamReader::EndElement:
+    {
+      int depth = mDepth--;
+      if ( !mSignatureDepth )
+      {
+        QByteArray canonical;
+        mDocument.endElement( xml, canonical );
+        digest( canonical );
+        return;
+      }
+
+      if ( depth == mSignatureDepth )
+      {
+        mSignatureDepth = 0;
+        return;
+      }
+
+      bool isDsig = xml.namespaceUri() == nsDSIG;
+      if ( mInSignedInfo )
+      {
+        mSignedInfoC14n.endElement( xml, mSignedInfo );
+        if ( isDsig && xml.name() == "SignedInfo" )
+          mInSignedInfo = false;
+      }
+
+      if ( isDsig && xml.name() == "DigestValue" )
+        mDigestValue = base64Value( mText );
+      else if ( isDsig && xml.name() == "SignatureValue" )
+        mSignatureValue = base64Value( mText );
+      return;
+    }
+
+    case QXmlStreamReader::Characters:
+    {
+      // outside of the root element nothing is canonical
+      if ( mDepth == 0 )
+        return;
+
+      if ( !mSignatureDepth )
+      {
+        QByteArray canonical;
+        mDocument.characters( xml, canonical );
+        digest( canonical );
+        return;
+      }
+
+      if ( mInSignedInfo )
+        mSignedInfoC14n.characters( xml, mSignedInfo );
+      mText += xml.text();
+      return;
+    }
+
+    case QXmlStreamReader::ProcessingInstruction:
+    {
+      if ( mDepth == 0 || mSignatureDepth )
+        return;
+      QByteArray canonical;
+      mDocument.processingInstruction( xml, canonical );
+      digest( canonical );
+      return;
+    }
+
+    default:
+      // comments are dropped by c14n, the rest does not occur inside the root
+      return;
+  }
+}
+
+bool QgsAuthSAML2MetadataVerifier::fail( QString *error, const QString &message )
+{
+  QgsDebugMsg( QString( "Federation metadata verification failed: %1" ).arg( message ) );
+  if ( error )
+    *error = message;
+  return false;
+}
+
+bool QgsAuthSAML2MetadataVerifier::verify( QString *error )
+{
+  if ( !isValid() )
+    return fail( error, QStringLiteral( "signing certificate could not be read" ) );
+
+  mContentDigest = mContentHash.final().toByteArray().toHex();
+  QString knownGoodEntry = QString( "%1 %2" ).arg( QString( mContentDigest ), QString( certificateFingerprint() ) );
+  {
+    QMutexLocker locker( &sKnownGoodMutex );
+    if ( knownGood().contains( knownGoodEntry ) )
+    {
+      QgsDebugMsg( "Federation metadata unchanged since its signature was verified" );
+      return true;
+    }
+  }
+
+  if ( !mSignatureSeen )
+    return fail( error, QStringLiteral( "metadata is not signed" ) );
+  if ( mReferences != 1 )
+    return fail( error, QStringLiteral( "signature must have exactly one reference" ) );
+  if ( !mReferenceUri.isEmpty() && ( mRootId.isEmpty() || mReferenceUri != '#' + mRootId ) )
+    return fail( error, QStringLiteral( "signature does not reference the metadata root" ) );
+  if ( mCanonicalizationMethod != nsEXC_C14N )
+    return fail( error, QStringLiteral( "unsupported canonicalization %1" ).arg( mCanonicalizationMethod ) );
+  if ( !mTransforms.contains( ENVELOPED_SIGNATURE ) )
+    return fail( error, QStringLiteral( "signature is not enveloped" ) );
+  Q_FOREACH ( const QString &transform, mTransforms )
+  {
+    if ( transform != ENVELOPED_SIGNATURE && transform != nsEXC_C14N )
+      return fail( error, QStringLiteral( "unsupported transform %1" ).arg( transform ) );
+  }
+  if ( !mInclusivePrefixes.isEmpty() )
+    return fail( error, QStringLiteral( "inclusive namespace prefixes are not supported" ) );
+  if ( !mDigest )
+    return fail( error, QStringLiteral( "unsupported digest %1" ).arg( mDigestMethod ) );
+
+  if ( mDigest->final().toByteArray() != mDigestValue )
+    return fail( error, QStringLiteral( "metadata digest does not match, the content was modified" ) );
+
+  QCA::SignatureAlgorithm algorithm;
+  if ( mSignatureMethod == RSA_SHA256 )
+    algorithm = QCA::EMSA3_SHA256;
+  else if ( mSignatureMethod == RSA_SHA1 )
+    algorithm = QCA::EMSA3_SHA1;
+  else
+    return fail( error, QStringLiteral( "unsupported signature method %1" ).arg( mSignatureMethod ) );
+
+  QCA::PublicKey key = mCertificate.subjectPublicKey();
+  if ( !key.canVerify() || !key.verifyMessage( mSignedInfo, mSignatureValue, algorithm ) )
+    return fail( error, QStringLiteral( "signature does not match the signing certificate" ) );
+
+  QMutexLocker locker( &sKnownGoodMutex );
+  rememberGood( knownGoodEntry );
+  return true;
+}
@@ -0,0 +1,118 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2METADATAVERIFIER_H
+#define QGSAUTHSAML2METADATAVERIFIER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QScopedPointer>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QXmlStreamReader>
+#include <QtCrypto>
+
+/**
+ * Verifies the enveloped XML signature of federation metadata while the
+ * metadata is parsed.
+ *
+ * The loader hands every token of its QXmlStreamReader to process(). The
+ * verifier canonicalises the tokens on the fly with exclusive XML
+ * canonicalisation and feeds them to the reference digest, skipping the
+ * signature itself; SignedInfo is canonicalised into a small buffer of its
+ * own. Nothing of the document is kept, so verification adds no memory that
+ * grows with the size of the aggregate. verify() then compares the digest
+ * and checks the signature value against the configured certificate.
+ *
+ * Only what federations use is supported: a single reference to the root
+ * element, enveloped-signature and exclusive c14n transforms, RSA with
+ * SHA-1 or SHA-256.
+ */
+class QgsAuthSAML2MetadataVerifier
+{
+public:
+  /** Verifies against the certificate in PEM file certificateFile */
+  explicit QgsAuthSAML2MetadataVerifier( const QString &certificateFile );
+
+  /** False if the certificate could not be read */
+  bool isValid() const { return !mCertificate.isNull(); }
+
+  /** SHA-256 of the signing certificate, hex encoded */
+  QByteArray certificateFingerprint() const;
+
+  /** Raw bytes of the document, in the order they arrive */
+  void addData( const QByteArray &data );
+
+  /** The token the reader just read */
+  void process( const QXmlStreamReader &xml );
+
+  /**
+   * Checks the signature once the document is complete.
+   * A document known to be signed correctly is not checked again.
+   */
+  bool verify( QString *error = nullptr );
+
+private:
+  //! Exclusive c14n of the tokens of one subtree
+  class Canonicalizer
+  {
+    public:
+      void startElement( const QXmlStreamReader &xml, QByteArray &out );
+      void endElement( const QXmlStreamReader &xml, QByteArray &out );
+      void characters( const QXmlStreamReader &xml, QByteArray &out );
+      void processingInstruction( const QXmlStreamReader &xml, QByteArray &out );
+
+    private:
+      //! prefixes rendered per open element
+      QVector< QHash<QString, QString> > mRendered;
+  };
+
+  void digest( const QByteArray &canonical );
+
+  bool fail( QString *error, const QString &message );
+
+  QCA::Certificate mCertificate;
+  QCA::Hash mContentHash;
+  QByteArray mContentDigest;
+
+  int mDepth;
+  QString mRootId;
+  Canonicalizer mDocument;
+  QByteArray mPending;            //!< canonical bytes before the digest method is known
+  QScopedPointer<QCA::Hash> mDigest;
+  bool mUnsigned;                 //!< the root has no signature as first child
+
+  bool mSignatureSeen;
+  int mSignatureDepth;            //!< 0 unless inside the signature
+  bool mInSignedInfo;
+  Canonicalizer mSignedInfoC14n;
+  QByteArray mSignedInfo;
+  QString mText;
+
+  QString mCanonicalizationMethod;
+  QString mSignatureMethod;
+  QString mDigestMethod;
+  QString mReferenceUri;
+  QStringList mTransforms;
+  QString mInclusivePrefixes;
+  int mReferences;
+  QByteArray mDigestValue;
+  QByteArray mSignatureValue;
+
+  Q_DISABLE_COPY( QgsAuthSAML2MetadataVerifier )
+};
+
+#endif // QGSAUTHSAML2METADATAVERIFIER_H
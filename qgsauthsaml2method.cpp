@@ -14,45 +14,139 @@
 
 
 #include "qgsauthsaml2method.h"
-#include "qgsauthsaml2edit.h"
+#include "qgsauthsaml2broker.h"
+#include "qgsauthsaml2cookies.h"
+#include "qgsauthsaml2handshake.h"
+#include "qgsauthsaml2metrics.h"
+#include "qgsauthsaml2sessionstore.h"
+#include "qgsauthsaml2trace.h"
+#include "qgsapplication.h"
 #include "qgsnetworkaccessmanager.h"
 #include "qgsauthmanager.h"
 #include "qgslogger.h"
 #include "qgsmessagelog.h"
 
-#include <QDomDocument>
+#include <QAbstractNetworkCache>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QNetworkCacheMetaData>
 #include <QNetworkRequest>
-#include <QNetworkReply>
-#include <QBuffer>
 #include <QNetworkCookie>
-#include <QDomNamedNodeMap>
+#include <QNetworkReply>
+#include <QMutexLocker>
+#include <QSet>
 #include <QSettings>
 
+#include <climits>
+
 static const QString AUTH_METHOD_KEY = "SAML2";
 static const QString AUTH_METHOD_DESCRIPTION = "SAML2 authentication";
 
-QMap<QString, QgsAuthMethodConfig> QgsAuthSAML2Method::mAuthConfigCache = QMap<QString, QgsAuthMethodConfig>();
+QgsAuthSAML2ShardedCache<QgsAuthMethodConfig> QgsAuthSAML2Method::mAuthConfigCache;
 
 namespace
 {
-  QDomNode namedItemNS(const QDomNodeList &nodes, const char *nsURI, const char *localName)
+  int handshakeLegTimeout()
   {
-    QDomNode n;
-    int ix, count = nodes.count();
-    for (ix=0; ix < count; ix++)
-    {
-      n = nodes.at(ix);
-      //QgsDebugMsg(QString("element name: %1 nsURI: %2").arg(n.localName(),n.namespaceURI()));		
-      if ((n.localName() == localName) && (n.namespaceURI() == nsURI))
-        return n;
-    }
-    return QDomNode();
+    return QSettings().value( "/qgis/networkAndProxy/networkTimeout", "60000" ).toInt();
+  }
+
+  // seconds an endpoint that did not challenge is trusted not to, 0 disables the negative cache
+  int noChallengeTtl()
+  {
+    return QSettings().value( "/auth/saml2/noChallengeTtl", 300 ).toInt();
+  }
+
+  // the probe outcome belongs to the endpoint, not to the query of a single request
+  QString endpointKey( const QUrl &url )
+  {
+    return QString( "%1://%2:%3%4" ).arg( url.scheme(), url.host() )
+           .arg( url.port( url.scheme() == "https" ? 443 : 80 ) ).arg( url.path() );
+  }
+
+  // seconds before expiry at which a session is renewed in the background
+  int renewBefore()
+  {
+    return QSettings().value( "/auth/saml2/renewBefore", 120 ).toInt();
+  }
+
+  // signal to the SP that we understand SAML2 ECP
+  void prepareEcpRequest( QNetworkRequest &request )
+  {
+    request.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork );
+    request.setAttribute( QNetworkRequest::CacheSaveControlAttribute, true );
+
+    request.setRawHeader("PAOS", "ver=\"urn:liberty:paos:2003-08\";\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\"");
+    request.setRawHeader("Accept", "text/xml; application/vnd.paos+xml");
+  }
+
+  // seconds between dumps of the metrics to saml2metrics.prom, 0 disables the dump
+  int metricsDumpInterval()
+  {
+    return QSettings().value( "/auth/saml2/metricsDumpInterval", 0 ).toInt();
+  }
+
+  // 0 off, 1 handshake events, 2 events and redacted SOAP envelopes
+  QgsAuthSAML2Trace::Level traceLevel()
+  {
+    int level = QSettings().value( "/auth/saml2/traceLevel", 0 ).toInt();
+    return QgsAuthSAML2Trace::Level( qBound( int( QgsAuthSAML2Trace::Off ), level, int( QgsAuthSAML2Trace::Payloads ) ) );
+  }
+
+  // SP sessions kept in memory, the least recently used go first
+  int sessionCapacity()
+  {
+    return QSettings().value( "/auth/saml2/sessionCapacity", 256 ).toInt();
+  }
+
+  // seconds a restored session without expiry is trusted, matching common SP defaults
+  int assumedSessionLifetime()
+  {
+    return QSettings().value( "/auth/saml2/sessionLifetime", 28800 ).toInt();
+  }
+
+  // the SP deployment a request goes to
+  QString spEndpoint( const QUrl &url )
+  {
+    return QString( "%1://%2:%3" ).arg( url.scheme(), url.host() )
+           .arg( url.port( url.scheme() == "https" ? 443 : 80 ) );
+  }
+
+  // one ECP login, and one SP session, per authcfg and SP deployment
+  QString handshakeKey( const QString &authcfg, const QUrl &url )
+  {
+    return QString( "%1|%2" ).arg( authcfg, spEndpoint( url ) );
+  }
+
+  // seconds a SP or IdP is left alone after its first failed handshake, doubled on each further failure
+  int backoffInitial()
+  {
+    return QSettings().value( "/auth/saml2/backoffInitial", 5 ).toInt();
+  }
+
+  int backoffMax()
+  {
+    return QSettings().value( "/auth/saml2/backoffMax", 300 ).toInt();
+  }
+
+  // serve fresh cached responses of the partition without probing the SP or logging in
+  bool cacheFirst()
+  {
+    return QSettings().value( "/auth/saml2/cacheFirst", false ).toBool();
+  }
+
+  // the value of a setting QgsAuthSAML2Method::reloadSettings() read
+  int current( QAtomicInt &setting )
+  {
+    return setting.fetchAndAddRelaxed( 0 );
   }
 }
 
 
 QgsAuthSAML2Method::QgsAuthSAML2Method()
   : QgsAuthMethod()
+  , mSessionsRestored( false )
+  , mPersistPending( 0 )
 {
   setVersion( 1 );
   setExpansions( QgsAuthMethod::NetworkRequest | QgsAuthMethod::NetworkReply );
@@ -61,10 +155,53 @@ QgsAuthSAML2Method::QgsAuthSAML2Method()
     << "wfs"  // convert to lowercase
     << "wcs"
     << "wms" );
+
+  reloadSettings();
+  mSessionCache.setCapacity( sessionCapacity() );
+  mNoChallengeCache.setCapacity( 1024 );
+  mCacheOwners.setCapacity( 4096 );
+
+  QgsAuthSAML2Trace::configure( traceLevel(), QSettings().value( "/auth/saml2/traceEntries", 256 ).toInt() );
+
+  mRenewalTimer.setSingleShot( true );
+  connect( &mRenewalTimer, SIGNAL( timeout() ), this, SLOT( renewSessions() ) );
+
+  int dumpInterval = metricsDumpInterval();
+  if ( dumpInterval > 0 )
+  {
+    connect( &mMetricsTimer, SIGNAL( timeout() ), this, SLOT( dumpMetrics() ) );
+    mMetricsTimer.start( 1000 * dumpInterval );
+  }
 }
 
 QgsAuthSAML2Method::~QgsAuthSAML2Method()
 {
+  QList<QSharedPointer<QgsAuthSAML2Handshake> > inFlight;
+  {
+    QMutexLocker locker( &mHandshakesMutex );
+    inFlight = mHandshakes.values();
+  }
+
+  // retireHandshakes() runs on the worker before the waiters are released; let the
+  // handshakes publish their sessions, then cut them off from this method. Once the
+  // worker stopped, nothing will finish any more.
+  bool wait = QgsAuthSAML2Handshake::isWorkerRunning() && !QgsAuthSAML2Handshake::isWorkerThread();
+  Q_FOREACH ( const QSharedPointer<QgsAuthSAML2Handshake> &handshake, inFlight )
+  {
+    if ( wait && handshake->waitForFinished( handshake->timeBudget() ) )
+      continue;
+
+    disconnect( handshake.data(), SIGNAL( finished() ), this, SLOT( retireHandshakes() ) );
+    // once it reached its final state the handshake may be emitting right now, finished()
+    // returns soon; before that, it no longer reaches this method
+    QgsAuthSAML2Handshake::State state = handshake->state();
+    if ( wait && ( state == QgsAuthSAML2Handshake::Finished || state == QgsAuthSAML2Handshake::Failed ) )
+      handshake->waitForFinished( ULONG_MAX );
+  }
+
+  // the queued write never runs once this method is gone, e.g. in qgis_saml2_login
+  if ( mPersistPending.fetchAndAddOrdered( 0 ) )
+    persistSessions();
 }
 
 QString QgsAuthSAML2Method::key() const
@@ -88,17 +225,42 @@ bool QgsAuthSAML2Method::updateNetworkRequest( QNetworkRequest &request, const Q
   Q_UNUSED( dataprovider )
 
   QString errorMsg;
-  QEventLoop networkLoop;
-  QByteArray spECPResponse;
-  QByteArray idpECPResponse;
-  QgsNetworkAccessManager* nam = QgsNetworkAccessManager::instance();
+  QgsAuthSAML2Metrics *metrics = QgsAuthSAML2Metrics::instance();
+  const QString key = handshakeKey( authcfg, request.url() );
+  QList<QNetworkCookie> cookies;
 
-  if( mCookieCache.contains( request.url().host() ) )
+  if ( sessionCookies( key, request.url(), &cookies ) )
   {
-    request.setHeader( QNetworkRequest::CookieHeader, mCookieCache[request.url().host()] );
+    metrics->increment( QgsAuthSAML2Metrics::SessionHits );
+    request.setHeader( QNetworkRequest::CookieHeader, QVariant::fromValue( cookies ) );
+    partitionCache( request, key );
     return true;
   }
 
+  // a response this partition stored is still fresh; the provider gets it from the cache without a session
+  if ( current( mCacheFirst )
+       && request.attribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork ).toInt() != QNetworkRequest::AlwaysNetwork
+       && hasFreshResponse( key, request.url() ) )
+  {
+    metrics->increment( QgsAuthSAML2Metrics::CacheFirstHits );
+    request.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferCache );
+    return true;
+  }
+
+  // skip the probe GET for endpoints that recently answered without an ECP challenge
+  const QString endpoint = endpointKey( request.url() );
+  qint64 noChallengeUntil;
+  if ( mNoChallengeCache.lookup( endpoint, &noChallengeUntil ) )
+  {
+    if ( QDateTime::currentMSecsSinceEpoch() < noChallengeUntil )
+    {
+      metrics->increment( QgsAuthSAML2Metrics::ProbesAvoided );
+      partitionCache( request, key );
+      return true;
+    }
+    mNoChallengeCache.remove( endpoint );
+  }
+
   QgsAuthMethodConfig mconfig = getMethodConfig( authcfg );
   if ( !mconfig.isValid() )
   {
@@ -107,193 +269,679 @@ bool QgsAuthSAML2Method::updateNetworkRequest( QNetworkRequest &request, const Q
     return false;
   }
 
-  request.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork );
-  request.setAttribute( QNetworkRequest::CacheSaveControlAttribute, true );
+  // sessions of a previous QGIS run, now that the master password is available
+  restoreSessions();
 
-  //  the ECP URI
-  const char *nsECPURI = "urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp";
+  // the handshake legs are chained on the worker thread; parking it on itself would never finish
+  if ( QgsAuthSAML2Handshake::isWorkerThread() )
+  {
+    errorMsg = QStringLiteral( "Update request FAILED for authcfg: %1: ECP handshake requested from the handshake thread" ).arg( authcfg );
+    QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
+    return false;
+  }
 
-  // signal to the SP that we understand SAML2 ECP
-  request.setRawHeader("PAOS", "ver=\"urn:liberty:paos:2003-08\";\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\"");
-  request.setRawHeader("Accept", "text/xml; application/vnd.paos+xml");
+  prepareEcpRequest( request );
 
-  /* Wait until reply is finished */
-  /* this now contains the ecp response from the SP and not the capabilities*/
-  QNetworkReply* spReply = nam->get( request );
-  connect( spReply, SIGNAL( finished() ), &networkLoop, SLOT( quit() ) );
-  networkLoop.exec();
-  
-  if ( spReply->error() == QNetworkReply::NoError )
+  // single-flight: the first request for a SP starts the handshake, concurrent
+  // requests for the same authcfg and SP park on it and share its outcome
+  QSharedPointer<QgsAuthSAML2Handshake> handshake;
   {
-    spECPResponse = spReply->readAll();
-
-    if ( spECPResponse.isEmpty() )
+    QMutexLocker locker( &mHandshakesMutex );
+    // the session may have been published while we were waiting for the lock
+    if ( sessionCookies( key, request.url(), &cookies ) )
     {
-      QString errorMsg = QStringLiteral( "Update request FAILED: empty ECP response from SP: %1" ).arg( spReply->errorString() );
-      QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
-      return false;
+      metrics->increment( QgsAuthSAML2Metrics::SessionHits );
+      request.setHeader( QNetworkRequest::CookieHeader, QVariant::fromValue( cookies ) );
+      partitionCache( request, key );
+      return true;
     }
+
+    metrics->increment( mHandshakes.contains( key ) ? QgsAuthSAML2Metrics::Coalesced : QgsAuthSAML2Metrics::SessionMisses );
+    // another QGIS process of this user may hold a session for the SP, or be logging in to it right now
+    handshake = startHandshake( key, request, authcfg, mconfig, current( mSessionBroker ) );
   }
-  else
+
+  // the SP or the IdP failed recently; the failure was logged when it happened
+  if ( !handshake )
   {
-    QString errorMsg = QStringLiteral( "Update request FAILED: ECP Response from SP failed: %1" ).arg( spReply->errorString() );
+    QgsDebugMsg( QString( "Update request FAILED for authcfg: %1: backing off from %2" ).arg( authcfg, spEndpoint( request.url() ) ) );
+    return false;
+  }
+
+  // the broker claim and IdP failover are part of the handshake and of this wait
+  QElapsedTimer waited;
+  waited.start();
+  metrics->addToGauge( QgsAuthSAML2Metrics::RequestsWaiting, 1 );
+  bool finished = handshake->waitForFinished( handshake->timeBudget() );
+  metrics->addToGauge( QgsAuthSAML2Metrics::RequestsWaiting, -1 );
+  metrics->recordDuration( QgsAuthSAML2Metrics::WaitPhase, waited.elapsed() );
+
+  if ( !finished )
+  {
+    metrics->increment( QgsAuthSAML2Metrics::HandshakeTimeouts );
+    errorMsg = QStringLiteral( "Update request FAILED for authcfg: %1: ECP handshake timed out" ).arg( authcfg );
     QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
     return false;
   }
 
-  if( spReply->header(QNetworkRequest::ContentTypeHeader).toString() != "application/vnd.paos+xml" )
+  // a failed handshake fails every request that waited on it; it was logged once
+  if ( handshake->state() == QgsAuthSAML2Handshake::Failed )
+    return false;
+
+  // a login for another path of the SP may leave nothing for this one; the SP then
+  // rejects the request and checkReply() logs in for this path
+  if ( handshake->challenged() )
+    request.setHeader( QNetworkRequest::CookieHeader,
+                       QVariant::fromValue( QgsAuthSAML2Cookies::matching( handshake->cookies(), request.url(), QDateTime::currentDateTimeUtc() ) ) );
+
+  // the handshake already downloaded this very resource; the first request for it stores
+  // it in the cache of this thread and lets the provider read it from there
+  QNetworkCacheMetaData metaData;
+  QByteArray body;
+  if ( handshake->request().url() == request.url()
+       && handshake->takeResponse( &metaData, &body )
+       && storeResponse( metaData, body ) )
   {
-    return true;
+    CacheOwner owner;
+    owner.key = key;
+    owner.expires = metaData.expirationDate();
+    mCacheOwners.insert( request.url().toString(), owner );
+    request.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferCache );
+  }
+  else
+  {
+    partitionCache( request, key );
   }
 
-  QgsDebugMsg( QString( "ECP Response from SP: %1" ).arg( spECPResponse.data() ) );
+  return true;
+}
+
+bool QgsAuthSAML2Method::storeResponse( const QNetworkCacheMetaData &metaData, const QByteArray &body )
+{
+  QAbstractNetworkCache *cache = QgsNetworkAccessManager::instance()->cache();
+  if ( !cache )
+    return false;
 
-  // check if the response contains the PAOS response from the SP
-  if (spECPResponse.indexOf(nsECPURI) != -1)
+  QIODevice *device = cache->prepare( metaData );
+  if ( !device )
+    return false;
+
+  if ( device->write( body ) != body.size() )
   {
-    QDomDocument docFromSP, docFromIdP;
-    QString acsURL,rsValue;
-    QString errorMsg;
-    int errorLine, errorColumn;
-    if ( docFromSP.setContent( spECPResponse, true, &errorMsg, &errorLine, &errorColumn ) ) 
+    cache->remove( metaData.url() );
+    return false;
+  }
+  cache->insert( device );
+  return true;
+}
+
+void QgsAuthSAML2Method::recordCachedResponse( QNetworkReply *reply, const QString &authcfg )
+{
+  // Qt stores the response before finished() is emitted; a revalidated entry keeps its owner
+  const QByteArray cacheControl = reply->rawHeader( "Cache-Control" );
+  if ( reply->error() != QNetworkReply::NoError
+       || reply->attribute( QNetworkRequest::SourceIsFromCacheAttribute ).toBool()
+       || !reply->request().attribute( QNetworkRequest::CacheSaveControlAttribute, true ).toBool()
+       || cacheControl.contains( "no-store" ) )
+    return;
+
+  // the freshness the disk cache gives the entry, from the headers rather than a lookup on disk
+  CacheOwner owner;
+  owner.key = handshakeKey( authcfg, reply->url() );
+  if ( !cacheControl.contains( "no-cache" ) )
+  {
+    Q_FOREACH ( const QByteArray &directive, cacheControl.split( ',' ) )
     {
-      QDomNode headerNode = namedItemNS(docFromSP.documentElement().childNodes(), "http://schemas.xmlsoap.org/soap/envelope/", "Header");
-      QDomNode bodyNode = namedItemNS(docFromSP.documentElement().childNodes(), "http://schemas.xmlsoap.org/soap/envelope/", "Body");
-      QDomNode relayState = namedItemNS(headerNode.childNodes(), nsECPURI, "RelayState");
-      rsValue = relayState.toElement().text();
-      QgsDebugMsg( QString( "RelayState: %1" ).arg( rsValue) );
+      if ( directive.trimmed().startsWith( "max-age=" ) )
+        owner.expires = QDateTime::currentDateTimeUtc().addSecs( directive.trimmed().mid( 8 ).toInt() );
+    }
+    if ( !owner.expires.isValid() )
+      owner.expires = QDateTime::fromString( QString::fromLatin1( reply->rawHeader( "Expires" ) ), Qt::RFC2822Date );
+  }
+  mCacheOwners.insert( reply->url().toString(), owner );
+}
+
+void QgsAuthSAML2Method::partitionCache( QNetworkRequest &request, const QString &key )
+{
+  // the disk cache is keyed by URL alone and knows nothing of cookies; a response another
+  // authcfg or an earlier QGIS run stored is fetched again, and the new response takes over
+  // the entry. Whatever this method did not see stored is not trusted, without asking the disk.
+  CacheOwner owner;
+  bool known = mCacheOwners.lookup( request.url().toString(), &owner );
+  if ( known && owner.key == key )
+    return;
 
-      QDomNode authnRequest = namedItemNS(bodyNode.childNodes(), "urn:oasis:names:tc:SAML:2.0:protocol", "AuthnRequest");
-      acsURL = authnRequest.toElement().attribute("AssertionConsumerServiceURL");
-      QgsDebugMsg( QString( "acsURL: %1" ).arg( acsURL) );
+  if ( known )
+    QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::CacheBypassed );
+  request.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::AlwaysNetwork );
+}
 
-      QDomNode paosRequest = namedItemNS(headerNode.childNodes(), "urn:liberty:paos:2003-08", "Request");
-      QDomNode ecpRequest = namedItemNS(headerNode.childNodes(), nsECPURI,"Request");
+bool QgsAuthSAML2Method::hasFreshResponse( const QString &key, const QUrl &url )
+{
+  // PreferCache would also return a stale entry, those go through the session and get revalidated.
+  // An entry the disk cache evicted meanwhile goes to the SP without a session, which redirects to
+  // the IdP, and checkReply() logs in again.
+  CacheOwner owner;
+  return mCacheOwners.lookup( url.toString(), &owner ) && owner.key == key
+         && owner.expires.isValid() && QDateTime::currentDateTimeUtc() < owner.expires;
+}
 
-    }
-    else
-    {
-      errorMsg = QStringLiteral( "Update request config FAILED for authcfg: %1: could not create DOM from ECP response from SP" ).arg( authcfg );
-      QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
+bool QgsAuthSAML2Method::sessionCookies( const QString &key, const QUrl &url, QList<QNetworkCookie> *cookies )
+{
+  Session session;
+  if ( !mSessionCache.lookup( key, &session ) )
+    return false;
+
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  if ( session.expires.isValid() && now >= session.expires )
+  {
+    QgsDebugMsg( QString( "SP session for %1 expired" ).arg( key ) );
+    QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::SessionsExpired );
+    mSessionCache.remove( key );
+    return false;
+  }
+
+  *cookies = QgsAuthSAML2Cookies::matching( session.cookies, url, now );
+  return !cookies->isEmpty();
+}
+
+QSharedPointer<QgsAuthSAML2Handshake> QgsAuthSAML2Method::startHandshake( const QString &key, const QNetworkRequest &request,
+  const QString &authcfg, const QgsAuthMethodConfig &mconfig, bool brokered )
+{
+  QSharedPointer<QgsAuthSAML2Handshake> handshake = mHandshakes.value( key );
+  if ( handshake )
+    return handshake;
+
+  if ( !admitHandshake( QStringList() << spEndpoint( request.url() ) << mconfig.config( "providerurl" ) ) )
+  {
+    QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::BreakerRejections );
+    return handshake;
+  }
+
+  // the handshake is released on the worker thread, where its replies live
+  handshake = QSharedPointer<QgsAuthSAML2Handshake>( new QgsAuthSAML2Handshake( request, authcfg, mconfig ), &QObject::deleteLater );
+  // publish right when it completes on the worker thread, independent of who waits for it
+  connect( handshake.data(), SIGNAL( finished() ), this, SLOT( retireHandshakes() ), Qt::DirectConnection );
+  mHandshakes.insert( key, handshake );
+  // connect to the IdP while the SP is answering the challenge
+  QgsAuthSAML2Handshake::prewarm( mconfig.config( "providerurl" ), true );
+  // taken with the entry above, so only this handshake talks to the broker for key
+  if ( brokered )
+    QgsAuthSAML2Handshake::beginBrokered( handshake, key, 3 * current( mLegTimeout ) );
+  else
+    handshake->begin();
+  return handshake;
+}
+
+bool QgsAuthSAML2Method::admitHandshake( const QStringList &endpoints )
+{
+  qint64 now = QDateTime::currentMSecsSinceEpoch();
+  Q_FOREACH ( const QString &endpoint, endpoints )
+  {
+    QHash<QString, Breaker>::const_iterator it = mBreakers.constFind( endpoint );
+    if ( it != mBreakers.constEnd() && ( now < it->openUntil || it->probing ) )
       return false;
-    }
-    // modify the RAW data to preserve the Digital Signature
-    // we CANNOT do this via DOM processing...
-    QByteArray dataToIdP = spECPResponse;
-    int ix1 = dataToIdP.indexOf("Header>") + 7;
-    int ix2 = dataToIdP.indexOf("Header>", ix1) + 7;
-    dataToIdP.remove(ix1, ix2-ix1);
-    dataToIdP.insert(ix1-1,'/');
-
-    QNetworkRequest requestToIdP( QUrl( mconfig.config( "providerurl" ) ) );
-    // in case the user has saved username/password in the configuration, it must
-    // be applied to the IdP not the SP
-    QString username = mconfig.config( "username" );
-    QString password = mconfig.config( "password" );
-
-    if ( !username.isEmpty() )
+  }
+
+  // the backoff is over: this handshake is the single probe of whatever failed before
+  Q_FOREACH ( const QString &endpoint, endpoints )
+  {
+    QHash<QString, Breaker>::iterator it = mBreakers.find( endpoint );
+    if ( it != mBreakers.end() )
+      it->probing = true;
+  }
+  return true;
+}
+
+void QgsAuthSAML2Method::recordOutcome( const QString &endpoint, Outcome outcome )
+{
+  QHash<QString, Breaker>::iterator it = mBreakers.find( endpoint );
+  if ( outcome == Succeeded )
+  {
+    if ( it != mBreakers.end() )
     {
-      requestToIdP.setRawHeader( "Authorization", "Basic " + QString( "%1:%2" ).arg( username, password ).toAscii().toBase64() );
+      QgsMessageLog::logMessage( QStringLiteral( "SAML2 endpoint %1 recovered" ).arg( endpoint ), AUTH_METHOD_KEY, QgsMessageLog::INFO );
+      mBreakers.erase( it );
     }
+    return;
+  }
 
-    requestToIdP.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork );
-    requestToIdP.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false );
-
-    // signal SAML2 ECP to the IdP
-    requestToIdP.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml");
-    // relay the modified ECP message to IdP
-    QgsDebugMsg( QString( "ECP message to IdP: %1" ).arg( QString(dataToIdP)) );
-    /* Wait until reply is finished */    
-    QNetworkReply* idpReply = nam->post( requestToIdP , dataToIdP);
-    connect( idpReply, SIGNAL( finished() ), &networkLoop, SLOT( quit() ) );
-    networkLoop.exec();
-    // we have a response from the IdP
-    if ( idpReply->error() == QNetworkReply::NoError )
+  if ( outcome == Untested )
+  {
+    if ( it != mBreakers.end() )
+      it->probing = false;
+    return;
+  }
+
+  if ( it == mBreakers.end() )
+    it = mBreakers.insert( endpoint, Breaker() );
+
+  ++it->failures;
+  it->probing = false;
+  qint64 backoff = qMin( qint64( current( mBackoffInitial ) ) << qMin( it->failures - 1, 16 ), qint64( current( mBackoffMax ) ) );
+  it->openUntil = QDateTime::currentMSecsSinceEpoch() + 1000 * backoff;
+
+  QgsMessageLog::logMessage( QStringLiteral( "SAML2 endpoint %1 failed %2 time(s) in a row, requests fail fast for %3 s" )
+                             .arg( endpoint ).arg( it->failures ).arg( backoff ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+}
+
+void QgsAuthSAML2Method::retireHandshakes()
+{
+  bool sessionsChanged = false;
+  bool sessionsPublished = false;
+  QList<QgsAuthSAML2SessionStore::Record> brokered;
+  QStringList released;
+  {
+    QMutexLocker locker( &mHandshakesMutex );
+    QHash<QString, QSharedPointer<QgsAuthSAML2Handshake> >::iterator it = mHandshakes.begin();
+    while ( it != mHandshakes.end() )
     {
-      idpECPResponse = idpReply->readAll();
+      QSharedPointer<QgsAuthSAML2Handshake> handshake = it.value();
+      QgsAuthSAML2Handshake::State state = handshake->state();
+      if ( state != QgsAuthSAML2Handshake::Finished && state != QgsAuthSAML2Handshake::Failed )
+      {
+        ++it;
+        continue;
+      }
 
-      if ( idpECPResponse.isEmpty() )
+      const QUrl url = handshake->request().url();
+      const QString key = it.key();
+      const QString sp = spEndpoint( url );
+      const QString idp = handshake->idpUrl();
+      Session session;
+      if ( state == QgsAuthSAML2Handshake::Failed )
       {
-        QString errorMsg = QStringLiteral( "Update request FAILED: empty ECP response from IdP: %1" ).arg( idpReply->errorString() );
-        QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
-        return false;
+        // blame the leg that failed, the legs before it proved their endpoint works
+        switch ( handshake->failedIn() )
+        {
+          case QgsAuthSAML2Handshake::IdpAssertion:
+            recordOutcome( sp, Succeeded );
+            recordOutcome( idp, Failed );
+            break;
+          case QgsAuthSAML2Handshake::AssertionConsumer:
+            recordOutcome( sp, Failed );
+            recordOutcome( idp, Succeeded );
+            break;
+          default:
+            recordOutcome( sp, Failed );
+            recordOutcome( idp, Untested );
+            break;
+        }
+
+        // keep a session that failed to renew until it expires, but do not retry it
+        if ( mSessionCache.lookup( key, &session ) )
+        {
+          session.renew = false;
+          mSessionCache.insert( key, session );
+        }
       }
-    }
-    else
-    {
-      QString errorMsg = QStringLiteral( "Update request FAILED: ECP Response from IdP failed: %1" ).arg( idpReply->errorString() );
-      QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
-      return false;
-    }
+      else if ( handshake->brokered() )
+      {
+        // the process that logged in renews the session and publishes the new one
+        mSessionCache.lookup( key, &session );
+        session.obtained = handshake->brokeredObtained();
+        QgsAuthSAML2Cookies::merge( session.cookies, handshake->cookies(), QDateTime::currentDateTimeUtc() );
+        session.expires = handshake->sessionExpiry();
+        session.request = handshake->request();
+        session.authcfg = handshake->authcfg();
+        session.renew = false;
+        mSessionCache.insert( key, session );
+      }
+      else if ( handshake->challenged() )
+      {
+        recordOutcome( sp, Succeeded );
+        recordOutcome( idp, Succeeded );
+        // cookies for other paths of the SP stay, those the SP set again are replaced
+        mSessionCache.lookup( key, &session );
+        session.obtained = QDateTime::currentDateTimeUtc();
+        QgsAuthSAML2Cookies::merge( session.cookies, handshake->cookies(), session.obtained );
+        session.expires = handshake->sessionExpiry();
+        session.request = handshake->request();
+        session.authcfg = handshake->authcfg();
+        session.renew = true;
+        mSessionCache.insert( key, session );
+        sessionsChanged = sessionsChanged || session.expires.isValid();
+        sessionsPublished = true;
 
-    QgsDebugMsg( QString( "ECP Response from IdP: %1" ).arg( idpECPResponse.constData() ) );
-    if ( docFromIdP.setContent( idpECPResponse, true, &errorMsg, &errorLine, &errorColumn ) ) 
-    {
-      QDomNode headerNode = namedItemNS(docFromIdP.documentElement().childNodes(), "http://schemas.xmlsoap.org/soap/envelope/", "Header");
-      QString relayState = QString ("<ecp:RelayState xmlns:ecp=\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\" " + headerNode.prefix() + ":actor=\"http://schemas.xmlsoap.org/soap/actor/next\" " + headerNode.prefix() + ":mustUnderstand=\"1\">" + rsValue + "</ecp:RelayState>");
-      idpECPResponse.replace(QString("<%1:Header>").arg(headerNode.prefix()).toAscii().data(),QString("<%1:Header>%2").arg(headerNode.prefix(),relayState).toAscii().data());
-    }
-    else
-    {
-      errorMsg = QStringLiteral( "Update request config FAILED for authcfg: %1: could not create DOM from ECP response from SP" ).arg( authcfg );
-      QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
-      return false;
+        // publishing also ends the claim of this process
+        if ( current( mSessionBroker ) )
+        {
+          QgsAuthSAML2SessionStore::Record record;
+          record.key = key;
+          record.authcfg = session.authcfg;
+          record.url = url;
+          record.cookies = session.cookies;
+          record.obtained = session.obtained;
+          record.expires = session.expires;
+          brokered << record;
+        }
+      }
+      else
+      {
+        recordOutcome( sp, Succeeded );
+        recordOutcome( idp, Untested );
+        int ttl = current( mNoChallengeTtl );
+        if ( ttl > 0 )
+          mNoChallengeCache.insert( endpointKey( url ), QDateTime::currentMSecsSinceEpoch() + 1000 * qint64( ttl ) );
+      }
+
+      // the processes waiting at the broker log in on their own
+      if ( handshake->brokerClaimed() && ( state == QgsAuthSAML2Handshake::Failed || !handshake->challenged() ) )
+        released << key;
+      it = mHandshakes.erase( it );
     }
+  }
+
+  // publishing also ends the claim; the broker runs on a thread of its own, never this one
+  Q_FOREACH ( const QgsAuthSAML2SessionStore::Record &record, brokered )
+    QgsAuthSAML2Broker::publish( record );
+  Q_FOREACH ( const QString &key, released )
+    QgsAuthSAML2Broker::release( key );
+
+  // the auth database and QCA are not safe to use from the worker
+  if ( sessionsPublished && mPersistPending.testAndSetOrdered( 0, 1 ) )
+    QMetaObject::invokeMethod( this, "persistSessions", Qt::QueuedConnection );
+
+  // the renewal timer belongs to the thread of this method
+  if ( sessionsChanged )
+    QMetaObject::invokeMethod( this, "scheduleRenewal", Qt::QueuedConnection );
+}
+
+void QgsAuthSAML2Method::restoreSessions()
+{
+  // requests arriving meanwhile wait for the sessions instead of logging in again
+  QMutexLocker locker( &mRestoreMutex );
+  if ( mSessionsRestored )
+    return;
+  mSessionsRestored = true;
+
+  if ( !QgsAuthSAML2SessionStore::isEnabled() )
+    return;
+
+  QString errorMsg;
+  QList<QgsAuthSAML2SessionStore::Record> records = QgsAuthSAML2SessionStore::load( &errorMsg );
+  if ( !errorMsg.isEmpty() )
+  {
+    QgsMessageLog::logMessage( QStringLiteral( "Restoring SAML2 sessions FAILED: %1" ).arg( errorMsg ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+    return;
+  }
+
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  bool renewable = false;
+  Q_FOREACH ( const QgsAuthSAML2SessionStore::Record &record, records )
+  {
+    if ( !record.expires.isValid() && record.obtained.addSecs( assumedSessionLifetime() ) <= now )
+      continue;
+
+    // a login of this run is newer than anything on disk; older stores keyed by host only
+    const QString key = handshakeKey( record.authcfg, record.url );
+    if ( mSessionCache.contains( key ) )
+      continue;
+
+    Session session;
+    QgsAuthSAML2Cookies::merge( session.cookies, QgsAuthSAML2Cookies::normalized( record.cookies, record.url ), now );
+    if ( session.cookies.isEmpty() )
+      continue;
+    session.obtained = record.obtained;
+    session.expires = record.expires;
+    session.request = QNetworkRequest( record.url );
+    prepareEcpRequest( session.request );
+    session.authcfg = record.authcfg;
+    mSessionCache.insert( key, session );
+    renewable = renewable || session.expires.isValid();
+  }
+
+  if ( renewable )
+    QMetaObject::invokeMethod( this, "scheduleRenewal", Qt::QueuedConnection );
+}
+
+void QgsAuthSAML2Method::persistSessions()
+{
+  // one write for all the sessions published since the call was queued
+  mPersistPending.fetchAndStoreOrdered( 0 );
+  if ( !QgsAuthSAML2SessionStore::isEnabled() )
+    return;
+
+  QList<QgsAuthSAML2SessionStore::Record> records;
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  QHash<QString, Session> sessions = mSessionCache.snapshot();
+  for ( QHash<QString, Session>::const_iterator it = sessions.constBegin(); it != sessions.constEnd(); ++it )
+  {
+    const Session &session = it.value();
+    if ( session.expires.isValid() && session.expires <= now )
+      continue;
+
+    QgsAuthSAML2SessionStore::Record record;
+    record.key = it.key();
+    record.authcfg = session.authcfg;
+    record.url = session.request.url();
+    record.cookies = session.cookies;
+    record.obtained = session.obtained;
+    record.expires = session.expires;
+    records << record;
+  }
+
+  QString errorMsg;
+  if ( !QgsAuthSAML2SessionStore::save( records, &errorMsg ) )
+    QgsMessageLog::logMessage( QStringLiteral( "Storing SAML2 sessions FAILED: %1" ).arg( errorMsg ), AUTH_METHOD_KEY, QgsMessageLog::WARNING );
+}
+
+void QgsAuthSAML2Method::scheduleRenewal()
+{
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  const int renewBefore = current( mRenewBefore );
+  qint64 next = -1;
+
+  QMutexLocker locker( &mHandshakesMutex );
+  QHash<QString, Session> sessions = mSessionCache.snapshot();
+  for ( QHash<QString, Session>::const_iterator it = sessions.constBegin(); it != sessions.constEnd(); ++it )
+  {
+    const Session &session = it.value();
+    if ( !session.renew || !session.expires.isValid()
+         || mHandshakes.contains( handshakeKey( session.authcfg, session.request.url() ) ) )
+      continue;
+
+    // renew ahead of expiry, but never more often than every half session lifetime
+    qint64 lead = qMin( 1000 * qint64( renewBefore ), session.obtained.msecsTo( session.expires ) / 2 );
+    qint64 due = qMax( qint64( 0 ), now.msecsTo( session.expires ) - lead );
+    if ( next < 0 || due < next )
+      next = due;
+  }
 
-    QgsDebugMsg( QString( "ECP message to SP: %1" ).arg( QString(idpECPResponse) ) );
+  if ( next < 0 )
+    mRenewalTimer.stop();
+  else
+    mRenewalTimer.start( int( qMin( next, qint64( INT_MAX ) ) ) );
+}
 
-    // send modified IdP response to the SP - this contains the captured RelayState
-    QNetworkRequest requestToSP ( acsURL);
-    requestToSP.setAttribute( QNetworkRequest::CacheLoadControlAttribute, QNetworkRequest::PreferNetwork );
-    requestToSP.setAttribute( QNetworkRequest::CacheSaveControlAttribute, false );
+void QgsAuthSAML2Method::renewSessions()
+{
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  const int renewBefore = current( mRenewBefore );
+
+  // the session cache needs no lock, and loading a config may ask for the master password
+  QHash<QString, Session> due;
+  QHash<QString, QgsAuthMethodConfig> configs;
+  QHash<QString, Session> sessions = mSessionCache.snapshot();
+  for ( QHash<QString, Session>::const_iterator it = sessions.constBegin(); it != sessions.constEnd(); ++it )
+  {
+    const Session &session = it.value();
+    if ( !session.renew || !session.expires.isValid() )
+      continue;
 
-    QgsDebugMsg( QString( "requesting capabilities via ECP with URL: %1" ).arg( acsURL ) );
-    requestToSP.setHeader(QNetworkRequest::ContentTypeHeader, "text/xml; application/vnd.paos+xml");
+    qint64 lead = qMin( 1000 * qint64( renewBefore ), session.obtained.msecsTo( session.expires ) / 2 );
+    if ( now.msecsTo( session.expires ) > lead )
+      continue;
 
-    /* Send request for cookies */  
-    QNetworkReply* capabilitiesReply = nam->post( requestToSP, idpECPResponse );
-    connect( capabilitiesReply, SIGNAL( finished() ), &networkLoop, SLOT( quit() ) );
-    networkLoop.exec();
-    if ( capabilitiesReply->error() == QNetworkReply::NoError )
+    if ( !configs.contains( session.authcfg ) )
+      configs.insert( session.authcfg, getMethodConfig( session.authcfg ) );
+    if ( configs.value( session.authcfg ).isValid() )
+      due.insert( it.key(), session );
+  }
+
+  {
+    QMutexLocker locker( &mHandshakesMutex );
+    for ( QHash<QString, Session>::const_iterator it = due.constBegin(); it != due.constEnd(); ++it )
     {
-      QVariant cookie = capabilitiesReply->header( QNetworkRequest::SetCookieHeader );
-      if ( !cookie.isValid() )
+      const Session &session = it.value();
+      QgsDebugMsg( QString( "Renewing SP session for %1" ).arg( it.key() ) );
+      QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::Renewals );
+      // nobody waits for it; retireHandshakes() replaces the session once it is done
+      if ( !startHandshake( handshakeKey( session.authcfg, session.request.url() ), session.request, session.authcfg, configs.value( session.authcfg ) ) )
       {
-        QString errorMsg = QStringLiteral( "Update request FAILED: no cookies from SP: %1" ).arg( capabilitiesReply->errorString() );
-        QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
-        return false;
+        // the endpoints are backing off, keep the session until it expires like a failed renewal
+        Session kept = session;
+        kept.renew = false;
+        mSessionCache.insert( it.key(), kept );
       }
-      request.setHeader( QNetworkRequest::CookieHeader, cookie );
-      mCookieCache.insert( request.url().host(), cookie );
-      return true;
-    }
-    else
-    {
-      QString errorMsg = QStringLiteral( "Update request FAILED: ECP Response from SP failed: %1" ).arg( capabilitiesReply->errorString() );
-      QgsMessageLog::logMessage( errorMsg, AUTH_METHOD_KEY, QgsMessageLog::CRITICAL );
-      return false;
     }
   }
-  return true;
+
+  scheduleRenewal();
 }
 
 bool QgsAuthSAML2Method::updateDataSourceUriItems( QStringList &connectionItems, const QString &authcfg,
   const QString &dataprovider )
 {
   Q_UNUSED( dataprovider )
-  Q_UNUSED( connectionItems )
-  Q_UNUSED( authcfg )
+
+  // nothing to add to the URI; log in to the service while the layer is still being set up
+  QList<QUrl> endpoints;
+  Q_FOREACH ( const QString &item, connectionItems )
+  {
+    if ( !item.startsWith( "url=" ) )
+      continue;
+
+    QString value = item.mid( 4 );
+    QUrl url( value );
+    if ( url.host().isEmpty() )
+      url = QUrl( QUrl::fromPercentEncoding( value.toUtf8() ) );
+    endpoints << url;
+  }
+
+  if ( !endpoints.isEmpty() )
+    preauthenticate( authcfg, endpoints );
   return true;
 }
 
+int QgsAuthSAML2Method::preauthenticate( const QString &authcfg, const QList<QUrl> &endpoints )
+{
+  QgsAuthMethodConfig mconfig = getMethodConfig( authcfg );
+  if ( !mconfig.isValid() || QgsAuthSAML2Handshake::isWorkerThread() )
+    return 0;
+
+  restoreSessions();
+
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  QSet<QString> seen;
+  int started = 0;
+
+  QMutexLocker locker( &mHandshakesMutex );
+  Q_FOREACH ( const QUrl &url, endpoints )
+  {
+    if ( !url.isValid() || url.host().isEmpty() )
+      continue;
+
+    const QString key = handshakeKey( authcfg, url );
+    if ( seen.contains( key ) )
+      continue;
+    seen.insert( key );
+
+    QList<QNetworkCookie> cookies;
+    if ( sessionCookies( key, url, &cookies ) )
+      continue;
+
+    qint64 noChallengeUntil;
+    if ( mNoChallengeCache.lookup( endpointKey( url ), &noChallengeUntil ) && now.toMSecsSinceEpoch() < noChallengeUntil )
+      continue;
+
+    // the handshakes run side by side on the worker; the first to reach the IdP
+    // logs in and the others reuse its SSO session
+    QNetworkRequest request( url );
+    prepareEcpRequest( request );
+    if ( startHandshake( key, request, authcfg, mconfig ) )
+      ++started;
+  }
+
+  QgsDebugMsg( QString( "Pre-authenticating %1 SAML2 endpoint(s) for authcfg: %2" ).arg( started ).arg( authcfg ) );
+  return started;
+}
+
 bool QgsAuthSAML2Method::updateNetworkReply( QNetworkReply *reply, const QString &authcfg, const QString &dataprovider )
 {
   Q_UNUSED( dataprovider )
-  Q_UNUSED( reply )
-  Q_UNUSED( authcfg )
+
+  if ( !reply )
+    return true;
+
+  // the reply was just created, its headers are checked once they arrive
+  new QgsAuthSAML2ReplyWatcher( reply, authcfg, this );
   return true;
 }
 
+void QgsAuthSAML2Method::checkReply( QNetworkReply *reply, const QString &authcfg )
+{
+  // decide from the headers alone, the body belongs to the provider
+  int status = reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt();
+  bool rejected = reply->header( QNetworkRequest::ContentTypeHeader ).toString().startsWith( "application/vnd.paos+xml" );
+
+  QgsAuthMethodConfig mconfig = getMethodConfig( authcfg );
+  if ( !rejected && status >= 300 && status < 400 )
+  {
+    // the SP sends the browser profile to the IdP when the session is gone
+    QUrl location = reply->attribute( QNetworkRequest::RedirectionTargetAttribute ).toUrl();
+    rejected = location.toString().contains( "SAMLRequest=" )
+               || ( mconfig.isValid() && location.host() == QUrl( mconfig.config( "providerurl" ) ).host() );
+  }
+
+  const QUrl url = reply->url();
+  if ( !rejected && status == 401 )
+  {
+    // a plain 401 may just as well come from an auth scheme other than SAML; it only
+    // rejects a session the request carried, and not for an endpoint that recently
+    // answered the probe without a challenge, or every 401 would probe again
+    qint64 noChallengeUntil;
+    rejected = !qvariant_cast<QList<QNetworkCookie> >( reply->request().header( QNetworkRequest::CookieHeader ) ).isEmpty()
+               && !( mNoChallengeCache.lookup( endpointKey( url ), &noChallengeUntil )
+                     && QDateTime::currentMSecsSinceEpoch() < noChallengeUntil );
+  }
+
+  if ( !rejected )
+    return;
+
+  QgsDebugMsg( QString( "SP at %1 rejected the SAML2 session (HTTP %2)" ).arg( url.host() ).arg( status ) );
+  QgsAuthSAML2Metrics::instance()->increment( QgsAuthSAML2Metrics::SessionsRejected );
+
+  // the endpoint challenges after all
+  mNoChallengeCache.remove( endpointKey( url ) );
+
+  if ( !mconfig.isValid() || QgsAuthSAML2Handshake::isWorkerThread() )
+    return;
+
+  QMutexLocker locker( &mHandshakesMutex );
+
+  // only drop the cookies the rejected request carried, a renewal may have replaced them already;
+  // cookies for other paths of the SP are not affected
+  const QString key = handshakeKey( authcfg, url );
+  Session session;
+  if ( mSessionCache.lookup( key, &session ) )
+  {
+    QList<QNetworkCookie> sent = qvariant_cast<QList<QNetworkCookie> >( reply->request().header( QNetworkRequest::CookieHeader ) );
+    if ( !QgsAuthSAML2Cookies::containsAll( session.cookies, sent ) )
+      return;
+    QgsAuthSAML2Cookies::remove( session.cookies, sent );
+    if ( session.cookies.isEmpty() )
+      mSessionCache.remove( key );
+    else
+      mSessionCache.insert( key, session );
+  }
+
+  // log in again in the background, the next request joins this handshake
+  QNetworkRequest request( url );
+  prepareEcpRequest( request );
+  startHandshake( key, request, authcfg, mconfig );
+}
+
 void QgsAuthSAML2Method::updateMethodConfig( QgsAuthMethodConfig &mconfig )
 {
   if ( mconfig.hasConfig( "oldconfigstyle" ) )
@@ -312,9 +960,59 @@ void QgsAuthSAML2Method::updateMethodConfig( QgsAuthMethodConfig &mconfig )
   // TODO: add updates as method version() increases due to config storage changes
 }
 
+int QgsAuthSAML2Method::probesAvoided() const
+{
+  return QgsAuthSAML2Metrics::instance()->counter( QgsAuthSAML2Metrics::ProbesAvoided );
+}
+
+QString QgsAuthSAML2Method::metrics() const
+{
+  return QgsAuthSAML2Metrics::instance()->toText();
+}
+
+QString QgsAuthSAML2Method::trace() const
+{
+  return QgsAuthSAML2Trace::toText();
+}
+
+void QgsAuthSAML2Method::dumpMetrics()
+{
+  const QString fileName = QgsApplication::qgisSettingsDirPath() + "saml2metrics.prom";
+  if ( !QgsAuthSAML2Metrics::instance()->writeTo( fileName ) )
+    QgsDebugMsg( QString( "Could not write SAML2 metrics to %1" ).arg( fileName ) );
+}
+
 void QgsAuthSAML2Method::clearCachedConfig( const QString &authcfg )
 {
   removeMethodConfig( authcfg );
+  reloadSettings();
+
+  // the config may now log in as someone else, what the old one cached is not for them
+  QAbstractNetworkCache *cache = QgsNetworkAccessManager::instance()->cache();
+  QHash<QString, CacheOwner> owners = mCacheOwners.snapshot();
+  for ( QHash<QString, CacheOwner>::const_iterator it = owners.constBegin(); it != owners.constEnd(); ++it )
+  {
+    if ( !it.value().key.startsWith( authcfg + '|' ) )
+      continue;
+    mCacheOwners.remove( it.key() );
+    if ( cache )
+      cache->remove( QUrl( it.key() ) );
+  }
+
+  // the user may just have fixed what made the endpoints fail
+  QMutexLocker locker( &mHandshakesMutex );
+  mBreakers.clear();
+}
+
+void QgsAuthSAML2Method::reloadSettings()
+{
+  mCacheFirst.fetchAndStoreRelaxed( cacheFirst() );
+  mSessionBroker.fetchAndStoreRelaxed( QgsAuthSAML2Broker::isEnabled() );
+  mNoChallengeTtl.fetchAndStoreRelaxed( noChallengeTtl() );
+  mLegTimeout.fetchAndStoreRelaxed( handshakeLegTimeout() );
+  mBackoffInitial.fetchAndStoreRelaxed( backoffInitial() );
+  mBackoffMax.fetchAndStoreRelaxed( backoffMax() );
+  mRenewBefore.fetchAndStoreRelaxed( renewBefore() );
 }
 
 QgsAuthMethodConfig QgsAuthSAML2Method::getMethodConfig( const QString &authcfg, bool fullconfig )
@@ -322,9 +1020,8 @@ QgsAuthMethodConfig QgsAuthSAML2Method::getMethodConfig( const QString &authcfg,
   QgsAuthMethodConfig mconfig;
 
   // check if it is cached
-  if ( mAuthConfigCache.contains( authcfg ) )
+  if ( mAuthConfigCache.lookup( authcfg, &mconfig ) )
   {
-    mconfig = mAuthConfigCache.value( authcfg );
     QgsDebugMsg( QString( "Retrieved config for authcfg: %1" ).arg( authcfg ) );
     return mconfig;
   }
@@ -339,6 +1036,10 @@ QgsAuthMethodConfig QgsAuthSAML2Method::getMethodConfig( const QString &authcfg,
   // cache bundle
   putMethodConfig( authcfg, mconfig );
 
+  // have the IdP connection ready by the time the first login needs it
+  if ( mconfig.hasConfig( "providerurl" ) )
+    QgsAuthSAML2Handshake::prewarm( mconfig.config( "providerurl" ), true );
+
   return mconfig;
 }
 
@@ -350,60 +1051,32 @@ void QgsAuthSAML2Method::putMethodConfig( const QString &authcfg, const QgsAuthM
 
 void QgsAuthSAML2Method::removeMethodConfig( const QString &authcfg )
 {
-  if ( mAuthConfigCache.contains( authcfg ) )
+  if ( mAuthConfigCache.remove( authcfg ) )
   {
-    mAuthConfigCache.remove( authcfg );
     QgsDebugMsg( QString( "Removed basic config for authcfg: %1" ).arg( authcfg ) );
   }
 }
 
-//////////////////////////////////////////////
-// Plugin externals
-//////////////////////////////////////////////
-
-/**
-* Required class factory to return a pointer to a newly created object
-*/
-QGISEXTERN QgsAuthSAML2Method *classFactory()
-{
-  return new QgsAuthSAML2Method();
-}
-
-/** Required key function (used to map the plugin to a data store type)
-*/
-QGISEXTERN QString authMethodKey()
+QgsAuthSAML2ReplyWatcher::QgsAuthSAML2ReplyWatcher( QNetworkReply *reply, const QString &authcfg, QgsAuthSAML2Method *method )
+  : QObject( reply )
+  , mReply( reply )
+  , mAuthcfg( authcfg )
+  , mMethod( method )
 {
-  return AUTH_METHOD_KEY;
+  connect( reply, SIGNAL( metaDataChanged() ), this, SLOT( onMetaDataChanged() ) );
+  connect( reply, SIGNAL( finished() ), this, SLOT( onFinished() ) );
 }
 
-/**
-* Required description function
-*/
-QGISEXTERN QString description()
+void QgsAuthSAML2ReplyWatcher::onMetaDataChanged()
 {
-  return AUTH_METHOD_DESCRIPTION;
+  // the status line and headers are only relevant once
+  disconnect( mReply, SIGNAL( metaDataChanged() ), this, SLOT( onMetaDataChanged() ) );
+  if ( mMethod )
+    mMethod->checkReply( mReply, mAuthcfg );
 }
 
-/**
-* Required isAuthMethod function. Used to determine if this shared library
-* is an authentication method plugin
-*/
-QGISEXTERN bool isAuthMethod()
+void QgsAuthSAML2ReplyWatcher::onFinished()
 {
-  return true;
+  if ( mMethod )
+    mMethod->recordCachedResponse( mReply, mAuthcfg );
 }
-
-/**
-* Optional class factory to return a pointer to a newly created edit widget
-*/
-QGISEXTERN QgsAuthSAML2Edit *editWidget( QWidget *parent )
-{
-  return new QgsAuthSAML2Edit( parent );
-}
-
-/**
-* Required cleanup function
-*/
-QGISEXTERN void cleanupAuthMethod() // pass QgsAuthMethod *method, then delete method  ?
-{
-}
\ No newline at end of file
@@ -18,11 +18,51 @@
 
 #include "qgsauthconfig.h"
 #include "qgsauthmethod.h"
+#include "qgsauthsaml2cache.h"
+
+#include <QAtomicInt>
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QNetworkCookie>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QTimer>
+
+class QgsAuthSAML2Handshake;
+class QgsAuthSAML2Method;
+class QNetworkCacheMetaData;
+class QNetworkReply;
+
+/**
+ * Checks the headers of a reply to a SAML protected request as soon as they
+ * arrive. Owned by the reply and living in its thread.
+ */
+class QgsAuthSAML2ReplyWatcher : public QObject
+{
+  Q_OBJECT
+
+public:
+  QgsAuthSAML2ReplyWatcher( QNetworkReply *reply, const QString &authcfg, QgsAuthSAML2Method *method );
+
+private slots:
+  void onMetaDataChanged();
+
+  void onFinished();
+
+private:
+  QNetworkReply *mReply;
+  QString mAuthcfg;
+  QPointer<QgsAuthSAML2Method> mMethod;
+};
 
 class QgsAuthSAML2Method : public QgsAuthMethod
 {
   Q_OBJECT
 
+  friend class QgsAuthSAML2ReplyWatcher;
+
 public:
   explicit QgsAuthSAML2Method();
   ~QgsAuthSAML2Method();
@@ -46,9 +86,149 @@ public:
 
   void updateMethodConfig( QgsAuthMethodConfig &mconfig ) override;
 
+  //! Number of SP probe GETs skipped because the endpoint is known not to challenge
+  int probesAvoided() const;
+
+  /**
+   * Starts the SP logins for all endpoints at once and returns without waiting.
+   * The logins share one IdP session, requests for the endpoints join them.
+   * Endpoints with a valid session or without challenge are skipped.
+   * Returns the number of logins started or joined.
+   */
+  int preauthenticate( const QString &authcfg, const QList<QUrl> &endpoints );
+
+  //! Authentication metrics of this QGIS process in the Prometheus text format
+  QString metrics() const;
+
+  //! Recent handshake trace, empty unless /auth/saml2/traceLevel is set
+  QString trace() const;
+
+private slots:
+  //! Publishes the outcome of completed handshakes and retires them
+  void retireHandshakes();
+
+  //! Arms the renewal timer for the session that expires first
+  void scheduleRenewal();
+
+  //! Starts background logins for sessions about to expire
+  void renewSessions();
+
+  //! Writes the metrics to saml2metrics.prom in the settings directory
+  void dumpMetrics();
+
+  //! Writes the valid sessions to the persistent session store
+  void persistSessions();
 
 private:
-  QMap<QString, QVariant> mCookieCache;
+  struct Session
+  {
+    Session() : renew( true ) {}
+
+    QList<QNetworkCookie> cookies;  //!< with domain and path, see QgsAuthSAML2Cookies
+    QDateTime obtained;
+    QDateTime expires;        //!< invalid if neither the cookie nor the assertion limit the session
+    QNetworkRequest request;  //!< replayed to renew the session
+    QString authcfg;
+    bool renew;
+  };
+
+  //! SP sessions by authcfg and SP deployment, looked up by every network thread
+  QgsAuthSAML2ShardedCache<Session> mSessionCache;
+
+  //! The cookies of the session under key that go with a request to url; false if there are none
+  bool sessionCookies( const QString &key, const QUrl &url, QList<QNetworkCookie> *cookies );
+
+  //! Whether the persistent session store was read, guarded by mRestoreMutex
+  bool mSessionsRestored;
+
+  //! Held while the persistent session store is read
+  QMutex mRestoreMutex;
+
+  //! Loads the persistent session store once, needs the master password
+  void restoreSessions();
+
+  //! Non-zero while a persistSessions() call is queued
+  QAtomicInt mPersistPending;
+
+  QTimer mRenewalTimer;
+
+  //! Expiry (msecs since epoch) of endpoints that answered the probe without an ECP challenge
+  QgsAuthSAML2ShardedCache<qint64> mNoChallengeCache;
+
+  QTimer mMetricsTimer;
+
+  //! ECP handshakes in flight, keyed by authcfg and SP, shared by all requests waiting on them
+  QHash<QString, QSharedPointer<QgsAuthSAML2Handshake> > mHandshakes;
+  QMutex mHandshakesMutex;
+
+  //! Invalidates the SP session if the reply shows the SP no longer accepts it, and logs in again
+  void checkReply( QNetworkReply *reply, const QString &authcfg );
+
+  //! A disk cache entry this method saw stored
+  struct CacheOwner
+  {
+    QString key;        //!< partition (authcfg and SP deployment) that stored it
+    QDateTime expires;  //!< end of its freshness, invalid if the server gave none
+  };
+
+  //! Disk cache entries by URL
+  QgsAuthSAML2ShardedCache<CacheOwner> mCacheOwners;
+
+  //! Writes a response the handshake fetched to the network cache of the calling thread
+  bool storeResponse( const QNetworkCacheMetaData &metaData, const QByteArray &body );
+
+  //! Records that the response in reply was stored in the disk cache for authcfg
+  void recordCachedResponse( QNetworkReply *reply, const QString &authcfg );
+
+  //! Keeps request from reading a cached response another partition stored
+  void partitionCache( QNetworkRequest &request, const QString &key );
+
+  //! Whether the disk cache holds an unexpired response to url stored by partition key
+  bool hasFreshResponse( const QString &key, const QUrl &url );
+
+  //! Backoff state of a SP or IdP endpoint after failed handshakes
+  struct Breaker
+  {
+    Breaker() : failures( 0 ), openUntil( 0 ), probing( false ) {}
+
+    int failures;       //!< consecutive failed handshakes
+    qint64 openUntil;   //!< msecs since epoch before which no handshake is started
+    bool probing;       //!< a handshake is testing whether the endpoint recovered
+  };
+
+  enum Outcome
+  {
+    Succeeded,
+    Failed,
+    Untested           //!< the handshake failed before it reached the endpoint
+  };
+
+  //! Endpoints that failed recently, guarded by mHandshakesMutex
+  QHash<QString, Breaker> mBreakers;
+
+  //! Whether a handshake may go to all of endpoints now; caller holds mHandshakesMutex
+  bool admitHandshake( const QStringList &endpoints );
+
+  //! Opens, extends or closes the breaker of endpoint; caller holds mHandshakesMutex
+  void recordOutcome( const QString &endpoint, Outcome outcome );
+
+  //! Returns the handshake in flight for key, starting one if there is none; caller holds mHandshakesMutex
+  //! Returns null while the SP or the IdP is backing off
+  //! A brokered handshake asks the session broker for key before it logs in
+  QSharedPointer<QgsAuthSAML2Handshake> startHandshake( const QString &key, const QNetworkRequest &request,
+    const QString &authcfg, const QgsAuthMethodConfig &mconfig, bool brokered = false );
+
+  //! /auth/saml2 settings, read by reloadSettings() rather than on every request
+  QAtomicInt mCacheFirst;
+  QAtomicInt mSessionBroker;
+  QAtomicInt mNoChallengeTtl;
+  QAtomicInt mLegTimeout;
+  QAtomicInt mBackoffInitial;
+  QAtomicInt mBackoffMax;
+  QAtomicInt mRenewBefore;
+
+  //! Reads the settings above, on construction and whenever an auth config changes
+  void reloadSettings();
 
   QgsAuthMethodConfig getMethodConfig( const QString &authcfg, bool fullconfig = true );
 
@@ -56,7 +236,7 @@ private:
 
   void removeMethodConfig( const QString &authcfg );
 
-  static QMap<QString, QgsAuthMethodConfig> mAuthConfigCache;
+  static QgsAuthSAML2ShardedCache<QgsAuthMethodConfig> mAuthConfigCache;
 };
 
 #endif // QGSAUTHSAML2METHOD_H
@@ -0,0 +1,197 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2metrics.h"
+
+#include <QFile>
+#if QT_VERSION >= 0x050100
+#include <QSaveFile>
+#endif
+#include <QMutexLocker>
+#include <QTextStream>
+
+#include <cstdio>
+
+Q_GLOBAL_STATIC( QgsAuthSAML2Metrics, sMetrics )
+
+namespace
+{
+  const char *COUNTER_NAMES[] =
+  {
+    "saml2_session_hits_total",
+    "saml2_session_misses_total",
+    "saml2_sessions_expired_total",
+    "saml2_sessions_rejected_total",
+    "saml2_probes_avoided_total",
+    "saml2_requests_coalesced_total",
+    "saml2_handshakes_started_total",
+    "saml2_handshakes_succeeded_total",
+    "saml2_handshakes_unchallenged_total",
+    "saml2_handshakes_failed_total",
+    "saml2_handshake_timeouts_total",
+    "saml2_session_renewals_total",
+    "saml2_breaker_rejections_total",
+    "saml2_cache_first_hits_total",
+    "saml2_cache_bypassed_total",
+    "saml2_broker_sessions_total"
+  };
+
+  const char *GAUGE_NAMES[] =
+  {
+    "saml2_handshakes_in_flight",
+    "saml2_requests_waiting"
+  };
+
+  const char *PHASE_NAMES[] =
+  {
+    "sp_challenge",
+    "idp_assertion",
+    "assertion_consumer",
+    "handshake",
+    "wait"
+  };
+
+  QString labelValue( QString value )
+  {
+    return value.replace( '\\', "\\\\" ).replace( '"', "\\\"" ).replace( '\n', "\\n" );
+  }
+}
+
+
+QgsAuthSAML2Metrics *QgsAuthSAML2Metrics::instance()
+{
+  return sMetrics();
+}
+
+QgsAuthSAML2Metrics::QgsAuthSAML2Metrics()
+{
+}
+
+void QgsAuthSAML2Metrics::recordDuration( Phase phase, qint64 msecs )
+{
+  int bucket = 0;
+  while ( bucket < BucketCount - 1 && msecs > ( Q_INT64_C( 1 ) << bucket ) )
+    ++bucket;
+
+  QMutexLocker locker( &mMutex );
+  Histogram &histogram = mHistograms[phase];
+  ++histogram.buckets[bucket];
+  histogram.sum += msecs;
+  ++histogram.count;
+}
+
+void QgsAuthSAML2Metrics::recordFailure( const QString &idp, Phase phase )
+{
+  QMutexLocker locker( &mMutex );
+  ++mFailures[ qMakePair( idp, int( phase ) ) ];
+}
+
+void QgsAuthSAML2Metrics::reset()
+{
+  for ( int i = 0; i < CounterCount; ++i )
+    mCounters[i].fetchAndStoreRelaxed( 0 );
+
+  // gauges follow work in progress and are not reset
+  QMutexLocker locker( &mMutex );
+  for ( int i = 0; i < PhaseCount; ++i )
+    mHistograms[i] = Histogram();
+  mFailures.clear();
+}
+
+QString QgsAuthSAML2Metrics::toText() const
+{
+  QString text;
+  QTextStream out( &text );
+
+  for ( int i = 0; i < CounterCount; ++i )
+  {
+    out << "# TYPE " << COUNTER_NAMES[i] << " counter\n";
+    out << COUNTER_NAMES[i] << ' ' << counter( Counter( i ) ) << '\n';
+  }
+
+  for ( int i = 0; i < GaugeCount; ++i )
+  {
+    out << "# TYPE " << GAUGE_NAMES[i] << " gauge\n";
+    out << GAUGE_NAMES[i] << ' ' << gauge( Gauge( i ) ) << '\n';
+  }
+
+  QMutexLocker locker( &mMutex );
+
+  out << "# TYPE saml2_phase_duration_milliseconds histogram\n";
+  for ( int i = 0; i < PhaseCount; ++i )
+  {
+    const Histogram &histogram = mHistograms[i];
+    qint64 cumulative = 0;
+    for ( int bucket = 0; bucket < BucketCount; ++bucket )
+    {
+      cumulative += histogram.buckets[bucket];
+      QString le = bucket < BucketCount - 1 ? QString::number( Q_INT64_C( 1 ) << bucket ) : QString( "+Inf" );
+      out << "saml2_phase_duration_milliseconds_bucket{phase=\"" << PHASE_NAMES[i] << "\",le=\"" << le << "\"} " << cumulative << '\n';
+    }
+    out << "saml2_phase_duration_milliseconds_sum{phase=\"" << PHASE_NAMES[i] << "\"} " << histogram.sum << '\n';
+    out << "saml2_phase_duration_milliseconds_count{phase=\"" << PHASE_NAMES[i] << "\"} " << histogram.count << '\n';
+  }
+
+  out << "# TYPE saml2_handshake_failures_total counter\n";
+  for ( QHash< QPair<QString, int>, qint64 >::const_iterator it = mFailures.constBegin(); it != mFailures.constEnd(); ++it )
+  {
+    out << "saml2_handshake_failures_total{idp=\"" << labelValue( it.key().first ) << "\",phase=\"" << PHASE_NAMES[it.key().second] << "\"} " << it.value() << '\n';
+  }
+
+  out.flush();
+  return text;
+}
+
+bool QgsAuthSAML2Metrics::writeTo( const QString &fileName ) const
+{
+  QByteArray text = toText().toUtf8();
+
+  // written aside and swapped in one step, a scraper always finds a whole dump
+#if QT_VERSION >= 0x050100
+  QSaveFile file( fileName );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Text ) )
+    return false;
+  if ( file.write( text ) != text.size() )
+  {
+    file.cancelWriting();
+    return false;
+  }
+  return file.commit();
+#else
+  QFile file( fileName + ".new" );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text ) )
+    return false;
+  bool ok = file.write( text ) == text.size();
+  file.close();
+  if ( !ok || file.error() != QFile::NoError )
+  {
+    file.remove();
+    return false;
+  }
+#ifdef Q_OS_WIN
+  // rename() does not replace an existing file on Windows
+  QFile::remove( fileName );
+  return file.rename( fileName );
+#else
+  // rename(2) replaces the old dump atomically, QFile::rename() would refuse to
+  if ( std::rename( QFile::encodeName( file.fileName() ).constData(), QFile::encodeName( fileName ).constData() ) != 0 )
+  {
+    file.remove();
+    return false;
+  }
+  return true;
+#endif
+#endif
+}
@@ -0,0 +1,122 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2METRICS_H
+#define QGSAUTHSAML2METRICS_H
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+
+/**
+ * Counters, gauges and timing histograms of the ECP authentication.
+ *
+ * Counters and gauges are plain atomics, cheap enough for every request that
+ * passes updateNetworkRequest(). Timings and failures are recorded once per
+ * handshake leg and take a mutex. toText() renders everything in the
+ * Prometheus text format, which is also what the periodic dump writes.
+ */
+class QgsAuthSAML2Metrics
+{
+public:
+  enum Counter
+  {
+    SessionHits,          //!< request served with a cached SP session
+    SessionMisses,        //!< request that had to wait for a handshake
+    SessionsExpired,      //!< cached SP session found expired
+    SessionsRejected,     //!< SP refused a session it had issued
+    ProbesAvoided,        //!< probe skipped, the endpoint does not challenge
+    Coalesced,            //!< request that joined a handshake in flight
+    HandshakesStarted,
+    HandshakesSucceeded,  //!< handshake that established an SP session
+    HandshakesUnchallenged, //!< probe that found the resource unprotected
+    HandshakesFailed,
+    HandshakeTimeouts,    //!< request that gave up waiting for a handshake
+    Renewals,             //!< background login ahead of session expiry
+    BreakerRejections,    //!< handshake refused, the SP or IdP is backing off
+    CacheFirstHits,       //!< request left to a fresh cached response without probe or handshake
+    CacheBypassed,        //!< cached response of another authcfg or SP session not used
+    BrokerSessions,       //!< SP session taken over from another QGIS process
+    CounterCount
+  };
+
+  enum Gauge
+  {
+    HandshakesInFlight,
+    RequestsWaiting,      //!< requests parked on a handshake
+    GaugeCount
+  };
+
+  enum Phase
+  {
+    SpChallengePhase,
+    IdpAssertionPhase,
+    AssertionConsumerPhase,
+    HandshakePhase,       //!< a whole handshake
+    WaitPhase,            //!< time a request was parked on a handshake
+    PhaseCount
+  };
+
+  static QgsAuthSAML2Metrics *instance();
+
+  QgsAuthSAML2Metrics();
+
+  void increment( Counter counter ) { mCounters[counter].fetchAndAddRelaxed( 1 ); }
+
+  int counter( Counter counter ) const { return mCounters[counter].fetchAndAddRelaxed( 0 ); }
+
+  void addToGauge( Gauge gauge, int delta ) { mGauges[gauge].fetchAndAddRelaxed( delta ); }
+
+  int gauge( Gauge gauge ) const { return mGauges[gauge].fetchAndAddRelaxed( 0 ); }
+
+  void recordDuration( Phase phase, qint64 msecs );
+
+  /** Counts a failed handshake against the IdP it used and the leg it failed in */
+  void recordFailure( const QString &idp, Phase phase );
+
+  /** Everything in the Prometheus text exposition format */
+  QString toText() const;
+
+  /** Writes toText() to fileName */
+  bool writeTo( const QString &fileName ) const;
+
+  void reset();
+
+private:
+  //! upper bounds of the buckets are 1, 2, 4, ... 2^(BucketCount - 2) msecs, plus +Inf
+  static const int BucketCount = 19;
+
+  struct Histogram
+  {
+    Histogram() : sum( 0 ), count( 0 ) { for ( int i = 0; i < BucketCount; ++i ) buckets[i] = 0; }
+
+    qint64 buckets[BucketCount];
+    qint64 sum;
+    qint64 count;
+  };
+
+  mutable QAtomicInt mCounters[CounterCount];
+  mutable QAtomicInt mGauges[GaugeCount];
+
+  mutable QMutex mMutex;
+  Histogram mHistograms[PhaseCount];
+  QHash< QPair<QString, int>, qint64 > mFailures;
+
+  Q_DISABLE_COPY( QgsAuthSAML2Metrics )
+};
+
+#endif // QGSAUTHSAML2METRICS_H
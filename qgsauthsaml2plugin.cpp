@@ -0,0 +1,79 @@
+/***************************************************************************
+    begin                : October 15, 2017
+    copyright            : (C) 2017 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+// the entry points of the auth method plugin; the method itself is in the
+// saml2authcore library, which has no widgets and is shared with qgis_saml2_login
+
+#include "qgsauthsaml2method.h"
+#include "qgsauthsaml2broker.h"
+#include "qgsauthsaml2edit.h"
+#include "qgsauthsaml2handshake.h"
+#include "qgis.h"
+
+static const QString AUTH_METHOD_KEY = "SAML2";
+static const QString AUTH_METHOD_DESCRIPTION = "SAML2 authentication";
+
+//////////////////////////////////////////////
+// Plugin externals
+//////////////////////////////////////////////
+
+/**
+* Required class factory to return a pointer to a newly created object
+*/
+QGISEXTERN QgsAuthSAML2Method *classFactory()
+{
+  return new QgsAuthSAML2Method();
+}
+
+/** Required key function (used to map the plugin to a data store type)
+*/
+QGISEXTERN QString authMethodKey()
+{
+  return AUTH_METHOD_KEY;
+}
+
+/**
+* Required description function
+*/
+QGISEXTERN QString description()
+{
+  return AUTH_METHOD_DESCRIPTION;
+}
+
+/**
+* Required isAuthMethod function. Used to determine if this shared library
+* is an authentication method plugin
+*/
+QGISEXTERN bool isAuthMethod()
+{
+  return true;
+}
+
+/**
+* Optional class factory to return a pointer to a newly created edit widget
+*/
+QGISEXTERN QgsAuthSAML2Edit *editWidget( QWidget *parent )
+{
+  return new QgsAuthSAML2Edit( parent );
+}
+
+/**
+* Required cleanup function
+*/
+QGISEXTERN void cleanupAuthMethod() // pass QgsAuthMethod *method, then delete method  ?
+{
+  QgsAuthSAML2Handshake::shutdownWorker();
+  QgsAuthSAML2Broker::shutdown();
+}
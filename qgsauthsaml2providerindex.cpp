@@ -0,0 +1,475 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2providerindex.h"
+
+#include <QHash>
+#include <QSet>
+
+#include <algorithm>
+#include <cstring>
+
+/*
+ * File layout, all numbers are native quint32:
+ *
+ *   Header
+ *   Entity[entityCount]
+ *   quint32[listsCount]     string offsets of the per entity lists
+ *   Key[keyCount]           sorted by the bytes they point at
+ *   strings                 quint32 byte count followed by UTF-8 bytes
+ *
+ * String offsets are relative to the strings, list offsets count quint32
+ * from the start of the lists.
+ */
+
+namespace
+{
+  const quint32 INDEX_MAGIC = 0x534d4c58; // SMLX, swapped on a foreign byte order
+  const quint32 INDEX_VERSION = 1;
+
+  struct Header
+  {
+    quint32 magic;
+    quint32 version;
+    quint32 entityCount;
+    quint32 listsOffset;
+    quint32 listsCount;
+    quint32 keysOffset;
+    quint32 keyCount;
+    quint32 stringsOffset;
+    quint32 stringsSize;
+  };
+
+  //! A word of a folded term, as bytes [begin, end) of the strings
+  struct Key
+  {
+    quint32 begin;
+    quint32 end;
+    quint32 entity;
+  };
+
+  class StringTable
+  {
+  public:
+    quint32 add( const QByteArray &string )
+    {
+      QHash<QByteArray, quint32>::const_iterator it = mOffsets.constFind( string );
+      if ( it != mOffsets.constEnd() )
+        return it.value();
+
+      quint32 offset = mData.size();
+      quint32 length = string.size();
+      mData.append( reinterpret_cast<const char *>( &length ), sizeof( length ) );
+      mData.append( string );
+      mOffsets.insert( string, offset );
+      return offset;
+    }
+
+    const QByteArray &data() const { return mData; }
+
+  private:
+    QByteArray mData;
+    QHash<QByteArray, quint32> mOffsets;
+  };
+
+  int compareBytes( const char *a, int aLength, const char *b, int bLength )
+  {
+    int result = std::memcmp( a, b, qMin( aLength, bLength ) );
+    return result != 0 ? result : aLength - bLength;
+  }
+
+  struct KeyLess
+  {
+    explicit KeyLess( const char *strings ) : mStrings( strings ) {}
+
+    bool operator()( const Key &a, const Key &b ) const
+    {
+      return compareBytes( mStrings + a.begin, a.end - a.begin, mStrings + b.begin, b.end - b.begin ) < 0;
+    }
+
+    const char *mStrings;
+  };
+
+  struct KeyBelow
+  {
+    explicit KeyBelow( const char *strings ) : mStrings( strings ) {}
+
+    bool operator()( const Key &key, const QByteArray &text ) const
+    {
+      return compareBytes( mStrings + key.begin, key.end - key.begin, text.constData(), text.size() ) < 0;
+    }
+
+    const char *mStrings;
+  };
+
+  bool isSeparator( char c )
+  {
+    return c == ' ' || c == '.' || c == '-' || c == '_' || c == '/' || c == ':' || c == '(' || c == ')' || c == ',' || c == '\'' || c == '"';
+  }
+
+  QByteArray folded( const QString &text )
+  {
+    return text.trimmed().toCaseFolded().toUtf8();
+  }
+}
+
+struct QgsAuthSAML2ProviderIndex::Entity
+{
+  quint32 entityId;
+  quint32 displayName;
+  quint32 ecpUrl;
+  quint32 namesOffset;      //!< pairs of xml:lang and name
+  quint32 namesCount;
+  quint32 endpointsOffset;
+  quint32 endpointsCount;
+  quint32 scopesOffset;
+  quint32 scopesCount;
+  quint32 termsOffset;      //!< folded search terms
+  quint32 termsCount;
+};
+
+
+QgsAuthSAML2ProviderIndex::QgsAuthSAML2ProviderIndex()
+  : mData( nullptr )
+  , mSize( 0 )
+{
+}
+
+QgsAuthSAML2ProviderIndex::~QgsAuthSAML2ProviderIndex()
+{
+  close();
+}
+
+bool QgsAuthSAML2ProviderIndex::write( const QString &fileName, const QgsAuthSAML2ProviderList &providers, QString *error )
+{
+  StringTable strings;
+  QVector<Entity> entities;
+  QVector<quint32> lists;
+  QVector<Key> keys;
+  entities.reserve( providers.size() );
+
+  for ( int i = 0; i < providers.size(); ++i )
+  {
+    const QgsAuthSAML2Provider &provider = providers.at( i );
+    Entity entity;
+    entity.entityId = strings.add( provider.entityId.toUtf8() );
+    entity.displayName = strings.add( provider.displayName.toUtf8() );
+    entity.ecpUrl = strings.add( provider.ecpUrl.toUtf8() );
+
+    QStringList terms;
+    terms << provider.entityId << provider.displayName;
+
+    entity.namesOffset = lists.size();
+    entity.namesCount = provider.displayNames.size();
+    for ( int j = 0; j < provider.displayNames.size(); ++j )
+    {
+      lists << strings.add( provider.displayNames.at( j ).first.toUtf8() ) << strings.add( provider.displayNames.at( j ).second.toUtf8() );
+      terms << provider.displayNames.at( j ).second;
+    }
+
+    entity.endpointsOffset = lists.size();
+    entity.endpointsCount = provider.ecpUrls.size();
+    Q_FOREACH ( const QString &url, provider.ecpUrls )
+      lists << strings.add( url.toUtf8() );
+
+    entity.scopesOffset = lists.size();
+    entity.scopesCount = provider.scopes.size();
+    Q_FOREACH ( const QString &scope, provider.scopes )
+    {
+      lists << strings.add( scope.toUtf8() );
+      terms << scope;
+    }
+
+    QSet<QByteArray> termSet;
+    Q_FOREACH ( const QString &term, terms )
+    {
+      QByteArray bytes = folded( term );
+      if ( !bytes.isEmpty() )
+        termSet.insert( bytes );
+    }
+
+    entity.termsOffset = lists.size();
+    entity.termsCount = termSet.size();
+    Q_FOREACH ( const QByteArray &term, termSet )
+    {
+      quint32 offset = strings.add( term );
+      lists << offset;
+
+      quint32 begin = offset + sizeof( quint32 );
+      for ( int pos = 0; pos < term.size(); ++pos )
+      {
+        if ( isSeparator( term.at( pos ) ) || ( pos > 0 && !isSeparator( term.at( pos - 1 ) ) ) )
+          continue;
+        Key key;
+        key.begin = begin + pos;
+        key.end = begin + term.size();
+        key.entity = i;
+        keys << key;
+      }
+    }
+
+    entities << entity;
+  }
+
+  std::sort( keys.begin(), keys.end(), KeyLess( strings.data().constData() ) );
+
+  Header header;
+  header.magic = INDEX_MAGIC;
+  header.version = INDEX_VERSION;
+  header.entityCount = entities.size();
+  header.listsOffset = sizeof( Header ) + entities.size() * sizeof( Entity );
+  header.listsCount = lists.size();
+  header.keysOffset = header.listsOffset + lists.size() * sizeof( quint32 );
+  header.keyCount = keys.size();
+  header.stringsOffset = header.keysOffset + keys.size() * sizeof( Key );
+  header.stringsSize = strings.data().size();
+
+  // write aside and swap, the index may be mapped by another dialog
+  QFile file( fileName + ".new" );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+  {
+    if ( error )
+      *error = file.errorString();
+    return false;
+  }
+
+  bool ok = file.write( reinterpret_cast<const char *>( &header ), sizeof( header ) ) == sizeof( header )
+            && file.write( reinterpret_cast<const char *>( entities.constData() ), entities.size() * sizeof( Entity ) ) == qint64( entities.size() * sizeof( Entity ) )
+            && file.write( reinterpret_cast<const char *>( lists.constData() ), lists.size() * sizeof( quint32 ) ) == qint64( lists.size() * sizeof( quint32 ) )
+            && file.write( reinterpret_cast<const char *>( keys.constData() ), keys.size() * sizeof( Key ) ) == qint64( keys.size() * sizeof( Key ) )
+            && file.write( strings.data() ) == strings.data().size();
+  file.close();
+
+  if ( !ok || file.error() != QFile::NoError )
+  {
+    if ( error )
+      *error = file.errorString();
+    file.remove();
+    return false;
+  }
+
+  QFile::remove( fileName );
+  if ( !file.rename( fileName ) )
+  {
+    if ( error )
+      *error = file.errorString();
+    return false;
+  }
+  return true;
+}
+
+bool QgsAuthSAML2ProviderIndex::open( const QString &fileName, QString *error )
+{
+  close();
+
+  mFile.setFileName( fileName );
+  if ( !mFile.open( QIODevice::ReadOnly ) )
+  {
+    if ( error )
+      *error = mFile.errorString();
+    return false;
+  }
+
+  mSize = mFile.size();
+  const uchar *data = mSize >= qint64( sizeof( Header ) ) ? mFile.map( 0, mSize ) : nullptr;
+  if ( !data )
+  {
+    if ( error )
+      *error = QStringLiteral( "provider index %1 could not be mapped" ).arg( fileName );
+    mFile.close();
+    return false;
+  }
+
+  // never trust the offsets of a file beyond its size
+  const Header *header = reinterpret_cast<const Header *>( data );
+  bool valid = header->magic == INDEX_MAGIC && header->version == INDEX_VERSION
+               && header->listsOffset == sizeof( Header ) + qint64( header->entityCount ) * sizeof( Entity )
+               && header->keysOffset == header->listsOffset + qint64( header->listsCount ) * sizeof( quint32 )
+               && header->stringsOffset == header->keysOffset + qint64( header->keyCount ) * sizeof( Key )
+               && qint64( header->stringsOffset ) + header->stringsSize <= mSize;
+  if ( !valid )
+  {
+    if ( error )
+      *error = QStringLiteral( "provider index %1 is damaged or from another version" ).arg( fileName );
+    mFile.unmap( const_cast<uchar *>( data ) );
+    mFile.close();
+    return false;
+  }
+
+  mData = data;
+  return true;
+}
+
+void QgsAuthSAML2ProviderIndex::close()
+{
+  if ( mData )
+    mFile.unmap( const_cast<uchar *>( mData ) );
+  mData = nullptr;
+  mSize = 0;
+  mFile.close();
+}
+
+int QgsAuthSAML2ProviderIndex::size() const
+{
+  return mData ? reinterpret_cast<const Header *>( mData )->entityCount : 0;
+}
+
+const QgsAuthSAML2ProviderIndex::Entity *QgsAuthSAML2ProviderIndex::entity( int entity ) const
+{
+  if ( entity < 0 || entity >= size() )
+    return nullptr;
+  return reinterpret_cast<const Entity *>( mData + sizeof( Header ) ) + entity;
+}
+
+const quint32 *QgsAuthSAML2ProviderIndex::list( quint32 offset, quint32 count ) const
+{
+  const Header *header = reinterpret_cast<const Header *>( mData );
+  if ( qint64( offset ) + count > header->listsCount )
+    return nullptr;
+  return reinterpret_cast<const quint32 *>( mData + header->listsOffset ) + offset;
+}
+
+QByteArray QgsAuthSAML2ProviderIndex::bytes( quint32 offset ) const
+{
+  const Header *header = reinterpret_cast<const Header *>( mData );
+  if ( qint64( offset ) + sizeof( quint32 ) > header->stringsSize )
+    return QByteArray();
+
+  const char *strings = reinterpret_cast<const char *>( mData + header->stringsOffset );
+  quint32 length;
+  std::memcpy( &length, strings + offset, sizeof( length ) );
+  if ( qint64( offset ) + sizeof( quint32 ) + length > header->stringsSize )
+    return QByteArray();
+
+  // no copy, valid as long as the index is open
+  return QByteArray::fromRawData( strings + offset + sizeof( quint32 ), length );
+}
+
+QString QgsAuthSAML2ProviderIndex::string( quint32 offset ) const
+{
+  QByteArray raw = bytes( offset );
+  return QString::fromUtf8( raw.constData(), raw.size() );
+}
+
+QString QgsAuthSAML2ProviderIndex::entityId( int entity ) const
+{
+  const Entity *e = this->entity( entity );
+  return e ? string( e->entityId ) : QString();
+}
+
+QString QgsAuthSAML2ProviderIndex::displayName( int entity ) const
+{
+  const Entity *e = this->entity( entity );
+  return e ? string( e->displayName ) : QString();
+}
+
+QString QgsAuthSAML2ProviderIndex::ecpUrl( int entity ) const
+{
+  const Entity *e = this->entity( entity );
+  return e ? string( e->ecpUrl ) : QString();
+}
+
+QStringList QgsAuthSAML2ProviderIndex::ecpUrls( int entity ) const
+{
+  QStringList urls;
+  const Entity *e = this->entity( entity );
+  if ( !e )
+    return urls;
+
+  if ( const quint32 *endpoints = list( e->endpointsOffset, e->endpointsCount ) )
+  {
+    for ( quint32 i = 0; i < e->endpointsCount; ++i )
+      urls << string( endpoints[i] );
+  }
+  return urls;
+}
+
+QgsAuthSAML2Provider QgsAuthSAML2ProviderIndex::provider( int entity ) const
+{
+  QgsAuthSAML2Provider provider;
+  const Entity *e = this->entity( entity );
+  if ( !e )
+    return provider;
+
+  provider.entityId = string( e->entityId );
+  provider.displayName = string( e->displayName );
+  provider.ecpUrl = string( e->ecpUrl );
+  provider.ecpUrls = ecpUrls( entity );
+
+  if ( const quint32 *names = list( e->namesOffset, 2 * e->namesCount ) )
+  {
+    for ( quint32 i = 0; i < e->namesCount; ++i )
+      provider.displayNames << qMakePair( string( names[2 * i] ), string( names[2 * i + 1] ) );
+  }
+  if ( const quint32 *scopes = list( e->scopesOffset, e->scopesCount ) )
+  {
+    for ( quint32 i = 0; i < e->scopesCount; ++i )
+      provider.scopes << string( scopes[i] );
+  }
+  return provider;
+}
+
+QVector<int> QgsAuthSAML2ProviderIndex::search( const QString &text ) const
+{
+  QVector<int> result;
+  int count = size();
+  QByteArray needle = folded( text );
+
+  if ( needle.isEmpty() )
+  {
+    result.reserve( count );
+    for ( int i = 0; i < count; ++i )
+      result << i;
+    return result;
+  }
+
+  const Header *header = reinterpret_cast<const Header *>( mData );
+  const Key *keys = reinterpret_cast<const Key *>( mData + header->keysOffset );
+  const char *strings = reinterpret_cast<const char *>( mData + header->stringsOffset );
+  QVector<bool> found( count, false );
+
+  // words starting with the text
+  const Key *key = std::lower_bound( keys, keys + header->keyCount, needle, KeyBelow( strings ) );
+  for ( ; key != keys + header->keyCount; ++key )
+  {
+    if ( key->end > header->stringsSize || key->end - key->begin < quint32( needle.size() )
+         || std::memcmp( strings + key->begin, needle.constData(), needle.size() ) != 0 )
+      break;
+    if ( key->entity < quint32( count ) && !found[key->entity] )
+    {
+      found[key->entity] = true;
+      result << key->entity;
+    }
+  }
+
+  // the text anywhere else
+  for ( int i = 0; i < count; ++i )
+  {
+    if ( found[i] )
+      continue;
+    const Entity *e = entity( i );
+    const quint32 *terms = list( e->termsOffset, e->termsCount );
+    for ( quint32 t = 0; terms && t < e->termsCount; ++t )
+    {
+      if ( bytes( terms[t] ).contains( needle ) )
+      {
+        result << i;
+        break;
+      }
+    }
+  }
+
+  return result;
+}
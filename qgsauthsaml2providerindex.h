@@ -0,0 +1,102 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2PROVIDERINDEX_H
+#define QGSAUTHSAML2PROVIDERINDEX_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+//! IdP of a federation that offers the ECP profile
+struct QgsAuthSAML2Provider
+{
+  QString entityId;
+  QString displayName;                          //!< preferred name, English if given
+  QList< QPair<QString, QString> > displayNames; //!< xml:lang and name of every mdui:DisplayName
+  QString ecpUrl;                               //!< Location of the SOAP SingleSignOnService
+  QStringList ecpUrls;                          //!< every SOAP SingleSignOnService, in document order
+  QStringList scopes;                           //!< shibmd:Scope values
+};
+
+typedef QList<QgsAuthSAML2Provider> QgsAuthSAML2ProviderList;
+
+/**
+ * Read-only index of the IdPs of a federation, kept in a file that is
+ * memory-mapped instead of read.
+ *
+ * Opening an index costs a map call no matter how many entities it holds, and
+ * an entity is only decoded when it is shown. Searching works on case folded
+ * UTF-8 terms (all display names, the entityID and the scopes): every word of
+ * every term is a key of a sorted table, so prefix matches are found by binary
+ * search, and the terms are laid out per entity for a substring scan that
+ * touches no QString.
+ */
+class QgsAuthSAML2ProviderIndex
+{
+public:
+  QgsAuthSAML2ProviderIndex();
+  ~QgsAuthSAML2ProviderIndex();
+
+  /** Writes the index of providers to fileName */
+  static bool write( const QString &fileName, const QgsAuthSAML2ProviderList &providers, QString *error = nullptr );
+
+  bool open( const QString &fileName, QString *error = nullptr );
+
+  void close();
+
+  bool isOpen() const { return mData != nullptr; }
+
+  QString fileName() const { return mFile.fileName(); }
+
+  int size() const;
+
+  QString entityId( int entity ) const;
+
+  QString displayName( int entity ) const;
+
+  QString ecpUrl( int entity ) const;
+
+  QStringList ecpUrls( int entity ) const;
+
+  /** Decodes all there is about an entity */
+  QgsAuthSAML2Provider provider( int entity ) const;
+
+  /**
+   * Entities matching text, those with a word starting with text first, then
+   * those containing it anywhere. All entities for an empty text.
+   */
+  QVector<int> search( const QString &text ) const;
+
+private:
+  struct Entity;
+
+  const Entity *entity( int entity ) const;
+  const quint32 *list( quint32 offset, quint32 count ) const;
+  QByteArray bytes( quint32 offset ) const;
+  QString string( quint32 offset ) const;
+
+  QFile mFile;
+  const uchar *mData;
+  qint64 mSize;
+
+  Q_DISABLE_COPY( QgsAuthSAML2ProviderIndex )
+};
+
+#endif // QGSAUTHSAML2PROVIDERINDEX_H
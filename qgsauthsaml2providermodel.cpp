@@ -0,0 +1,101 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2providermodel.h"
+
+namespace
+{
+  const int FETCH_BATCH = 100;
+}
+
+
+QgsAuthSAML2ProviderModel::QgsAuthSAML2ProviderModel( QObject *parent )
+  : QAbstractListModel( parent )
+  , mFetched( 0 )
+{
+}
+
+bool QgsAuthSAML2ProviderModel::setIndexFile( const QString &fileName, QString *error )
+{
+  beginResetModel();
+  bool ok = mIndex.open( fileName, error );
+  mMatches = mIndex.search( QString() );
+  mFetched = 0;
+  endResetModel();
+  return ok;
+}
+
+void QgsAuthSAML2ProviderModel::clear()
+{
+  beginResetModel();
+  mIndex.close();
+  mMatches.clear();
+  mFetched = 0;
+  endResetModel();
+}
+
+void QgsAuthSAML2ProviderModel::setFilter( const QString &text )
+{
+  beginResetModel();
+  mMatches = mIndex.search( text );
+  mFetched = 0;
+  endResetModel();
+}
+
+int QgsAuthSAML2ProviderModel::rowCount( const QModelIndex &parent ) const
+{
+  return parent.isValid() ? 0 : mFetched;
+}
+
+QVariant QgsAuthSAML2ProviderModel::data( const QModelIndex &index, int role ) const
+{
+  if ( !index.isValid() || index.row() >= mFetched )
+    return QVariant();
+
+  int entity = mMatches.at( index.row() );
+  switch ( role )
+  {
+    case Qt::DisplayRole:
+      return mIndex.displayName( entity );
+    case Qt::ToolTipRole:
+    case EntityIdRole:
+      return mIndex.entityId( entity );
+    case EcpUrlRole:
+      return mIndex.ecpUrl( entity );
+    case EcpUrlsRole:
+      return mIndex.ecpUrls( entity );
+    default:
+      return QVariant();
+  }
+}
+
+bool QgsAuthSAML2ProviderModel::canFetchMore( const QModelIndex &parent ) const
+{
+  return !parent.isValid() && mFetched < mMatches.size();
+}
+
+void QgsAuthSAML2ProviderModel::fetchMore( const QModelIndex &parent )
+{
+  if ( parent.isValid() )
+    return;
+
+  int count = qMin( FETCH_BATCH, mMatches.size() - mFetched );
+  if ( count <= 0 )
+    return;
+
+  beginInsertRows( QModelIndex(), mFetched, mFetched + count - 1 );
+  mFetched += count;
+  endInsertRows();
+}
@@ -0,0 +1,70 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2PROVIDERMODEL_H
+#define QGSAUTHSAML2PROVIDERMODEL_H
+
+#include <QAbstractListModel>
+#include <QVector>
+
+#include "qgsauthsaml2providerindex.h"
+
+/**
+ * List of the IdPs in a provider index matching a search text.
+ *
+ * Rows are handed to the view in batches through fetchMore(), and the names
+ * are decoded from the mapped index only when the view asks for them.
+ */
+class QgsAuthSAML2ProviderModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+public:
+  enum Role
+  {
+    EcpUrlRole = Qt::UserRole,
+    EntityIdRole,
+    EcpUrlsRole      //!< every SOAP endpoint of the IdP, as QStringList
+  };
+
+  explicit QgsAuthSAML2ProviderModel( QObject *parent = nullptr );
+
+  /** Shows the providers of the index at fileName, returns false if it cannot be opened */
+  bool setIndexFile( const QString &fileName, QString *error = nullptr );
+
+  /** Drops the index, e.g. before it is rewritten */
+  void clear();
+
+  int rowCount( const QModelIndex &parent = QModelIndex() ) const override;
+
+  QVariant data( const QModelIndex &index, int role = Qt::DisplayRole ) const override;
+
+  bool canFetchMore( const QModelIndex &parent ) const override;
+
+  void fetchMore( const QModelIndex &parent ) override;
+
+  /** Number of matching providers, fetched or not */
+  int matchCount() const { return mMatches.size(); }
+
+public slots:
+  void setFilter( const QString &text );
+
+private:
+  QgsAuthSAML2ProviderIndex mIndex;
+  QVector<int> mMatches;
+  int mFetched;
+};
+
+#endif // QGSAUTHSAML2PROVIDERMODEL_H
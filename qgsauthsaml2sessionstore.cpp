@@ -0,0 +1,199 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2sessionstore.h"
+#include "qgsapplication.h"
+#include "qgsauthmanager.h"
+#include "qgslogger.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QtCrypto>
+
+namespace
+{
+  const quint32 STORE_MAGIC = 0x53414d4c; // SAML
+  const quint32 STORE_VERSION = 1;
+  const char *KEY_SETTING = "saml2-session-store-key";
+  const int KEY_SIZE = 32;
+
+  // serializes writers of the store file
+  QMutex sStoreMutex;
+
+  bool setError( QString *error, const QString &message )
+  {
+    if ( error )
+      *error = message;
+    return false;
+  }
+
+  // cipher key followed by MAC key, created on first use
+  QByteArray storeKeys( bool create )
+  {
+    QgsAuthManager *authm = QgsAuthManager::instance();
+    QByteArray keys = QByteArray::fromBase64( authm->getAuthSetting( KEY_SETTING, QVariant(), true ).toByteArray() );
+    if ( keys.size() == 2 * KEY_SIZE || !create )
+      return keys;
+
+    keys = QCA::Random::randomArray( 2 * KEY_SIZE ).toByteArray();
+    if ( !authm->storeAuthSetting( KEY_SETTING, QString( keys.toBase64() ), true ) )
+      return QByteArray();
+    return keys;
+  }
+
+  QByteArray mac( const QByteArray &keys, const QByteArray &iv, const QByteArray &data )
+  {
+    QCA::MessageAuthenticationCode hmac( "hmac(sha256)", QCA::SymmetricKey( keys.mid( KEY_SIZE ) ) );
+    hmac.update( iv );
+    hmac.update( data );
+    return hmac.final().toByteArray();
+  }
+
+  // compares without leaking the position of the first difference
+  bool sameMac( const QByteArray &a, const QByteArray &b )
+  {
+    if ( a.size() != b.size() )
+      return false;
+    char diff = 0;
+    for ( int i = 0; i < a.size(); ++i )
+      diff |= a.at( i ) ^ b.at( i );
+    return diff == 0;
+  }
+}
+
+
+bool QgsAuthSAML2SessionStore::isEnabled()
+{
+  return QSettings().value( "/auth/saml2/persistSessions", false ).toBool()
+         && QCA::isSupported( "aes256-cbc-pkcs7" ) && QCA::isSupported( "hmac(sha256)" );
+}
+
+QString QgsAuthSAML2SessionStore::fileName()
+{
+  return QgsApplication::qgisSettingsDirPath() + "saml2sessions.dat";
+}
+
+QList<QgsAuthSAML2SessionStore::Record> QgsAuthSAML2SessionStore::load( QString *error )
+{
+  QList<Record> records;
+
+  QFile file( fileName() );
+  if ( !file.exists() )
+    return records;
+  if ( !file.open( QIODevice::ReadOnly ) )
+  {
+    setError( error, file.errorString() );
+    return records;
+  }
+
+  QDataStream in( &file );
+  quint32 magic, version;
+  QByteArray iv, data, storedMac;
+  in >> magic >> version >> iv >> data >> storedMac;
+  if ( in.status() != QDataStream::Ok || magic != STORE_MAGIC || version != STORE_VERSION )
+  {
+    setError( error, QStringLiteral( "session store is damaged or from another version" ) );
+    return records;
+  }
+
+  QByteArray keys = storeKeys( false );
+  if ( keys.size() != 2 * KEY_SIZE || !sameMac( storedMac, mac( keys, iv, data ) ) )
+  {
+    setError( error, QStringLiteral( "session store was written with another key or modified" ) );
+    return records;
+  }
+
+  QCA::Cipher cipher( "aes256", QCA::Cipher::CBC, QCA::Cipher::DefaultPadding, QCA::Decode,
+                      QCA::SymmetricKey( keys.left( KEY_SIZE ) ), QCA::InitializationVector( iv ) );
+  QByteArray plain = cipher.process( QCA::SecureArray( data ) ).toByteArray();
+  if ( !cipher.ok() )
+  {
+    setError( error, QStringLiteral( "session store could not be decrypted" ) );
+    return records;
+  }
+
+  QDataStream sessions( plain );
+  quint32 count;
+  sessions >> count;
+  QDateTime now = QDateTime::currentDateTimeUtc();
+  for ( quint32 i = 0; i < count && sessions.status() == QDataStream::Ok; ++i )
+  {
+    Record record;
+    QList<QByteArray> cookies;
+    sessions >> record.key >> record.authcfg >> record.url >> cookies >> record.obtained >> record.expires;
+    Q_FOREACH ( const QByteArray &cookie, cookies )
+      record.cookies << QNetworkCookie::parseCookies( cookie );
+
+    if ( record.expires.isValid() && record.expires <= now )
+      continue;
+    records << record;
+  }
+
+  QgsDebugMsg( QString( "Loaded %1 SAML2 sessions from %2" ).arg( records.size() ).arg( fileName() ) );
+  return records;
+}
+
+bool QgsAuthSAML2SessionStore::save( const QList<Record> &records, QString *error )
+{
+  QByteArray plain;
+  {
+    QDataStream sessions( &plain, QIODevice::WriteOnly );
+    sessions << quint32( records.size() );
+    Q_FOREACH ( const Record &record, records )
+    {
+      QList<QByteArray> cookies;
+      Q_FOREACH ( const QNetworkCookie &cookie, record.cookies )
+        cookies << cookie.toRawForm( QNetworkCookie::Full );
+      sessions << record.key << record.authcfg << record.url << cookies << record.obtained << record.expires;
+    }
+  }
+
+  QMutexLocker locker( &sStoreMutex );
+
+  QByteArray keys = storeKeys( true );
+  if ( keys.size() != 2 * KEY_SIZE )
+    return setError( error, QStringLiteral( "no session store key, is the master password set?" ) );
+
+  QCA::InitializationVector iv( 16 );
+  QCA::Cipher cipher( "aes256", QCA::Cipher::CBC, QCA::Cipher::DefaultPadding, QCA::Encode,
+                      QCA::SymmetricKey( keys.left( KEY_SIZE ) ), iv );
+  QByteArray data = cipher.process( QCA::SecureArray( plain ) ).toByteArray();
+  if ( !cipher.ok() )
+    return setError( error, QStringLiteral( "session store could not be encrypted" ) );
+
+  // write aside and swap, a crash must not leave a truncated store behind
+  QFile file( fileName() + ".new" );
+  if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    return setError( error, file.errorString() );
+  file.setPermissions( QFile::ReadOwner | QFile::WriteOwner );
+
+  QDataStream out( &file );
+  out << STORE_MAGIC << STORE_VERSION << iv.toByteArray() << data << mac( keys, iv.toByteArray(), data );
+  file.close();
+  if ( out.status() != QDataStream::Ok || file.error() != QFile::NoError )
+  {
+    file.remove();
+    return setError( error, QStringLiteral( "session store could not be written" ) );
+  }
+
+  QFile::remove( fileName() );
+  if ( !file.rename( fileName() ) )
+    return setError( error, file.errorString() );
+
+  return true;
+}
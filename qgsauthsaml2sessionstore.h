@@ -0,0 +1,62 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2SESSIONSTORE_H
+#define QGSAUTHSAML2SESSIONSTORE_H
+
+#include <QDateTime>
+#include <QList>
+#include <QNetworkCookie>
+#include <QString>
+#include <QUrl>
+
+/**
+ * Optional on-disk store of SP sessions, so a restarted QGIS picks up valid
+ * sessions instead of logging in to every SP again.
+ *
+ * The store is a single file in the QGIS settings directory, encrypted with
+ * AES-256 and authenticated with HMAC-SHA256 through QCA. The random keys are
+ * kept in the QGIS authentication database, protected by the master password.
+ * It is enabled with the /auth/saml2/persistSessions setting.
+ */
+class QgsAuthSAML2SessionStore
+{
+public:
+  struct Record
+  {
+    QString key;            //!< session cache key
+    QString authcfg;
+    QUrl url;               //!< request the session was established for
+    QList<QNetworkCookie> cookies;
+    QDateTime obtained;
+    QDateTime expires;      //!< invalid if the SP did not limit the session
+  };
+
+  static bool isEnabled();
+
+  /** Path of the store file */
+  static QString fileName();
+
+  /**
+   * Reads the sessions that are still valid.
+   * Needs the master password, i.e. an authcfg must have been decrypted before.
+   */
+  static QList<Record> load( QString *error = nullptr );
+
+  /** Replaces the stored sessions with records */
+  static bool save( const QList<Record> &records, QString *error = nullptr );
+};
+
+#endif // QGSAUTHSAML2SESSIONSTORE_H
@@ -0,0 +1,213 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2trace.h"
+
+#include <QDateTime>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QVector>
+
+#include <cstring>
+
+QAtomicInt QgsAuthSAML2Trace::sLevel( QgsAuthSAML2Trace::Off );
+
+namespace
+{
+  // a payload beyond this is cut, the ring must stay small whatever the IdP sends
+  const int MAX_PAYLOAD = 64 * 1024;
+
+  // elements whose content identifies the user or grants access
+  const char *SENSITIVE_ELEMENTS[] =
+  {
+    "Assertion",
+    "EncryptedAssertion",
+    "NameID",
+    "AttributeValue",
+    "SignatureValue",
+    "X509Certificate",
+    "CipherValue"
+  };
+
+  bool isSensitive( const QByteArray &localName )
+  {
+    for ( size_t i = 0; i < sizeof( SENSITIVE_ELEMENTS ) / sizeof( SENSITIVE_ELEMENTS[0] ); ++i )
+    {
+      if ( localName == SENSITIVE_ELEMENTS[i] )
+        return true;
+    }
+    return false;
+  }
+
+  struct Entry
+  {
+    Entry() : time( 0 ), handshake( 0 ), what( nullptr ) {}
+
+    qint64 time;
+    int handshake;
+    const char *what;   //!< set for payloads
+    QString message;
+    QByteArray payload;
+  };
+
+  struct Ring
+  {
+    Ring() : next( 0 ), size( 0 ) {}
+
+    QMutex mutex;
+    QVector<Entry> entries;
+    int next;
+    int size;
+
+    void append( const Entry &entry )
+    {
+      QMutexLocker locker( &mutex );
+      if ( entries.isEmpty() )
+        return;
+      entries[next] = entry;
+      next = ( next + 1 ) % entries.size();
+      size = qMin( size + 1, entries.size() );
+    }
+  };
+}
+
+Q_GLOBAL_STATIC( Ring, sRing )
+
+
+void QgsAuthSAML2Trace::configure( Level level, int capacity )
+{
+  Ring *ring = sRing();
+  {
+    QMutexLocker locker( &ring->mutex );
+    capacity = level == Off ? 0 : qMax( capacity, 1 );
+    if ( capacity != ring->entries.size() )
+    {
+      // keep the newest entries that fit
+      QVector<Entry> entries( capacity );
+      int kept = qMin( ring->size, capacity );
+      for ( int i = 0; i < kept; ++i )
+      {
+        int from = ( ring->next - kept + i + ring->entries.size() ) % ring->entries.size();
+        entries[i] = ring->entries.at( from );
+      }
+      ring->entries = entries;
+      ring->size = kept;
+      ring->next = capacity > 0 ? kept % capacity : 0;
+    }
+  }
+  sLevel.fetchAndStoreRelaxed( level );
+}
+
+void QgsAuthSAML2Trace::event( int handshake, const QString &message )
+{
+  Entry entry;
+  entry.time = QDateTime::currentMSecsSinceEpoch();
+  entry.handshake = handshake;
+  entry.message = message;
+  sRing()->append( entry );
+}
+
+void QgsAuthSAML2Trace::payload( int handshake, const char *what, const QByteArray &data )
+{
+  Entry entry;
+  entry.time = QDateTime::currentMSecsSinceEpoch();
+  entry.handshake = handshake;
+  entry.what = what;
+  entry.payload = redact( data );
+  if ( entry.payload.size() > MAX_PAYLOAD )
+  {
+    entry.message = QString( "%1 bytes, cut" ).arg( entry.payload.size() );
+    entry.payload.truncate( MAX_PAYLOAD );
+  }
+  else
+  {
+    entry.message = QString( "%1 bytes" ).arg( entry.payload.size() );
+  }
+  sRing()->append( entry );
+}
+
+QByteArray QgsAuthSAML2Trace::redact( const QByteArray &data )
+{
+  QByteArray out;
+  out.reserve( data.size() );
+
+  int pos = 0;
+  while ( pos < data.size() )
+  {
+    int open = data.indexOf( '<', pos );
+    int tagEnd = open < 0 ? -1 : data.indexOf( '>', open );
+    if ( tagEnd < 0 )
+    {
+      out.append( data.constData() + pos, data.size() - pos );
+      break;
+    }
+
+    int nameEnd = open + 1;
+    while ( nameEnd < tagEnd && !strchr( " \t\r\n/", data.at( nameEnd ) ) )
+      ++nameEnd;
+    QByteArray qname = data.mid( open + 1, nameEnd - open - 1 );
+
+    out.append( data.constData() + pos, tagEnd + 1 - pos );
+    pos = tagEnd + 1;
+
+    // end tags, comments, declarations and empty elements have nothing to hide
+    if ( qname.isEmpty() || qname.at( 0 ) == '!' || qname.at( 0 ) == '?' || data.at( tagEnd - 1 ) == '/' )
+      continue;
+
+    int colon = qname.indexOf( ':' );
+    if ( !isSensitive( colon < 0 ? qname : qname.mid( colon + 1 ) ) )
+      continue;
+
+    int close = data.indexOf( "</" + qname, pos );
+    if ( close < 0 )
+      close = data.size();
+    out.append( QString( "[%1 bytes redacted]" ).arg( close - pos ).toLatin1() );
+    pos = close;
+  }
+
+  return out;
+}
+
+QString QgsAuthSAML2Trace::toText()
+{
+  QString text;
+  QTextStream out( &text );
+
+  Ring *ring = sRing();
+  QMutexLocker locker( &ring->mutex );
+  for ( int i = 0; i < ring->size; ++i )
+  {
+    const Entry &entry = ring->entries.at( ( ring->next - ring->size + i + ring->entries.size() ) % ring->entries.size() );
+    out << QDateTime::fromMSecsSinceEpoch( entry.time ).toUTC().toString( "yyyy-MM-ddThh:mm:ss.zzz" )
+        << " #" << entry.handshake << ' ';
+    if ( entry.what )
+      out << entry.what << " (" << entry.message << "):\n" << QString::fromUtf8( entry.payload ) << '\n';
+    else
+      out << entry.message << '\n';
+  }
+
+  out.flush();
+  return text;
+}
+
+void QgsAuthSAML2Trace::clear()
+{
+  Ring *ring = sRing();
+  QMutexLocker locker( &ring->mutex );
+  ring->entries = QVector<Entry>( ring->entries.size() );
+  ring->next = 0;
+  ring->size = 0;
+}
@@ -0,0 +1,76 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2TRACE_H
+#define QGSAUTHSAML2TRACE_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Trace of the ECP handshakes, kept in a bounded ring buffer.
+ *
+ * Use the SAML2_TRACE_EVENT and SAML2_TRACE_PAYLOAD macros: their arguments
+ * are only evaluated when the level is enabled, so a disabled trace costs a
+ * single integer compare. Payloads are stored as bytes, with assertions,
+ * signatures, certificates and subject data redacted; formatting happens
+ * only when the trace is read with toText().
+ */
+class QgsAuthSAML2Trace
+{
+public:
+  enum Level
+  {
+    Off,
+    Events,   //!< state changes and decisions of the handshake
+    Payloads  //!< events plus the redacted SOAP envelopes
+  };
+
+  static bool isEnabled( Level level )
+  {
+#if QT_VERSION >= 0x050000
+    return sLevel.load() >= level;
+#else
+    return sLevel >= level;
+#endif
+  }
+
+  /** Sets the level and the number of entries kept; a smaller capacity drops the oldest entries */
+  static void configure( Level level, int capacity );
+
+  static void event( int handshake, const QString &message );
+
+  static void payload( int handshake, const char *what, const QByteArray &data );
+
+  /** The envelope with assertion and subject data replaced by their size */
+  static QByteArray redact( const QByteArray &data );
+
+  /** The entries in the ring, oldest first */
+  static QString toText();
+
+  static void clear();
+
+private:
+  static QAtomicInt sLevel;
+};
+
+#define SAML2_TRACE_EVENT( handshake, message ) \
+  do { if ( QgsAuthSAML2Trace::isEnabled( QgsAuthSAML2Trace::Events ) ) QgsAuthSAML2Trace::event( handshake, message ); } while ( false )
+
+#define SAML2_TRACE_PAYLOAD( handshake, what, data ) \
+  do { if ( QgsAuthSAML2Trace::isEnabled( QgsAuthSAML2Trace::Payloads ) ) QgsAuthSAML2Trace::payload( handshake, what, data ); } while ( false )
+
+#endif // QGSAUTHSAML2TRACE_H
@@ -0,0 +1,458 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include "qgsauthsaml2mockserver.h"
+
+#include <QDateTime>
+#include <QHostAddress>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+
+const char *QgsAuthSAML2MockServer::RESOURCE_PATH = "/ows";
+const char *QgsAuthSAML2MockServer::IDP_PATH = "/idp/profile/SAML2/SOAP/ECP";
+const char *QgsAuthSAML2MockServer::ACS_PATH = "/Shibboleth.sso/SAML2/ECP";
+const char *QgsAuthSAML2MockServer::USERNAME = "alice";
+const char *QgsAuthSAML2MockServer::PASSWORD = "wonderland";
+
+namespace
+{
+  const char *SP_ENTITY = "https://sp.example.org/shibboleth";
+  const char *IDP_ENTITY = "https://idp.example.org/idp/shibboleth";
+
+  // stands in for digests, signature values and certificates, same size as real ones
+  QByteArray filler( int bytes, int seed )
+  {
+    QByteArray data;
+    data.reserve( bytes );
+    for ( int i = 0; i < bytes; ++i )
+      data.append( char( ( i * 131 + seed * 17 ) & 0xff ) );
+    return data.toBase64();
+  }
+
+  QByteArray signature( const QString &reference, int seed )
+  {
+    return QString( "<ds:Signature xmlns:ds=\"http://www.w3.org/2000/09/xmldsig#\">"
+                    "<ds:SignedInfo>"
+                    "<ds:CanonicalizationMethod Algorithm=\"http://www.w3.org/2001/10/xml-exc-c14n#\"/>"
+                    "<ds:SignatureMethod Algorithm=\"http://www.w3.org/2001/04/xmldsig-more#rsa-sha256\"/>"
+                    "<ds:Reference URI=\"#%1\">"
+                    "<ds:Transforms>"
+                    "<ds:Transform Algorithm=\"http://www.w3.org/2000/09/xmldsig#enveloped-signature\"/>"
+                    "<ds:Transform Algorithm=\"http://www.w3.org/2001/10/xml-exc-c14n#\"/>"
+                    "</ds:Transforms>"
+                    "<ds:DigestMethod Algorithm=\"http://www.w3.org/2001/04/xmlenc#sha256\"/>"
+                    "<ds:DigestValue>%2</ds:DigestValue>"
+                    "</ds:Reference>"
+                    "</ds:SignedInfo>"
+                    "<ds:SignatureValue>%3</ds:SignatureValue>"
+                    "<ds:KeyInfo><ds:X509Data><ds:X509Certificate>%4</ds:X509Certificate></ds:X509Data></ds:KeyInfo>"
+                    "</ds:Signature>" )
+           .arg( reference,
+                 QString::fromLatin1( filler( 32, seed ) ),
+                 QString::fromLatin1( filler( 256, seed + 1 ) ),
+                 QString::fromLatin1( filler( 900, seed + 2 ) ) ).toUtf8();
+  }
+
+  QString isoNow( int secs = 0 )
+  {
+    return QDateTime::currentDateTimeUtc().addSecs( secs ).toString( "yyyy-MM-ddThh:mm:ssZ" );
+  }
+
+  // the values of all cookies in a Cookie request header
+  QStringList cookieValues( const QByteArray &header )
+  {
+    QStringList values;
+    Q_FOREACH ( const QByteArray &pair, header.split( ';' ) )
+    {
+      int equals = pair.indexOf( '=' );
+      if ( equals > 0 )
+        values << QString::fromLatin1( pair.mid( equals + 1 ).trimmed() );
+    }
+    return values;
+  }
+}
+
+
+QgsAuthSAML2MockServer::QgsAuthSAML2MockServer()
+  : QTcpServer()
+  , mThread( nullptr )
+  , mLatency( 0 )
+  , mIdpFailing( false )
+{
+}
+
+QgsAuthSAML2MockServer::~QgsAuthSAML2MockServer()
+{
+  if ( mThread )
+  {
+    mThread->quit();
+    mThread->wait();
+    delete mThread;
+  }
+}
+
+bool QgsAuthSAML2MockServer::start()
+{
+  mThread = new QThread();
+  mThread->setObjectName( "SAML2 mock SP and IdP" );
+  mThread->start();
+  moveToThread( mThread );
+
+  bool listening = false;
+  QMetaObject::invokeMethod( this, "listenLocal", Qt::BlockingQueuedConnection, Q_RETURN_ARG( bool, listening ) );
+  return listening;
+}
+
+bool QgsAuthSAML2MockServer::listenLocal()
+{
+  if ( !listen( QHostAddress::LocalHost, 0 ) )
+    return false;
+
+  connect( this, SIGNAL( newConnection() ), this, SLOT( onNewConnection() ) );
+  mBase = QUrl( QString( "http://127.0.0.1:%1" ).arg( serverPort() ) );
+  return true;
+}
+
+QUrl QgsAuthSAML2MockServer::resourceUrl() const
+{
+  QUrl url( mBase );
+  url.setPath( RESOURCE_PATH );
+  return url;
+}
+
+QUrl QgsAuthSAML2MockServer::idpUrl() const
+{
+  QUrl url( mBase );
+  url.setPath( IDP_PATH );
+  return url;
+}
+
+QUrl QgsAuthSAML2MockServer::acsUrl() const
+{
+  QUrl url( mBase );
+  url.setPath( ACS_PATH );
+  return url;
+}
+
+void QgsAuthSAML2MockServer::setLatency( int msecs )
+{
+  QMutexLocker locker( &mMutex );
+  mLatency = msecs;
+}
+
+void QgsAuthSAML2MockServer::setIdpFailing( bool failing )
+{
+  QMutexLocker locker( &mMutex );
+  mIdpFailing = failing;
+}
+
+int QgsAuthSAML2MockServer::resourceRequests() const
+{
+  return mResourceRequests.fetchAndAddRelaxed( 0 );
+}
+
+int QgsAuthSAML2MockServer::challenges() const
+{
+  return mChallenges.fetchAndAddRelaxed( 0 );
+}
+
+int QgsAuthSAML2MockServer::idpRequests() const
+{
+  return mIdpRequests.fetchAndAddRelaxed( 0 );
+}
+
+int QgsAuthSAML2MockServer::idpLogins() const
+{
+  return mIdpLogins.fetchAndAddRelaxed( 0 );
+}
+
+int QgsAuthSAML2MockServer::sessionsIssued() const
+{
+  return mSessionsIssued.fetchAndAddRelaxed( 0 );
+}
+
+void QgsAuthSAML2MockServer::dropSessions()
+{
+  QMutexLocker locker( &mMutex );
+  mSessions.clear();
+  mIdpSessions.clear();
+  mRelayStates.clear();
+}
+
+QByteArray QgsAuthSAML2MockServer::spEnvelope( const QString &acsUrl, const QString &relayState )
+{
+  const QString id = QString( "_%1" ).arg( QString::fromLatin1( filler( 16, relayState.size() ).toHex() ) );
+  QByteArray envelope;
+  envelope += "<S:Envelope xmlns:S=\"http://schemas.xmlsoap.org/soap/envelope/\">";
+  envelope += "<S:Header>";
+  envelope += QString( "<paos:Request xmlns:paos=\"urn:liberty:paos:2003-08\" S:actor=\"http://schemas.xmlsoap.org/soap/actor/next\" "
+                       "S:mustUnderstand=\"1\" responseConsumerURL=\"%1\" service=\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\"/>" )
+              .arg( acsUrl ).toUtf8();
+  envelope += QString( "<ecp:Request xmlns:ecp=\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\" IsPassive=\"0\" "
+                       "S:actor=\"http://schemas.xmlsoap.org/soap/actor/next\" S:mustUnderstand=\"1\">"
+                       "<saml:Issuer xmlns:saml=\"urn:oasis:names:tc:SAML:2.0:assertion\">%1</saml:Issuer>"
+                       "</ecp:Request>" ).arg( SP_ENTITY ).toUtf8();
+  envelope += QString( "<ecp:RelayState xmlns:ecp=\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\" "
+                       "S:actor=\"http://schemas.xmlsoap.org/soap/actor/next\" S:mustUnderstand=\"1\">%1</ecp:RelayState>" )
+              .arg( relayState ).toUtf8();
+  envelope += "</S:Header>";
+  envelope += "<S:Body>";
+  envelope += QString( "<samlp:AuthnRequest xmlns:samlp=\"urn:oasis:names:tc:SAML:2.0:protocol\" AssertionConsumerServiceURL=\"%1\" "
+                       "ID=\"%2\" IssueInstant=\"%3\" ProtocolBinding=\"urn:oasis:names:tc:SAML:2.0:bindings:PAOS\" Version=\"2.0\">"
+                       "<saml:Issuer xmlns:saml=\"urn:oasis:names:tc:SAML:2.0:assertion\">%4</saml:Issuer>" )
+              .arg( acsUrl, id, isoNow(), SP_ENTITY ).toUtf8();
+  envelope += signature( id, 1 );
+  envelope += "<samlp:NameIDPolicy AllowCreate=\"1\"/>";
+  envelope += "</samlp:AuthnRequest>";
+  envelope += "</S:Body>";
+  envelope += "</S:Envelope>";
+  return envelope;
+}
+
+QByteArray QgsAuthSAML2MockServer::idpEnvelope( const QString &acsUrl )
+{
+  const QString responseId = QString( "_%1" ).arg( QString::fromLatin1( filler( 16, 3 ).toHex() ) );
+  const QString assertionId = QString( "_%1" ).arg( QString::fromLatin1( filler( 16, 4 ).toHex() ) );
+  QByteArray envelope;
+  envelope += "<?xml version=\"1.0\" encoding=\"UTF-8\"?>";
+  envelope += "<soap11:Envelope xmlns:soap11=\"http://schemas.xmlsoap.org/soap/envelope/\">";
+  envelope += "<soap11:Header>";
+  envelope += QString( "<ecp:Response xmlns:ecp=\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\" "
+                       "AssertionConsumerServiceURL=\"%1\" soap11:actor=\"http://schemas.xmlsoap.org/soap/actor/next\" "
+                       "soap11:mustUnderstand=\"1\"/>" ).arg( acsUrl ).toUtf8();
+  envelope += "</soap11:Header>";
+  envelope += "<soap11:Body>";
+  envelope += QString( "<saml2p:Response xmlns:saml2p=\"urn:oasis:names:tc:SAML:2.0:protocol\" Destination=\"%1\" ID=\"%2\" "
+                       "IssueInstant=\"%3\" Version=\"2.0\">"
+                       "<saml2:Issuer xmlns:saml2=\"urn:oasis:names:tc:SAML:2.0:assertion\">%4</saml2:Issuer>"
+                       "<saml2p:Status><saml2p:StatusCode Value=\"urn:oasis:names:tc:SAML:2.0:status:Success\"/></saml2p:Status>" )
+              .arg( acsUrl, responseId, isoNow(), IDP_ENTITY ).toUtf8();
+  envelope += QString( "<saml2:Assertion xmlns:saml2=\"urn:oasis:names:tc:SAML:2.0:assertion\" ID=\"%1\" IssueInstant=\"%2\" Version=\"2.0\">"
+                       "<saml2:Issuer>%3</saml2:Issuer>" ).arg( assertionId, isoNow(), IDP_ENTITY ).toUtf8();
+  envelope += signature( assertionId, 5 );
+  envelope += QString( "<saml2:Subject>"
+                       "<saml2:NameID Format=\"urn:oasis:names:tc:SAML:2.0:nameid-format:transient\" NameQualifier=\"%1\" SPNameQualifier=\"%2\">%3</saml2:NameID>"
+                       "<saml2:SubjectConfirmation Method=\"urn:oasis:names:tc:SAML:2.0:cm:bearer\">"
+                       "<saml2:SubjectConfirmationData NotOnOrAfter=\"%4\" Recipient=\"%5\"/>"
+                       "</saml2:SubjectConfirmation>"
+                       "</saml2:Subject>"
+                       "<saml2:Conditions NotBefore=\"%6\" NotOnOrAfter=\"%4\">"
+                       "<saml2:AudienceRestriction><saml2:Audience>%2</saml2:Audience></saml2:AudienceRestriction>"
+                       "</saml2:Conditions>"
+                       "<saml2:AuthnStatement AuthnInstant=\"%6\" SessionIndex=\"%7\" SessionNotOnOrAfter=\"%8\">"
+                       "<saml2:AuthnContext><saml2:AuthnContextClassRef>urn:oasis:names:tc:SAML:2.0:ac:classes:PasswordProtectedTransport</saml2:AuthnContextClassRef></saml2:AuthnContext>"
+                       "</saml2:AuthnStatement>"
+                       "<saml2:AttributeStatement>"
+                       "<saml2:Attribute FriendlyName=\"eduPersonPrincipalName\" Name=\"urn:oid:1.3.6.1.4.1.5923.1.1.1.6\"><saml2:AttributeValue>%9@example.org</saml2:AttributeValue></saml2:Attribute>"
+                       "</saml2:AttributeStatement>"
+                       "</saml2:Assertion>" )
+              .arg( IDP_ENTITY, SP_ENTITY, QString::fromLatin1( filler( 24, 6 ).toHex() ), isoNow( 300 ), acsUrl,
+                    isoNow(), QString::fromLatin1( filler( 16, 7 ).toHex() ), isoNow( 8 * 3600 ), USERNAME ).toUtf8();
+  envelope += "</saml2p:Response>";
+  envelope += "</soap11:Body>";
+  envelope += "</soap11:Envelope>";
+  return envelope;
+}
+
+void QgsAuthSAML2MockServer::onNewConnection()
+{
+  while ( QTcpSocket *socket = nextPendingConnection() )
+  {
+    mBuffers.insert( socket, QByteArray() );
+    connect( socket, SIGNAL( readyRead() ), this, SLOT( onReadyRead() ) );
+    connect( socket, SIGNAL( disconnected() ), this, SLOT( onDisconnected() ) );
+  }
+}
+
+void QgsAuthSAML2MockServer::onDisconnected()
+{
+  QTcpSocket *socket = qobject_cast<QTcpSocket *>( sender() );
+  if ( !socket )
+    return;
+
+  mBuffers.remove( socket );
+  socket->deleteLater();
+}
+
+void QgsAuthSAML2MockServer::onReadyRead()
+{
+  QTcpSocket *socket = qobject_cast<QTcpSocket *>( sender() );
+  if ( !socket )
+    return;
+
+  QByteArray &buffer = mBuffers[ socket ];
+  buffer += socket->readAll();
+
+  int latency;
+  {
+    QMutexLocker locker( &mMutex );
+    latency = mLatency;
+  }
+
+  Request request;
+  while ( takeRequest( buffer, &request ) )
+  {
+    QByteArray reply = answer( request );
+    if ( latency <= 0 )
+    {
+      socket->write( reply );
+      continue;
+    }
+    mDelayed << qMakePair( QPointer<QTcpSocket>( socket ), reply );
+    QTimer::singleShot( latency, this, SLOT( sendDelayed() ) );
+  }
+}
+
+void QgsAuthSAML2MockServer::sendDelayed()
+{
+  // every answer waits the same time, they are due in the order they were queued
+  if ( mDelayed.isEmpty() )
+    return;
+  QPair<QPointer<QTcpSocket>, QByteArray> delayed = mDelayed.takeFirst();
+  if ( delayed.first )
+    delayed.first->write( delayed.second );
+}
+
+bool QgsAuthSAML2MockServer::takeRequest( QByteArray &buffer, Request *request )
+{
+  int headerEnd = buffer.indexOf( "\r\n\r\n" );
+  if ( headerEnd < 0 )
+    return false;
+
+  QList<QByteArray> lines = buffer.left( headerEnd ).split( '\n' );
+  QList<QByteArray> requestLine = lines.takeFirst().trimmed().split( ' ' );
+  if ( requestLine.size() < 2 )
+  {
+    buffer.clear();
+    return false;
+  }
+
+  Request parsed;
+  parsed.method = requestLine.at( 0 );
+  parsed.path = requestLine.at( 1 );
+  Q_FOREACH ( const QByteArray &line, lines )
+  {
+    int colon = line.indexOf( ':' );
+    if ( colon > 0 )
+      parsed.headers.insert( line.left( colon ).trimmed().toLower(), line.mid( colon + 1 ).trimmed() );
+  }
+
+  int length = parsed.headers.value( "content-length", "0" ).toInt();
+  if ( buffer.size() < headerEnd + 4 + length )
+    return false;
+
+  parsed.body = buffer.mid( headerEnd + 4, length );
+  buffer.remove( 0, headerEnd + 4 + length );
+  *request = parsed;
+  return true;
+}
+
+QByteArray QgsAuthSAML2MockServer::response( int status, const QByteArray &contentType, const QByteArray &body,
+    const QList<QByteArray> &extraHeaders )
+{
+  QByteArray reason = status == 200 ? "OK" : status == 302 ? "Found" : status == 401 ? "Unauthorized" : status == 404 ? "Not Found" : "Internal Server Error";
+  QByteArray result = "HTTP/1.1 " + QByteArray::number( status ) + ' ' + reason + "\r\n";
+  result += "Content-Type: " + contentType + "\r\n";
+  result += "Content-Length: " + QByteArray::number( body.size() ) + "\r\n";
+  result += "Cache-Control: private, no-store\r\n";
+  Q_FOREACH ( const QByteArray &header, extraHeaders )
+    result += header + "\r\n";
+  result += "\r\n";
+  result += body;
+  return result;
+}
+
+QByteArray QgsAuthSAML2MockServer::answer( const Request &request )
+{
+  const QByteArray path = request.path.left( request.path.indexOf( '?' ) == -1 ? request.path.size() : request.path.indexOf( '?' ) );
+
+  if ( request.method == "GET" && path == RESOURCE_PATH )
+  {
+    mResourceRequests.fetchAndAddRelaxed( 1 );
+    {
+      QMutexLocker locker( &mMutex );
+      Q_FOREACH ( const QString &value, cookieValues( request.headers.value( "cookie" ) ) )
+      {
+        if ( mSessions.contains( value ) )
+          return response( 200, "text/xml", "<WMS_Capabilities version=\"1.3.0\"><Service><Name>WMS</Name></Service></WMS_Capabilities>" );
+      }
+    }
+
+    if ( !request.headers.contains( "paos" ) || !request.headers.value( "accept" ).contains( "application/vnd.paos+xml" ) )
+      return response( 302, "text/html", QByteArray(), QList<QByteArray>() << "Location: https://idp.example.org/idp/profile/SAML2/Redirect/SSO" );
+
+    mChallenges.fetchAndAddRelaxed( 1 );
+    const QString relayState = QString( "ss:mem:%1" ).arg( mSerial.fetchAndAddRelaxed( 1 ) );
+    {
+      QMutexLocker locker( &mMutex );
+      mRelayStates.insert( relayState );
+    }
+    return response( 200, "application/vnd.paos+xml", spEnvelope( acsUrl().toString(), relayState ) );
+  }
+
+  if ( request.method == "POST" && path == IDP_PATH )
+  {
+    mIdpRequests.fetchAndAddRelaxed( 1 );
+    QMutexLocker locker( &mMutex );
+    if ( mIdpFailing )
+      return response( 500, "text/plain", "IdP unavailable" );
+
+    bool sso = false;
+    Q_FOREACH ( const QString &value, cookieValues( request.headers.value( "cookie" ) ) )
+      sso = sso || mIdpSessions.contains( value );
+
+    QList<QByteArray> headers;
+    if ( !sso )
+    {
+      const QByteArray expected = "Basic " + QByteArray( QByteArray( USERNAME ) + ':' + PASSWORD ).toBase64();
+      if ( request.headers.value( "authorization" ) != expected )
+        return response( 401, "text/plain", "Unauthorized", QList<QByteArray>() << "WWW-Authenticate: Basic realm=\"idp\"" );
+
+      mIdpLogins.fetchAndAddRelaxed( 1 );
+      int serial = mSerial.fetchAndAddRelaxed( 1 );
+      const QString session = QString::fromLatin1( filler( 24, serial ).toHex() ) + QString::number( serial );
+      mIdpSessions.insert( session );
+      headers << "Set-Cookie: shib_idp_session=" + session.toLatin1() + "; Path=/idp; HttpOnly";
+    }
+    return response( 200, "text/xml", idpEnvelope( acsUrl().toString() ), headers );
+  }
+
+  if ( request.method == "POST" && path == ACS_PATH )
+  {
+    QMutexLocker locker( &mMutex );
+    QString relayState;
+    int begin = request.body.indexOf( "RelayState" );
+    if ( begin >= 0 )
+    {
+      begin = request.body.indexOf( '>', begin ) + 1;
+      relayState = QString::fromUtf8( request.body.mid( begin, request.body.indexOf( '<', begin ) - begin ) );
+    }
+    if ( !mRelayStates.remove( relayState ) || !request.body.contains( "AuthnStatement" ) )
+      return response( 500, "text/plain", "Unsolicited response" );
+
+    int serial = mSerial.fetchAndAddRelaxed( 1 );
+    const QString session = QString::fromLatin1( filler( 24, serial ).toHex() ) + QString::number( serial );
+    mSessions.insert( session );
+    mSessionsIssued.fetchAndAddRelaxed( 1 );
+    return response( 302, "text/html", QByteArray(), QList<QByteArray>()
+                     << "Location: " + resourceUrl().toEncoded()
+                     << "Set-Cookie: _shibsession_" + QByteArray::number( serial ) + '=' + session.toLatin1() + "; Path=/; HttpOnly" );
+  }
+
+  return response( 404, "text/plain", "Not found" );
+}
@@ -0,0 +1,139 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#ifndef QGSAUTHSAML2MOCKSERVER_H
+#define QGSAUTHSAML2MOCKSERVER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QPointer>
+#include <QSet>
+#include <QString>
+#include <QTcpServer>
+#include <QUrl>
+
+class QTcpSocket;
+class QThread;
+
+/**
+ * SAML2 SP and IdP on the loopback interface, speaking PAOS/ECP over HTTP/1.1.
+ *
+ * One port serves both roles:
+ * - GET RESOURCE_PATH answers a request without session cookie that announces
+ *   PAOS with a signed AuthnRequest envelope, and the resource otherwise;
+ * - POST IDP_PATH checks the credentials or the SSO session cookie and answers
+ *   with a signed SAML response envelope;
+ * - POST ACS_PATH checks the RelayState and sets the session cookie.
+ *
+ * The server runs on a thread of its own, so requesting threads may block.
+ * Each answer can be delayed to stand in for real network latency.
+ */
+class QgsAuthSAML2MockServer : public QTcpServer
+{
+  Q_OBJECT
+
+public:
+  static const char *RESOURCE_PATH;
+  static const char *IDP_PATH;
+  static const char *ACS_PATH;
+  static const char *USERNAME;
+  static const char *PASSWORD;
+
+  QgsAuthSAML2MockServer();
+  ~QgsAuthSAML2MockServer();
+
+  /** Starts serving on a free loopback port, returns false if it could not listen */
+  bool start();
+
+  QUrl resourceUrl() const;
+  QUrl idpUrl() const;
+  QUrl acsUrl() const;
+
+  /** Delays every answer by msecs */
+  void setLatency( int msecs );
+
+  /** Makes the IdP answer with HTTP 500 instead of an assertion */
+  void setIdpFailing( bool failing );
+
+  int resourceRequests() const;
+  int challenges() const;
+  int idpRequests() const;
+  int idpLogins() const;
+  int sessionsIssued() const;
+
+  /** Forgets the sessions issued so far, the next requests are challenged again */
+  void dropSessions();
+
+  /** PAOS AuthnRequest envelope as a Shibboleth SP sends it, signed */
+  static QByteArray spEnvelope( const QString &acsUrl, const QString &relayState );
+
+  /** SAML response envelope as a Shibboleth IdP sends it, assertion signed */
+  static QByteArray idpEnvelope( const QString &acsUrl );
+
+private slots:
+  bool listenLocal();
+
+  void onNewConnection();
+
+  void onReadyRead();
+
+  void onDisconnected();
+
+  //! Writes a queued answer once its delay is over
+  void sendDelayed();
+
+private:
+  struct Request
+  {
+    QByteArray method;
+    QByteArray path;
+    QHash<QByteArray, QByteArray> headers;   //!< lower case names
+    QByteArray body;
+  };
+
+  //! Parses one request from the front of buffer; false until a whole one arrived
+  static bool takeRequest( QByteArray &buffer, Request *request );
+
+  QByteArray answer( const Request &request );
+
+  static QByteArray response( int status, const QByteArray &contentType, const QByteArray &body,
+                              const QList<QByteArray> &extraHeaders = QList<QByteArray>() );
+
+  QThread *mThread;
+  QUrl mBase;
+  int mLatency;
+  bool mIdpFailing;
+
+  QHash<QTcpSocket *, QByteArray> mBuffers;
+  QList<QPair<QPointer<QTcpSocket>, QByteArray> > mDelayed;
+
+  mutable QMutex mMutex;
+  QSet<QString> mRelayStates;
+  QSet<QString> mSessions;
+  QSet<QString> mIdpSessions;
+
+  QAtomicInt mSerial;
+  mutable QAtomicInt mResourceRequests;
+  mutable QAtomicInt mChallenges;
+  mutable QAtomicInt mIdpRequests;
+  mutable QAtomicInt mIdpLogins;
+  mutable QAtomicInt mSessionsIssued;
+};
+
+#endif // QGSAUTHSAML2MOCKSERVER_H
@@ -0,0 +1,265 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include "qgsauthsaml2cache.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSemaphore>
+#include <QStringList>
+#include <QThread>
+
+namespace
+{
+  typedef QgsAuthSAML2ShardedCache<QString> Cache;
+
+  // keys as updateNetworkRequest builds them: authcfg|scheme://host:port
+  QStringList sessionKeys( int count )
+  {
+    QStringList keys;
+    for ( int i = 0; i < count; ++i )
+      keys << QString( "%1|https://sp%2.example.org:443" ).arg( QString::number( 1000000 + i % 7, 36 ) ).arg( i );
+    return keys;
+  }
+
+  // lookups per thread in the benchmark, override with SAML2_BENCH_LOOKUPS
+  int benchLookups()
+  {
+    QByteArray count = qgetenv( "SAML2_BENCH_LOOKUPS" );
+    return count.isEmpty() ? 200000 : count.toInt();
+  }
+
+  //! What the cache replaced: one hash behind one mutex
+  class LockedHash
+  {
+    public:
+      void insert( const QString &key, const QString &value )
+      {
+        QMutexLocker locker( &mMutex );
+        mItems.insert( key, value );
+      }
+
+      bool lookup( const QString &key, QString *value ) const
+      {
+        QMutexLocker locker( &mMutex );
+        QHash<QString, QString>::const_iterator it = mItems.constFind( key );
+        if ( it == mItems.constEnd() )
+          return false;
+        *value = it.value();
+        return true;
+      }
+
+    private:
+      mutable QMutex mMutex;
+      QHash<QString, QString> mItems;
+  };
+
+  /**
+   * Looks up keys round robin, starting at an offset of its own so the
+   * threads do not walk the shards in lock step. Every 1000th call is an
+   * insert when a writer, the way a login publishes a session.
+   */
+  template <typename C>
+  class LookupThread : public QThread
+  {
+    public:
+      LookupThread( C *cache, const QStringList &keys, int lookups, int offset, bool writer, QSemaphore *gate )
+        : mCache( cache )
+        , mKeys( keys )
+        , mLookups( lookups )
+        , mOffset( offset )
+        , mWriter( writer )
+        , mGate( gate )
+        , mHits( 0 )
+      {}
+
+      int hits() const { return mHits; }
+
+    protected:
+      void run() override
+      {
+        mGate->acquire();
+        QString value;
+        for ( int i = 0; i < mLookups; ++i )
+        {
+          const QString &key = mKeys.at( ( mOffset + i ) % mKeys.size() );
+          if ( mWriter && i % 1000 == 0 )
+            mCache->insert( key, key );
+          else if ( mCache->lookup( key, &value ) )
+            ++mHits;
+        }
+      }
+
+    private:
+      C *mCache;
+      QStringList mKeys;
+      int mLookups;
+      int mOffset;
+      bool mWriter;
+      QSemaphore *mGate;
+      int mHits;
+  };
+
+  //! Runs threads lookup threads against cache, returns lookups per second
+  template <typename C>
+  double lookupsPerSecond( C *cache, const QStringList &keys, int threads, int lookups, bool writers )
+  {
+    QSemaphore gate;
+    QList<LookupThread<C> *> workers;
+    for ( int i = 0; i < threads; ++i )
+    {
+      workers << new LookupThread<C>( cache, keys, lookups, i * keys.size() / threads, writers, &gate );
+      workers.last()->start();
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    gate.release( threads );
+    Q_FOREACH ( LookupThread<C> *worker, workers )
+      worker->wait();
+    qint64 elapsed = qMax( qint64( 1 ), timer.elapsed() );
+
+    qDeleteAll( workers );
+    return 1000.0 * threads * lookups / elapsed;
+  }
+}
+
+/**
+ * QgsAuthSAML2ShardedCache, and a benchmark of its lookups per second from
+ * 1 to 32 threads next to a mutex guarded QHash.
+ */
+class TestQgsAuthSAML2Cache : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void insertLookupRemove();
+    void capacityEvictsLeastRecentlyUsed();
+    void snapshotAndClear();
+
+    void benchLookups_data();
+    void benchLookups();
+};
+
+void TestQgsAuthSAML2Cache::insertLookupRemove()
+{
+  Cache cache;
+  QString value;
+  QVERIFY( !cache.lookup( "a", &value ) );
+
+  cache.insert( "a", "1" );
+  cache.insert( "b", "2" );
+  QVERIFY( cache.lookup( "a", &value ) );
+  QCOMPARE( value, QString( "1" ) );
+  QVERIFY( cache.contains( "b" ) );
+  QCOMPARE( cache.value( "c", "none" ), QString( "none" ) );
+
+  cache.insert( "a", "3" );
+  QCOMPARE( cache.value( "a" ), QString( "3" ) );
+  QCOMPARE( cache.size(), 2 );
+
+  QVERIFY( cache.remove( "a" ) );
+  QVERIFY( !cache.remove( "a" ) );
+  QVERIFY( !cache.contains( "a" ) );
+  QCOMPARE( cache.size(), 1 );
+}
+
+void TestQgsAuthSAML2Cache::capacityEvictsLeastRecentlyUsed()
+{
+  // one shard, so the bound is exact
+  QgsAuthSAML2ShardedCache<int, 1> cache;
+  cache.setCapacity( 3 );
+  cache.insert( "a", 1 );
+  cache.insert( "b", 2 );
+  cache.insert( "c", 3 );
+
+  // a was looked up last, b is now the least recently used
+  QVERIFY( cache.contains( "a" ) );
+  cache.insert( "d", 4 );
+
+  QCOMPARE( cache.size(), 3 );
+  QVERIFY( cache.contains( "a" ) );
+  QVERIFY( !cache.contains( "b" ) );
+  QVERIFY( cache.contains( "c" ) );
+  QVERIFY( cache.contains( "d" ) );
+
+  Cache sharded;
+  sharded.setCapacity( 64 );
+  Q_FOREACH ( const QString &key, sessionKeys( 1000 ) )
+    sharded.insert( key, key );
+  QVERIFY( sharded.size() <= 64 );
+}
+
+void TestQgsAuthSAML2Cache::snapshotAndClear()
+{
+  Cache cache;
+  const QStringList keys = sessionKeys( 100 );
+  Q_FOREACH ( const QString &key, keys )
+    cache.insert( key, key.toUpper() );
+
+  QHash<QString, QString> snapshot = cache.snapshot();
+  QCOMPARE( snapshot.size(), keys.size() );
+  Q_FOREACH ( const QString &key, keys )
+    QCOMPARE( snapshot.value( key ), key.toUpper() );
+
+  cache.clear();
+  QCOMPARE( cache.size(), 0 );
+  QVERIFY( cache.snapshot().isEmpty() );
+}
+
+void TestQgsAuthSAML2Cache::benchLookups_data()
+{
+  QTest::addColumn<int>( "threads" );
+  QTest::addColumn<bool>( "writers" );
+  const int threads[] = { 1, 2, 4, 8, 16, 32 };
+  for ( unsigned i = 0; i < sizeof( threads ) / sizeof( threads[0] ); ++i )
+  {
+    QTest::newRow( qPrintable( QString( "%1 threads, read only" ).arg( threads[i] ) ) ) << threads[i] << false;
+    QTest::newRow( qPrintable( QString( "%1 threads, 0.1% inserts" ).arg( threads[i] ) ) ) << threads[i] << true;
+  }
+}
+
+void TestQgsAuthSAML2Cache::benchLookups()
+{
+  QFETCH( int, threads );
+  QFETCH( bool, writers );
+  const int lookups = benchLookups();
+  const QStringList keys = sessionKeys( 256 );
+
+  Cache cache;
+  LockedHash locked;
+  Q_FOREACH ( const QString &key, keys )
+  {
+    cache.insert( key, key );
+    locked.insert( key, key );
+  }
+
+  double sharded = 0;
+  QBENCHMARK_ONCE
+  {
+    sharded = lookupsPerSecond( &cache, keys, threads, lookups, writers );
+  }
+  double mutex = lookupsPerSecond( &locked, keys, threads, lookups, writers );
+
+  qDebug( "%d threads%s: sharded cache %.0f lookups/s, mutex guarded QHash %.0f lookups/s",
+          threads, writers ? " with inserts" : "", sharded, mutex );
+}
+
+QTEST_APPLESS_MAIN( TestQgsAuthSAML2Cache )
+#include "testqgsauthsaml2cache.moc"
@@ -0,0 +1,138 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include "qgsauthsaml2cookies.h"
+
+namespace
+{
+  QNetworkCookie cookie( const QByteArray &name, const QString &domain = QString(), const QString &path = QString() )
+  {
+    QNetworkCookie result( name, "value-of-" + name );
+    result.setDomain( domain );
+    result.setPath( path );
+    return result;
+  }
+
+  QStringList names( const QList<QNetworkCookie> &cookies )
+  {
+    QStringList result;
+    Q_FOREACH ( const QNetworkCookie &cookie, cookies )
+      result << QString::fromLatin1( cookie.name() );
+    return result;
+  }
+}
+
+/**
+ * Scoping of the SP session cookies after RFC 6265.
+ */
+class TestQgsAuthSAML2Cookies : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void defaultsDomainAndPath();
+    void dropsForeignDomains();
+    void rejectsPublicSuffixes();
+    void matchesDomainPathAndScheme();
+    void mergeReplacesAndExpires();
+};
+
+void TestQgsAuthSAML2Cookies::defaultsDomainAndPath()
+{
+  QList<QNetworkCookie> cookies = QgsAuthSAML2Cookies::normalized(
+                                    QList<QNetworkCookie>() << cookie( "host" ) << cookie( "domain", "example.org", "/ows" ),
+                                    QUrl( "https://sp.example.org/Shibboleth.sso/SAML2/ECP" ) );
+
+  QCOMPARE( cookies.size(), 2 );
+  QCOMPARE( cookies.at( 0 ).domain(), QString( "sp.example.org" ) );
+  QCOMPARE( cookies.at( 0 ).path(), QString( "/Shibboleth.sso/SAML2" ) );
+  QCOMPARE( cookies.at( 1 ).domain(), QString( ".example.org" ) );
+  QCOMPARE( cookies.at( 1 ).path(), QString( "/ows" ) );
+}
+
+void TestQgsAuthSAML2Cookies::dropsForeignDomains()
+{
+  QList<QNetworkCookie> cookies = QgsAuthSAML2Cookies::normalized(
+                                    QList<QNetworkCookie>() << cookie( "other", "example.com" ) << cookie( "child", "maps.sp.example.org" ),
+                                    QUrl( "https://sp.example.org/" ) );
+  QVERIFY( cookies.isEmpty() );
+}
+
+void TestQgsAuthSAML2Cookies::rejectsPublicSuffixes()
+{
+  const QUrl origin( "https://sp.example.co.uk/Shibboleth.sso/SAML2/ECP" );
+  QList<QNetworkCookie> cookies = QgsAuthSAML2Cookies::normalized( QList<QNetworkCookie>()
+                                  << cookie( "tld", "uk" )
+                                  << cookie( "registry", ".co.uk" )
+                                  << cookie( "site", "example.co.uk" ),
+                                  origin );
+  QCOMPARE( names( cookies ), QStringList() << "site" );
+  QCOMPARE( cookies.at( 0 ).domain(), QString( ".example.co.uk" ) );
+
+  cookies = QgsAuthSAML2Cookies::normalized( QList<QNetworkCookie>() << cookie( "registry", "com.au" ), QUrl( "https://sp.example.com.au/" ) );
+  QVERIFY( cookies.isEmpty() );
+
+  // the host itself may name its own domain, the cookie stays with the host
+  cookies = QgsAuthSAML2Cookies::normalized( QList<QNetworkCookie>() << cookie( "local", "localhost" ), QUrl( "http://localhost:8080/" ) );
+  QCOMPARE( names( cookies ), QStringList() << "local" );
+  QCOMPARE( cookies.at( 0 ).domain(), QString( "localhost" ) );
+  QVERIFY( QgsAuthSAML2Cookies::matching( cookies, QUrl( "http://sub.localhost/" ), QDateTime::currentDateTimeUtc() ).isEmpty() );
+}
+
+void TestQgsAuthSAML2Cookies::matchesDomainPathAndScheme()
+{
+  QNetworkCookie secure = cookie( "secure", "example.org", "/" );
+  secure.setSecure( true );
+  QList<QNetworkCookie> cookies = QgsAuthSAML2Cookies::normalized( QList<QNetworkCookie>()
+                                  << cookie( "host", QString(), "/ows" )
+                                  << cookie( "domain", "example.org", "/" )
+                                  << secure,
+                                  QUrl( "https://sp.example.org/ows/wms" ) );
+  const QDateTime now = QDateTime::currentDateTimeUtc();
+
+  QCOMPARE( names( QgsAuthSAML2Cookies::matching( cookies, QUrl( "https://sp.example.org/ows/wms?REQUEST=GetMap" ), now ) ),
+            QStringList() << "host" << "domain" << "secure" );
+  QCOMPARE( names( QgsAuthSAML2Cookies::matching( cookies, QUrl( "http://sp.example.org/owsx" ), now ) ),
+            QStringList() << "domain" );
+  QCOMPARE( names( QgsAuthSAML2Cookies::matching( cookies, QUrl( "https://maps.example.org/ows" ), now ) ),
+            QStringList() << "domain" << "secure" );
+  QVERIFY( QgsAuthSAML2Cookies::matching( cookies, QUrl( "https://example.com/" ), now ).isEmpty() );
+}
+
+void TestQgsAuthSAML2Cookies::mergeReplacesAndExpires()
+{
+  const QDateTime now = QDateTime::currentDateTimeUtc();
+  QList<QNetworkCookie> session = QgsAuthSAML2Cookies::normalized( QList<QNetworkCookie>()
+                                  << cookie( "a", QString(), "/" ) << cookie( "b", QString(), "/" ),
+                                  QUrl( "https://sp.example.org/" ) );
+
+  QNetworkCookie renewed = session.at( 0 );
+  renewed.setValue( "renewed" );
+  QNetworkCookie deleted = session.at( 1 );
+  deleted.setExpirationDate( now.addSecs( -1 ) );
+  QgsAuthSAML2Cookies::merge( session, QList<QNetworkCookie>() << renewed << deleted, now );
+
+  QCOMPARE( session.size(), 1 );
+  QCOMPARE( session.at( 0 ).value(), QByteArray( "renewed" ) );
+  QVERIFY( QgsAuthSAML2Cookies::containsAll( session, QList<QNetworkCookie>() << renewed ) );
+
+  QgsAuthSAML2Cookies::remove( session, QList<QNetworkCookie>() << renewed );
+  QVERIFY( session.isEmpty() );
+}
+
+QTEST_APPLESS_MAIN( TestQgsAuthSAML2Cookies )
+#include "testqgsauthsaml2cookies.moc"
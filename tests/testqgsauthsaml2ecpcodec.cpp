@@ -0,0 +1,256 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include "qgsauthsaml2ecpcodec.h"
+#include "qgsauthsaml2mockserver.h"
+
+#include <QDomDocument>
+#include <QDomElement>
+#include <QDomNodeList>
+
+namespace
+{
+  const char *nsSOAP = "http://schemas.xmlsoap.org/soap/envelope/";
+  const char *nsECP = "urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp";
+  const char *ACS_URL = "https://sp.example.org/Shibboleth.sso/SAML2/ECP";
+  const char *RELAY_STATE = "ss:mem:4711";
+
+  /*
+   * The DOM path the codec replaced, as updateNetworkRequest ran it: a full
+   * QDomDocument per envelope, linear namedItemNS scans, and edits of copies
+   * of the raw bytes found with indexOf( "Header>" ).
+   */
+
+  QDomNode namedItemNS( const QDomNodeList &nodes, const char *nsURI, const char *localName )
+  {
+    QDomNode n;
+    int ix, count = nodes.count();
+    for ( ix = 0; ix < count; ix++ )
+    {
+      n = nodes.at( ix );
+      if ( ( n.localName() == localName ) && ( n.namespaceURI() == nsURI ) )
+        return n;
+    }
+    return QDomNode();
+  }
+
+  //! Reads RelayState and the ACS URL of the SP envelope, returns the envelope for the IdP
+  QByteArray domIdpRequest( const QByteArray &spECPResponse, QString *rsValue, QString *acsURL )
+  {
+    QDomDocument docFromSP;
+    if ( !docFromSP.setContent( spECPResponse, true ) )
+      return QByteArray();
+
+    QDomNode headerNode = namedItemNS( docFromSP.documentElement().childNodes(), nsSOAP, "Header" );
+    QDomNode bodyNode = namedItemNS( docFromSP.documentElement().childNodes(), nsSOAP, "Body" );
+    QDomNode relayState = namedItemNS( headerNode.childNodes(), nsECP, "RelayState" );
+    *rsValue = relayState.toElement().text();
+    QDomNode authnRequest = namedItemNS( bodyNode.childNodes(), "urn:oasis:names:tc:SAML:2.0:protocol", "AuthnRequest" );
+    *acsURL = authnRequest.toElement().attribute( "AssertionConsumerServiceURL" );
+
+    QByteArray dataToIdP = spECPResponse;
+    int ix1 = dataToIdP.indexOf( "Header>" ) + 7;
+    int ix2 = dataToIdP.indexOf( "Header>", ix1 ) + 7;
+    dataToIdP.remove( ix1, ix2 - ix1 );
+    dataToIdP.insert( ix1 - 1, '/' );
+    return dataToIdP;
+  }
+
+  //! Returns the IdP envelope with RelayState added to its header, for the SP
+  QByteArray domSpResponse( const QByteArray &idpECPResponse, const QString &rsValue )
+  {
+    QDomDocument docFromIdP;
+    if ( !docFromIdP.setContent( idpECPResponse, true ) )
+      return QByteArray();
+
+    QByteArray dataToSP = idpECPResponse;
+    QDomNode headerNode = namedItemNS( docFromIdP.documentElement().childNodes(), nsSOAP, "Header" );
+    QString relayState = QString( "<ecp:RelayState xmlns:ecp=\"urn:oasis:names:tc:SAML:2.0:profiles:SSO:ecp\" " + headerNode.prefix() + ":actor=\"http://schemas.xmlsoap.org/soap/actor/next\" " + headerNode.prefix() + ":mustUnderstand=\"1\">" + rsValue + "</ecp:RelayState>" );
+    dataToSP.replace( QString( "<%1:Header>" ).arg( headerNode.prefix() ).toLatin1().data(), QString( "<%1:Header>%2" ).arg( headerNode.prefix(), relayState ).toLatin1().data() );
+    return dataToSP;
+  }
+
+  //! The bytes from the SOAP body on, which carry the signatures
+  QByteArray signedPart( const QByteArray &envelope )
+  {
+    return envelope.mid( envelope.indexOf( ":Body>" ) );
+  }
+}
+
+/**
+ * QgsAuthSAML2EcpCodec on the envelopes of the mock SP and IdP, and a
+ * benchmark of each handshake leg with the codec next to the DOM path it
+ * replaced.
+ */
+class TestQgsAuthSAML2EcpCodec : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void parseSpRequest();
+    void idpRequestMatchesDomPath();
+    void parseIdpResponse();
+    void spResponseMatchesDomPath();
+    void spResponseAddsMissingHeader();
+    void rejectsGarbage();
+
+    void benchLegs_data();
+    void benchLegs();
+};
+
+void TestQgsAuthSAML2EcpCodec::parseSpRequest()
+{
+  QgsAuthSAML2EcpCodec::SpRequest request;
+  QString error;
+  QVERIFY2( QgsAuthSAML2EcpCodec::parseSpRequest( QgsAuthSAML2MockServer::spEnvelope( ACS_URL, RELAY_STATE ), request, &error ), qPrintable( error ) );
+  QVERIFY( request.isEcp );
+  QCOMPARE( request.relayState, QString( RELAY_STATE ) );
+  QCOMPARE( request.acsUrl, QString( ACS_URL ) );
+  QCOMPARE( request.responseConsumerUrl, QString( ACS_URL ) );
+  QVERIFY( request.headerTagEnd > 0 );
+  QVERIFY( request.headerEnd > request.headerTagEnd );
+}
+
+void TestQgsAuthSAML2EcpCodec::idpRequestMatchesDomPath()
+{
+  const QByteArray envelope = QgsAuthSAML2MockServer::spEnvelope( ACS_URL, RELAY_STATE );
+  QgsAuthSAML2EcpCodec::SpRequest request;
+  QVERIFY( QgsAuthSAML2EcpCodec::parseSpRequest( envelope, request ) );
+  const QByteArray relayed = QgsAuthSAML2EcpCodec::idpRequest( envelope, request );
+
+  QString relayState;
+  QString acsUrl;
+  QCOMPARE( relayed, domIdpRequest( envelope, &relayState, &acsUrl ) );
+  QCOMPARE( request.relayState, relayState );
+  QCOMPARE( request.acsUrl, acsUrl );
+
+  QVERIFY( relayed.contains( "<S:Header/>" ) );
+  QVERIFY( !relayed.contains( "RelayState" ) );
+  QCOMPARE( signedPart( relayed ), signedPart( envelope ) );
+}
+
+void TestQgsAuthSAML2EcpCodec::parseIdpResponse()
+{
+  QgsAuthSAML2EcpCodec::IdpResponse response;
+  QString error;
+  QVERIFY2( QgsAuthSAML2EcpCodec::parseIdpResponse( QgsAuthSAML2MockServer::idpEnvelope( ACS_URL ), response, &error ), qPrintable( error ) );
+  QCOMPARE( response.acsUrl, QString( ACS_URL ) );
+  QCOMPARE( response.envelopePrefix, QString( "soap11" ) );
+  QCOMPARE( response.headerPrefix, QString( "soap11" ) );
+  QVERIFY( !response.headerSelfClosed );
+  QVERIFY( response.bodyBegin > response.headerTagEnd );
+  QVERIFY( response.sessionNotOnOrAfter.isValid() );
+  QVERIFY( response.sessionNotOnOrAfter > QDateTime::currentDateTimeUtc() );
+}
+
+void TestQgsAuthSAML2EcpCodec::spResponseMatchesDomPath()
+{
+  const QByteArray envelope = QgsAuthSAML2MockServer::idpEnvelope( ACS_URL );
+  QgsAuthSAML2EcpCodec::IdpResponse response;
+  QVERIFY( QgsAuthSAML2EcpCodec::parseIdpResponse( envelope, response ) );
+  const QByteArray posted = QgsAuthSAML2EcpCodec::spResponse( envelope, response, RELAY_STATE );
+
+  QCOMPARE( posted, domSpResponse( envelope, RELAY_STATE ) );
+  QCOMPARE( signedPart( posted ), signedPart( envelope ) );
+
+  // the SP reads the RelayState back from the header
+  QgsAuthSAML2EcpCodec::SpRequest request;
+  QVERIFY( QgsAuthSAML2EcpCodec::parseSpRequest( posted, request ) );
+  QCOMPARE( request.relayState, QString( RELAY_STATE ) );
+}
+
+void TestQgsAuthSAML2EcpCodec::spResponseAddsMissingHeader()
+{
+  // an IdP may leave the header out; the DOM path then posted no RelayState at all
+  QByteArray envelope = QgsAuthSAML2MockServer::idpEnvelope( ACS_URL );
+  int begin = envelope.indexOf( "<soap11:Header>" );
+  int end = envelope.indexOf( "</soap11:Header>" ) + int( qstrlen( "</soap11:Header>" ) );
+  envelope.remove( begin, end - begin );
+
+  QgsAuthSAML2EcpCodec::IdpResponse response;
+  QVERIFY( QgsAuthSAML2EcpCodec::parseIdpResponse( envelope, response ) );
+  QCOMPARE( response.headerTagEnd, -1 );
+  const QByteArray posted = QgsAuthSAML2EcpCodec::spResponse( envelope, response, RELAY_STATE );
+
+  QVERIFY( posted.contains( "<soap11:Header><ecp:RelayState" ) );
+  QCOMPARE( signedPart( posted ), signedPart( envelope ) );
+  QDomDocument doc;
+  QVERIFY( doc.setContent( posted, true ) );
+}
+
+void TestQgsAuthSAML2EcpCodec::rejectsGarbage()
+{
+  QgsAuthSAML2EcpCodec::SpRequest request;
+  QString error;
+  QVERIFY( !QgsAuthSAML2EcpCodec::parseSpRequest( "<html><body>Login</body></html>", request, &error ) );
+  QVERIFY( !error.isEmpty() );
+
+  QgsAuthSAML2EcpCodec::IdpResponse response;
+  QVERIFY( !QgsAuthSAML2EcpCodec::parseIdpResponse( "<S:Envelope xmlns:S=\"http://schemas.xmlsoap.org/soap/envelope/\"><S:Bo", response, &error ) );
+}
+
+void TestQgsAuthSAML2EcpCodec::benchLegs_data()
+{
+  QTest::addColumn<bool>( "stream" );
+  QTest::addColumn<bool>( "idpLeg" );
+  QTest::newRow( "SP envelope, DOM" ) << false << false;
+  QTest::newRow( "SP envelope, stream codec" ) << true << false;
+  QTest::newRow( "IdP envelope, DOM" ) << false << true;
+  QTest::newRow( "IdP envelope, stream codec" ) << true << true;
+}
+
+void TestQgsAuthSAML2EcpCodec::benchLegs()
+{
+  QFETCH( bool, stream );
+  QFETCH( bool, idpLeg );
+  const QByteArray spEnvelope = QgsAuthSAML2MockServer::spEnvelope( ACS_URL, RELAY_STATE );
+  const QByteArray idpEnvelope = QgsAuthSAML2MockServer::idpEnvelope( ACS_URL );
+
+  QByteArray result;
+  if ( !idpLeg && !stream )
+  {
+    QString relayState;
+    QString acsUrl;
+    QBENCHMARK { result = domIdpRequest( spEnvelope, &relayState, &acsUrl ); }
+  }
+  else if ( !idpLeg )
+  {
+    QBENCHMARK
+    {
+      QgsAuthSAML2EcpCodec::SpRequest request;
+      QgsAuthSAML2EcpCodec::parseSpRequest( spEnvelope, request );
+      result = QgsAuthSAML2EcpCodec::idpRequest( spEnvelope, request );
+    }
+  }
+  else if ( !stream )
+  {
+    QBENCHMARK { result = domSpResponse( idpEnvelope, RELAY_STATE ); }
+  }
+  else
+  {
+    QBENCHMARK
+    {
+      QgsAuthSAML2EcpCodec::IdpResponse response;
+      QgsAuthSAML2EcpCodec::parseIdpResponse( idpEnvelope, response );
+      result = QgsAuthSAML2EcpCodec::spResponse( idpEnvelope, response, RELAY_STATE );
+    }
+  }
+  QVERIFY( !result.isEmpty() );
+}
+
+QTEST_APPLESS_MAIN( TestQgsAuthSAML2EcpCodec )
+#include "testqgsauthsaml2ecpcodec.moc"
@@ -0,0 +1,469 @@
+/***************************************************************************
+    begin                : October 17, 2026
+    copyright            : (C) 2026 by Secure Dimensions GmbH, Germany
+    author               : Andreas Matheus, Secure Dimensions GmbH
+    email                : am at secure-dimensions dot de
+ ***************************************************************************
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ ***************************************************************************/
+
+
+#include <QtTest/QtTest>
+
+#include "qgsauthsaml2handshake.h"
+#include "qgsauthsaml2method.h"
+#include "qgsauthsaml2mockserver.h"
+#include "qgsapplication.h"
+#include "qgsauthmanager.h"
+#include "qgsnetworkaccessmanager.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QNetworkCookie>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QSemaphore>
+#include <QThread>
+#include <QVector>
+
+#include <algorithm>
+
+#ifdef Q_OS_LINUX
+#include <unistd.h>
+#endif
+
+#if QT_VERSION >= 0x050000
+#define SAML2_SKIP( message ) QSKIP( message )
+#else
+#define SAML2_SKIP( message ) QSKIP( message, SkipAll )
+#endif
+
+namespace
+{
+  // the benchmarks run this many handshakes, override with SAML2_BENCH_HANDSHAKES
+  int benchHandshakes()
+  {
+    QByteArray count = qgetenv( "SAML2_BENCH_HANDSHAKES" );
+    return count.isEmpty() ? 200 : count.toInt();
+  }
+
+  // msecs the mock servers take for each answer, override with SAML2_MOCK_LATENCY
+  int mockLatency()
+  {
+    return qgetenv( "SAML2_MOCK_LATENCY" ).toInt();
+  }
+
+  QList<QNetworkCookie> requestCookies( const QNetworkRequest &request )
+  {
+    return qvariant_cast<QList<QNetworkCookie> >( request.header( QNetworkRequest::CookieHeader ) );
+  }
+
+  // handshakes of the long run; it only runs when SAML2_LONGRUN_HANDSHAKES is set
+  int longRunHandshakes()
+  {
+    return qgetenv( "SAML2_LONGRUN_HANDSHAKES" ).toInt();
+  }
+
+  // resident set size in bytes, -1 where /proc is not available
+  qint64 residentBytes()
+  {
+#ifdef Q_OS_LINUX
+    QFile statm( "/proc/self/statm" );
+    if ( !statm.open( QIODevice::ReadOnly ) )
+      return -1;
+    QList<QByteArray> pages = statm.readAll().split( ' ' );
+    if ( pages.size() < 2 )
+      return -1;
+    return pages.at( 1 ).toLongLong() * sysconf( _SC_PAGESIZE );
+#else
+    return -1;
+#endif
+  }
+
+  qint64 percentile( QVector<qint64> samples, int percent )
+  {
+    if ( samples.isEmpty() )
+      return 0;
+    std::sort( samples.begin(), samples.end() );
+    return samples.at( qMin( samples.size() - 1, samples.size() * percent / 100 ) );
+  }
+
+  /**
+   * Sends requests through a method from a thread of its own, the way the
+   * rendering threads of QGIS do. With a gate, the thread takes one of its
+   * permits before the first request, so many threads can be let go at once.
+   */
+  class RequestThread : public QThread
+  {
+    public:
+      RequestThread( QgsAuthSAML2Method *method, const QString &authcfg, const QUrl &url, int requests, QSemaphore *gate = nullptr )
+        : mMethod( method )
+        , mAuthcfg( authcfg )
+        , mUrl( url )
+        , mRequests( requests )
+        , mGate( gate )
+        , mUpdated( 0 )
+        , mAuthenticated( 0 )
+      {}
+
+      int updated() const { return mUpdated; }
+      int authenticated() const { return mAuthenticated; }
+
+    protected:
+      void run() override
+      {
+        if ( mGate )
+          mGate->acquire();
+
+        for ( int i = 0; i < mRequests; ++i )
+        {
+          QNetworkRequest request( mUrl );
+          if ( !mMethod->updateNetworkRequest( request, mAuthcfg ) )
+            continue;
+          ++mUpdated;
+          if ( !requestCookies( request ).isEmpty() )
+            ++mAuthenticated;
+        }
+      }
+
+    private:
+      QgsAuthSAML2Method *mMethod;
+      QString mAuthcfg;
+      QUrl mUrl;
+      int mRequests;
+      QSemaphore *mGate;
+      int mUpdated;
+      int mAuthenticated;
+  };
+
+  // simultaneous requests in the concurrency tests, override with SAML2_CONCURRENT_REQUESTS
+  int concurrentRequests()
+  {
+    QByteArray count = qgetenv( "SAML2_CONCURRENT_REQUESTS" );
+    return count.isEmpty() ? 300 : count.toInt();
+  }
+
+  // the handshake of the concurrency tests lasts at least this long, so every released thread joins it
+  const int CONCURRENT_LATENCY = 100;
+}
+
+/**
+ * ECP logins of QgsAuthSAML2Method against the mock SP and IdP, the single
+ * handshake that concurrent requests share, and benchmarks of
+ * updateNetworkRequest: handshakes per second with their p50 and p99
+ * latency, and session hits per second across threads. An opt-in long run
+ * checks that resident memory stays flat over many handshakes.
+ */
+class TestQgsAuthSAML2Handshake : public QObject
+{
+  Q_OBJECT
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void init();
+    void cleanup();
+
+    void loginSetsSessionCookies();
+    void sessionIsReused();
+    void concurrentRequestsShareHandshake();
+    void concurrentRequestsShareFailure();
+
+    void benchHandshakes();
+    void longRunKeepsMemoryFlat();
+    void benchSessionHits_data();
+    void benchSessionHits();
+
+  private:
+    QString mTempDir;
+    QString mAuthcfg;
+    QgsAuthSAML2MockServer *mServer;
+    QgsAuthSAML2Method *mMethod;
+
+    //! Lets count threads with one request each go at once, returns them finished
+    QList<RequestThread *> fireConcurrently( int count );
+};
+
+void TestQgsAuthSAML2Handshake::initTestCase()
+{
+  mServer = nullptr;
+  mMethod = nullptr;
+
+  // settings and auth database of their own, the user's stay untouched
+  mTempDir = QDir::tempPath() + QString( "/qgis_saml2_test_%1" ).arg( QCoreApplication::applicationPid() );
+  QDir().mkpath( mTempDir );
+  qputenv( "QGIS_AUTH_DB_DIR_PATH", QFile::encodeName( mTempDir ) );
+  QCoreApplication::setOrganizationName( "QGIS" );
+  QCoreApplication::setOrganizationDomain( "qgis.org" );
+  QCoreApplication::setApplicationName( "QGIS-TEST-SAML2" );
+
+  QgsApplication::init( mTempDir );
+  QgsApplication::initQgis();
+
+  if ( QgsAuthManager::instance()->isDisabled() )
+    SAML2_SKIP( "The auth database is disabled, the qca-ossl plugin is missing" );
+  QVERIFY( QgsAuthManager::instance()->setMasterPassword( "saml2test", true ) );
+
+  mServer = new QgsAuthSAML2MockServer();
+  QVERIFY( mServer->start() );
+  mServer->setLatency( mockLatency() );
+
+  QgsAuthMethodConfig config( "SAML2", 1 );
+  config.setName( "SAML2 mock IdP" );
+  config.setConfig( "providerurl", mServer->idpUrl().toString() );
+  config.setConfig( "username", QgsAuthSAML2MockServer::USERNAME );
+  config.setConfig( "password", QgsAuthSAML2MockServer::PASSWORD );
+  QVERIFY( QgsAuthManager::instance()->storeAuthenticationConfig( config ) );
+  mAuthcfg = config.id();
+}
+
+void TestQgsAuthSAML2Handshake::cleanupTestCase()
+{
+  QgsAuthSAML2Handshake::shutdownWorker();
+  delete mServer;
+  QgsApplication::exitQgis();
+#if QT_VERSION >= 0x050000
+  QDir( mTempDir ).removeRecursively();
+#endif
+}
+
+void TestQgsAuthSAML2Handshake::init()
+{
+  // a method without sessions, the way QGIS starts
+  mMethod = new QgsAuthSAML2Method();
+  mServer->dropSessions();
+}
+
+void TestQgsAuthSAML2Handshake::cleanup()
+{
+  delete mMethod;
+  mMethod = nullptr;
+  mServer->setIdpFailing( false );
+  mServer->setLatency( mockLatency() );
+}
+
+QList<RequestThread *> TestQgsAuthSAML2Handshake::fireConcurrently( int count )
+{
+  QSemaphore gate;
+  QList<RequestThread *> workers;
+  for ( int i = 0; i < count; ++i )
+  {
+    RequestThread *worker = new RequestThread( mMethod, mAuthcfg, mServer->resourceUrl(), 1, &gate );
+    worker->start();
+    workers << worker;
+  }
+
+  gate.release( count );
+  Q_FOREACH ( RequestThread *worker, workers )
+    worker->wait();
+  return workers;
+}
+
+void TestQgsAuthSAML2Handshake::loginSetsSessionCookies()
+{
+  int challenges = mServer->challenges();
+  int sessions = mServer->sessionsIssued();
+
+  QNetworkRequest request( mServer->resourceUrl() );
+  QVERIFY( mMethod->updateNetworkRequest( request, mAuthcfg ) );
+  QVERIFY( !requestCookies( request ).isEmpty() );
+  QCOMPARE( mServer->challenges(), challenges + 1 );
+  QCOMPARE( mServer->sessionsIssued(), sessions + 1 );
+
+  // the SP serves the resource with the session, without a PAOS header
+  QNetworkRequest resource( mServer->resourceUrl() );
+  resource.setHeader( QNetworkRequest::CookieHeader, request.header( QNetworkRequest::CookieHeader ) );
+  resource.setAttribute( QNetworkRequest::CookieLoadControlAttribute, QNetworkRequest::Manual );
+  QNetworkReply *reply = QgsNetworkAccessManager::instance()->get( resource );
+  QEventLoop loop;
+  connect( reply, SIGNAL( finished() ), &loop, SLOT( quit() ) );
+  loop.exec();
+  QCOMPARE( reply->attribute( QNetworkRequest::HttpStatusCodeAttribute ).toInt(), 200 );
+  QVERIFY( reply->readAll().contains( "WMS_Capabilities" ) );
+  reply->deleteLater();
+}
+
+void TestQgsAuthSAML2Handshake::sessionIsReused()
+{
+  QNetworkRequest first( mServer->resourceUrl() );
+  QVERIFY( mMethod->updateNetworkRequest( first, mAuthcfg ) );
+  int challenges = mServer->challenges();
+
+  for ( int i = 0; i < 10; ++i )
+  {
+    QNetworkRequest request( mServer->resourceUrl() );
+    QVERIFY( mMethod->updateNetworkRequest( request, mAuthcfg ) );
+    QCOMPARE( requestCookies( request ), requestCookies( first ) );
+  }
+  QCOMPARE( mServer->challenges(), challenges );
+}
+
+void TestQgsAuthSAML2Handshake::concurrentRequestsShareHandshake()
+{
+  const int count = concurrentRequests();
+  mServer->setLatency( qMax( mockLatency(), CONCURRENT_LATENCY ) );
+  int challenges = mServer->challenges();
+  int idpLogins = mServer->idpLogins();
+  int sessions = mServer->sessionsIssued();
+
+  int authenticated = 0;
+  QList<RequestThread *> workers = fireConcurrently( count );
+  Q_FOREACH ( RequestThread *worker, workers )
+  {
+    authenticated += worker->authenticated();
+    delete worker;
+  }
+
+  // one PAOS challenge, one password check and one session; every request carries it.
+  // The IdP may see the SSO cookie of an earlier test first, which it no longer knows.
+  QCOMPARE( authenticated, count );
+  QCOMPARE( mServer->challenges(), challenges + 1 );
+  QCOMPARE( mServer->idpLogins(), idpLogins + 1 );
+  QCOMPARE( mServer->sessionsIssued(), sessions + 1 );
+}
+
+void TestQgsAuthSAML2Handshake::concurrentRequestsShareFailure()
+{
+  const int count = concurrentRequests();
+  mServer->setLatency( qMax( mockLatency(), CONCURRENT_LATENCY ) );
+  mServer->setIdpFailing( true );
+  int challenges = mServer->challenges();
+  int idpRequests = mServer->idpRequests();
+
+  int updated = 0;
+  QList<RequestThread *> workers = fireConcurrently( count );
+  Q_FOREACH ( RequestThread *worker, workers )
+  {
+    updated += worker->updated();
+    delete worker;
+  }
+
+  // every caller joined the one handshake and fails with it, the IdP is asked once
+  QCOMPARE( updated, 0 );
+  QCOMPARE( mServer->challenges(), challenges + 1 );
+  QCOMPARE( mServer->idpRequests(), idpRequests + 1 );
+}
+
+void TestQgsAuthSAML2Handshake::benchHandshakes()
+{
+  const int count = benchHandshakes();
+  QVector<qint64> latencies;
+  latencies.reserve( count );
+
+  QElapsedTimer total;
+  total.start();
+  QBENCHMARK_ONCE
+  {
+    for ( int i = 0; i < count; ++i )
+    {
+      // a method of its own per login, so each request runs the full handshake
+      QgsAuthSAML2Method method;
+      QNetworkRequest request( mServer->resourceUrl() );
+      QElapsedTimer timer;
+      timer.start();
+      QVERIFY( method.updateNetworkRequest( request, mAuthcfg ) );
+      latencies << timer.nsecsElapsed() / 1000;
+    }
+  }
+  qint64 elapsed = qMax( qint64( 1 ), total.elapsed() );
+
+  qDebug( "%d handshakes in %lld ms: %.1f handshakes/s, p50 %.2f ms, p99 %.2f ms",
+          count, elapsed, 1000.0 * count / elapsed,
+          percentile( latencies, 50 ) / 1000.0, percentile( latencies, 99 ) / 1000.0 );
+}
+
+void TestQgsAuthSAML2Handshake::longRunKeepsMemoryFlat()
+{
+  const int count = longRunHandshakes();
+  if ( count <= 0 )
+    SAML2_SKIP( "Set SAML2_LONGRUN_HANDSHAKES to run the long run, ctest does with 100000" );
+  if ( residentBytes() < 0 )
+    SAML2_SKIP( "The resident set size is only read from /proc/self/statm" );
+
+  // replies, buffers and caches reach their steady size during the warm up
+  const int warmUp = qMin( count / 10, 2000 );
+  qint64 baseline = -1;
+  qint64 peak = 0;
+
+  QElapsedTimer timer;
+  timer.start();
+  for ( int i = 0; i < count; ++i )
+  {
+    if ( i == warmUp )
+    {
+      baseline = residentBytes();
+      peak = baseline;
+    }
+    else if ( i > warmUp && i % 1000 == 0 )
+    {
+      peak = qMax( peak, residentBytes() );
+    }
+
+    // the mock remembers every session it issued; it must not be what grows
+    if ( i % 1000 == 0 )
+      mServer->dropSessions();
+
+    QgsAuthSAML2Method method;
+    QNetworkRequest request( mServer->resourceUrl() );
+    QVERIFY2( method.updateNetworkRequest( request, mAuthcfg ), qPrintable( QString( "handshake %1 failed" ).arg( i ) ) );
+    QVERIFY( !requestCookies( request ).isEmpty() );
+  }
+  qint64 end = residentBytes();
+  peak = qMax( peak, end );
+
+  // flat: what remains is allocator slack, not a share of every handshake
+  const qint64 tolerance = qMax( qint64( 4 * 1024 * 1024 ), baseline / 20 );
+  qDebug( "%d handshakes in %lld s: resident %lld KiB after %d, %lld KiB at the end, peak %lld KiB",
+          count, timer.elapsed() / 1000, baseline / 1024, warmUp, end / 1024, peak / 1024 );
+  QVERIFY2( end - baseline <= tolerance,
+            qPrintable( QString( "resident memory grew by %1 KiB, %2 KiB allowed" ).arg( ( end - baseline ) / 1024 ).arg( tolerance / 1024 ) ) );
+}
+
+void TestQgsAuthSAML2Handshake::benchSessionHits_data()
+{
+  QTest::addColumn<int>( "threads" );
+  QTest::newRow( "1 thread" ) << 1;
+  QTest::newRow( "4 threads" ) << 4;
+  QTest::newRow( "16 threads" ) << 16;
+}
+
+void TestQgsAuthSAML2Handshake::benchSessionHits()
+{
+  QFETCH( int, threads );
+  const int requests = 20000;
+
+  QNetworkRequest login( mServer->resourceUrl() );
+  QVERIFY( mMethod->updateNetworkRequest( login, mAuthcfg ) );
+
+  QList<RequestThread *> workers;
+  for ( int i = 0; i < threads; ++i )
+    workers << new RequestThread( mMethod, mAuthcfg, mServer->resourceUrl(), requests );
+
+  QElapsedTimer timer;
+  timer.start();
+  QBENCHMARK_ONCE
+  {
+    Q_FOREACH ( RequestThread *worker, workers )
+      worker->start();
+    Q_FOREACH ( RequestThread *worker, workers )
+      worker->wait();
+  }
+  qint64 elapsed = qMax( qint64( 1 ), timer.elapsed() );
+
+  Q_FOREACH ( RequestThread *worker, workers )
+  {
+    QCOMPARE( worker->authenticated(), requests );
+    delete worker;
+  }
+
+  qDebug( "%d threads: %.0f session hits/s", threads, 1000.0 * threads * requests / elapsed );
+}
+
+QTEST_MAIN( TestQgsAuthSAML2Handshake )
+#include "testqgsauthsaml2handshake.moc"